@@ -10,6 +10,7 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <ctime>
 #include <chrono>
 #include <iomanip>
@@ -17,16 +18,49 @@
 #include <cstddef>
 #include <stdexcept>
 #include<stdlib.h>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <iterator>
+#include <charconv>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdint>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <algorithm>
 
 // Forward declaration of Vector class template
 // A template class for a simplified implementation of a vector (dynamic array)
+// Elements live in raw, uninitialized storage and are constructed in place, so unused capacity
+// costs no constructor calls. Growth moves elements into the new buffer, and trivially copyable
+// types (pointers, integers) take a realloc/memcpy fast path instead of per-element copies.
 template <typename T>
 class Vector {
 private:
-    T *data;                // Pointer to dynamically allocated array for storing elements
+    T *data;                // Pointer to raw storage; only the first v_size slots hold live elements
     size_t v_size;          // Number of elements currently in the vector
     size_t v_capacity;      // Allocated space for the vector, can be larger than v_size
 
+    // True when elements can be relocated with memcpy/realloc instead of move construction
+    static constexpr bool trivial = std::is_trivially_copyable<T>::value;
+
+    // Reallocates the storage to exactly newCapacity slots (newCapacity >= v_size)
+    void reallocate(size_t newCapacity);
+    // Returns the capacity to use when one more slot is needed
+    size_t grownCapacity() const { return v_capacity < 4 ? 4 : v_capacity * 2; }
+    // Destroys the elements in [from, v_size) and shrinks the size to from
+    void destroyFrom(size_t from);
+
 public:
 
     // Returns an iterator pointing to the first element
@@ -45,15 +79,19 @@ public:
     }
 
 
-    // Constructor: initializes a vector with a given capacity (default 0)
-    explicit Vector(size_t cap = 0);     
-    // Destructor: responsible for freeing the allocated memory
-    ~Vector(); 
+    // Constructor: initializes a vector with a given capacity (default 0, no allocation)
+    explicit Vector(size_t cap = 0);
+    // Destructor: destroys the elements and frees the storage
+    ~Vector();
+
+    // Move construction and assignment steal the other vector's buffer
+    Vector(Vector&& other) noexcept;
+    Vector& operator=(Vector&& other) noexcept;
 
     // Returns the number of elements in the vector
-    size_t size() const;                 
+    size_t size() const;
     // Returns the current capacity of the vector
-    size_t capacity() const;             
+    size_t capacity() const;
     // Checks if the vector is empty (i.e., size is zero)
     bool empty() const;
 
@@ -61,12 +99,19 @@ public:
     const T& front() const;              // Access the first element
     const T& back() const;               // Access the last element
     T& operator[](size_t index);         // Access specified element without bounds checking
+    const T& operator[](size_t index) const { return data[index]; }
     T& at(size_t index);                 // Access specified element with bounds checking
 
     // Modifiers:
     void push_back(const T& element);    // Add element to the end of the vector
+    void push_back(T&& element);         // Move element to the end of the vector
+    template <typename... Args>
+    T& emplace_back(Args&&... args);     // Construct an element in place at the end
+    void pop_back();                     // Remove the last element
     void insert(size_t index, const T& element); // Insert element at specified index
+    void insert(size_t index, T&& element);      // Move element into the specified index
     void erase(size_t index);            // Erase element at specified index
+    void reserve(size_t cap);            // Make room for at least cap elements
     void shrink_to_fit();                // Reduce capacity to fit the size exactly
     void display() const;                // Prints all elements for debugging
 
@@ -74,30 +119,90 @@ public:
     Vector(const Vector&) = delete;
     Vector& operator=(const Vector&) = delete;
 
-    // Disable move construction and assignment for simplicity
-    Vector(Vector&&) = delete;
-    Vector& operator=(Vector&&) = delete;
-    
-    void clear() { v_size = 0; }
+    void clear() { destroyFrom(0); }
+    T* begin() { return data; }
+    T* end() { return data + v_size; }
     const T* begin() const { return data; }
     const T* end() const { return data + v_size; }
-   
+
 };
 
 // Constructor definition
 template <typename T>
-Vector<T>::Vector(size_t cap) : v_size(0), v_capacity(cap), data(new T[cap]) {
-    // Ensuring there's always a non-zero capacity to avoid divisions by zero during resizing
-    if (cap == 0) {
-        v_capacity = 1;
+Vector<T>::Vector(size_t cap) : data(nullptr), v_size(0), v_capacity(0) {
+    // Storage is only allocated when a capacity is requested or the first element arrives
+    if (cap > 0) {
+        reallocate(cap);
     }
 }
 
 // Destructor definition
 template <typename T>
 Vector<T>::~Vector() {
-    // Freeing the allocated memory
-    delete[] data;
+    // Destroying the live elements, then freeing the raw storage
+    destroyFrom(0);
+    std::free(data);
+}
+
+// Move constructor: takes over the other vector's buffer and leaves it empty
+template <typename T>
+Vector<T>::Vector(Vector&& other) noexcept : data(other.data), v_size(other.v_size), v_capacity(other.v_capacity) {
+    other.data = nullptr;
+    other.v_size = 0;
+    other.v_capacity = 0;
+}
+
+// Move assignment: releases our elements and takes over the other vector's buffer
+template <typename T>
+Vector<T>& Vector<T>::operator=(Vector&& other) noexcept {
+    if (this != &other) {
+        destroyFrom(0);
+        std::free(data);
+        data = other.data;
+        v_size = other.v_size;
+        v_capacity = other.v_capacity;
+        other.data = nullptr;
+        other.v_size = 0;
+        other.v_capacity = 0;
+    }
+    return *this;
+}
+
+// Function to move the elements into a buffer of a new capacity
+template <typename T>
+void Vector<T>::reallocate(size_t newCapacity) {
+    if constexpr (trivial) {
+        // Trivially copyable elements can be relocated by realloc, often without copying at all
+        void* grown = std::realloc(data, newCapacity * sizeof(T));
+        if (grown == nullptr && newCapacity > 0) {
+            throw std::bad_alloc();
+        }
+        data = static_cast<T*>(grown);
+    } else {
+        T* new_data = static_cast<T*>(std::malloc(newCapacity * sizeof(T)));
+        if (new_data == nullptr && newCapacity > 0) {
+            throw std::bad_alloc();
+        }
+        // Moving existing elements to the new buffer and ending the old elements' lifetimes
+        for (size_t i = 0; i < v_size; ++i) {
+            new (&new_data[i]) T(std::move(data[i]));
+            data[i].~T();
+        }
+        std::free(data);
+        data = new_data;
+    }
+    v_capacity = newCapacity;
+}
+
+// Function to destroy the elements from an index to the end
+template <typename T>
+void Vector<T>::destroyFrom(size_t from) {
+    if (!trivial) {
+        for (size_t i = from; i < v_size; ++i) {
+            data[i].~T();
+        }
+    }
+    v_size = from;
 }
 
 // Function to add an element at the end of the vector
@@ -105,22 +210,43 @@ template <typename T>
 void Vector<T>::push_back(const T& element) {
     // Check if there is enough room for a new element
     if (v_size >= v_capacity) {
-        // Not enough space: we need to allocate a larger array
-        v_capacity *= 2; // Doubling the capacity
-        T* new_data = new T[v_capacity];
-        
-        // Copying existing elements to the new array
-        for (size_t i = 0; i < v_size; ++i) {
-            new_data[i] = data[i];
-        }
+        // The element may live inside our own buffer, so take a copy before the buffer moves
+        T copy(element);
+        reallocate(grownCapacity());
+        new (&data[v_size++]) T(std::move(copy));
+        return;
+    }
 
-        // Deleting old array and updating the pointer
-        delete[] data;
-        data = new_data;
+    // Constructing the new element in place and incrementing size
+    new (&data[v_size++]) T(element);
+}
+
+// Function to move an element to the end of the vector
+template <typename T>
+void Vector<T>::push_back(T&& element) {
+    emplace_back(std::move(element));
+}
+
+// Function to construct an element in place at the end of the vector
+template <typename T>
+template <typename... Args>
+T& Vector<T>::emplace_back(Args&&... args) {
+    if (v_size >= v_capacity) {
+        // Arguments may refer into our own buffer, so build the element before the buffer moves
+        T element(std::forward<Args>(args)...);
+        reallocate(grownCapacity());
+        return *new (&data[v_size++]) T(std::move(element));
     }
-    
-    // Inserting the new element and incrementing size
-    data[v_size++] = element;
+    return *new (&data[v_size++]) T(std::forward<Args>(args)...);
+}
+
+// Function to remove the last element
+template <typename T>
+void Vector<T>::pop_back() {
+    if (empty()) {
+        throw std::out_of_range("Vector is empty");
+    }
+    destroyFrom(v_size - 1);
 }
 
 // Function to insert an element at the specified index
@@ -130,35 +256,40 @@ void Vector<T>::insert(size_t index, const T& element) {
     if (index > v_size) {
         throw std::out_of_range("Index out of range");
     }
+    // Copying first keeps the element valid if it lives inside our own buffer
+    insert(index, T(element));
+}
+
+// Function to move an element into the specified index
+template <typename T>
+void Vector<T>::insert(size_t index, T&& element) {
+    // Check for valid index
+    if (index > v_size) {
+        throw std::out_of_range("Index out of range");
+    }
 
     // Check if the current capacity can accommodate the new element
     if (v_size >= v_capacity) {
-        // Not enough space: we need to allocate a larger array
-        v_capacity *= 2; // Doubling the capacity
-        T* new_data = new T[v_capacity];
-
-        // Copying elements up to the index
-        for (size_t i = 0; i < index; ++i) {
-            new_data[i] = data[i];
-        }
-
-        // Shifting the subsequent elements to make space for the new element
-        for (size_t i = index; i < v_size; ++i) {
-            new_data[i + 1] = data[i];
-        }
+        T moved(std::move(element));
+        reallocate(grownCapacity());
+        insert(index, std::move(moved));
+        return;
+    }
 
-        // Releasing old array and updating the pointer
-        delete[] data;
-        data = new_data;
+    if (trivial) {
+        // Shifting the subsequent elements with a single memmove
+        std::memmove(static_cast<void*>(&data[index + 1]), static_cast<const void*>(&data[index]), (v_size - index) * sizeof(T));
+        new (&data[index]) T(std::move(element));
+    } else if (index == v_size) {
+        new (&data[index]) T(std::move(element));
     } else {
-        // Enough space: just shift elements to make space
-        for (size_t i = v_size; i > index; --i) {
-            data[i] = data[i - 1];
+        // The last element moves into the uninitialized slot, the rest shift by move assignment
+        new (&data[v_size]) T(std::move(data[v_size - 1]));
+        for (size_t i = v_size - 1; i > index; --i) {
+            data[i] = std::move(data[i - 1]);
         }
+        data[index] = std::move(element);
     }
-
-    // Insert the new element and increment size
-    data[index] = element;
     ++v_size;
 }
 
@@ -170,13 +301,28 @@ void Vector<T>::erase(size_t index) {
         throw std::out_of_range("Index out of range");
     }
 
+    if (trivial) {
+        // Closing the gap with a single memmove
+        std::memmove(static_cast<void*>(&data[index]), static_cast<const void*>(&data[index + 1]), (v_size - index - 1) * sizeof(T));
+        --v_size;
+        return;
+    }
+
     // Shift elements to fill the gap left by the removed element
     for (size_t i = index; i < v_size - 1; ++i) {
-        data[i] = data[i + 1];
+        data[i] = std::move(data[i + 1]);
     }
 
-    // Decrease size after removing the element
-    --v_size;
+    // Destroy the now moved-from last slot
+    destroyFrom(v_size - 1);
+}
+
+// Function to make room for at least cap elements without changing the size
+template <typename T>
+void Vector<T>::reserve(size_t cap) {
+    if (cap > v_capacity) {
+        reallocate(cap);
+    }
 }
 
 // Function to access an element without bounds checking
@@ -234,13 +380,13 @@ bool Vector<T>::empty() const {
 template <typename T>
 void Vector<T>::shrink_to_fit() {
     if (v_capacity > v_size) {
-        T* new_data = new T[v_size];
-        for (size_t i = 0; i < v_size; ++i) {
-            new_data[i] = data[i];
+        if (v_size == 0) {
+            std::free(data);
+            data = nullptr;
+            v_capacity = 0;
+        } else {
+            reallocate(v_size);
         }
-        delete[] data;
-        data = new_data;
-        v_capacity = v_size;
     }
 }
 
@@ -254,6 +400,105 @@ void Vector<T>::display() const {
 }
 
 
+// A vector with inline room for N elements: the first N live inside the object itself and the
+// heap is only used once there are more. Built for the many tiny directories, whose child lists
+// then cost no allocation at all. Elements must be trivially copyable (pointers, ids), so
+// spilling to the heap and closing gaps are plain memcpy/memmove.
+template <typename T, size_t N>
+class SmallVector {
+private:
+    static_assert(std::is_trivially_copyable<T>::value, "SmallVector elements must be trivially copyable");
+
+    T* data;                // inlineData until the elements spill to the heap
+    size_t v_size;          // Number of elements currently in the vector
+    size_t v_capacity;      // N while inline, the heap buffer's size after that
+    T inlineData[N];        // Storage for the first N elements
+
+    // Moves the elements into a heap buffer of newCapacity slots (newCapacity > N)
+    void grow(size_t newCapacity) {
+        T* grown;
+        if (data == inlineData) {
+            grown = static_cast<T*>(std::malloc(newCapacity * sizeof(T)));
+            if (grown != nullptr) {
+                std::memcpy(static_cast<void*>(grown), static_cast<const void*>(inlineData), v_size * sizeof(T));
+            }
+        } else {
+            grown = static_cast<T*>(std::realloc(data, newCapacity * sizeof(T)));
+        }
+        if (grown == nullptr) {
+            throw std::bad_alloc();
+        }
+        data = grown;
+        v_capacity = newCapacity;
+    }
+
+public:
+    // Constructor: starts inline, no allocation
+    SmallVector() : data(inlineData), v_size(0), v_capacity(N) {}
+    // Destructor: frees the heap buffer if the elements ever spilled
+    ~SmallVector() {
+        if (data != inlineData) {
+            std::free(data);
+        }
+    }
+
+    // Disable copy construction and assignment for simplicity
+    SmallVector(const SmallVector&) = delete;
+    SmallVector& operator=(const SmallVector&) = delete;
+
+    size_t size() const { return v_size; }
+    size_t capacity() const { return v_capacity; }
+    bool empty() const { return v_size == 0; }
+    // True while the elements still fit in the inline storage
+    bool isInline() const { return data == inlineData; }
+
+    T& operator[](size_t index) { return data[index]; }
+    const T& operator[](size_t index) const { return data[index]; }
+    T* begin() { return data; }
+    T* end() { return data + v_size; }
+    const T* begin() const { return data; }
+    const T* end() const { return data + v_size; }
+
+    // Adds an element at the end, spilling to the heap (and doubling from there) when full
+    void push_back(const T& element) {
+        if (v_size == v_capacity) {
+            T copy = element;  // The element may live in the buffer that is about to move
+            grow(v_capacity * 2);
+            data[v_size++] = copy;
+            return;
+        }
+        data[v_size++] = element;
+    }
+
+    // Removes the last element
+    void pop_back() {
+        if (empty()) {
+            throw std::out_of_range("Vector is empty");
+        }
+        --v_size;
+    }
+
+    // Removes the element at an index, closing the gap with a single memmove
+    void erase(size_t index) {
+        if (index >= v_size) {
+            throw std::out_of_range("Index out of range");
+        }
+        std::memmove(static_cast<void*>(&data[index]), static_cast<const void*>(&data[index + 1]),
+                     (v_size - index - 1) * sizeof(T));
+        --v_size;
+    }
+
+    // Makes room for at least cap elements without changing the size
+    void reserve(size_t cap) {
+        if (cap > v_capacity) {
+            grow(cap);
+        }
+    }
+
+    void clear() { v_size = 0; }
+};
+
+
 // Definition of Stack class template
 template <typename T>
 class Stack {
@@ -271,13 +516,23 @@ public:
         elements.push_back(element);
     }
 
+    // Move an element onto the stack
+    void push(T&& element) {
+        elements.push_back(std::move(element));
+    }
+
+    // Reserve room for a known number of elements
+    void reserve(size_t count) {
+        elements.reserve(count);
+    }
+
     // Pop an element from the stack
     T pop() {
         if (isEmpty()) {
             throw std::out_of_range("Stack Underflow");
         }
-        T topElement = elements.back();
-        elements.erase(elements.size() - 1); // Removing the last element
+        T topElement = std::move(elements[elements.size() - 1]);
+        elements.pop_back(); // Removing the last element
         return topElement;
     }
 
@@ -291,19 +546,21 @@ public:
 };
 
 
+// Definition of Queue class template: a FIFO queue on a circular buffer that doubles when full
 template <typename T>
 class Queue {
     T* begin() { return nullptr; } // Dummy implementation
     T* end() { return nullptr; } // Dummy implementation
 private:
-    T *array;              // Dynamic array for storing queue elements
-    int capacity;          // Maximum capacity of the queue
-    int size;              // Size of the queue
-    int front;             // Index of the front element in the queue
-    int rear;              // Index where a new element will be added
+    T *array;              // Circular buffer for storing queue elements
+    size_t capacity;       // Current capacity of the buffer, doubles when the queue fills it
+    size_t size;           // Size of the queue
+    size_t front;          // Index of the front element in the queue
+
+    void grow();           // Doubles the buffer, unwrapping the elements to its start
 
 public:
-    explicit Queue(int capacity = 10); // Constructor with default capacity value
+    explicit Queue(size_t capacity = 10); // Constructor with default initial capacity
     // Method to get the size of the queue
 
      size_t getSize() const {
@@ -313,14 +570,21 @@ public:
     
     ~Queue();                          // Destructor to free allocated memory
 
-    void enqueue(T element);  // Add an element to the queue
+    void enqueue(T element);  // Add an element to the queue, growing it if needed
     T dequeue();              // Remove and return the front element from the queue
     bool isEmpty() const;     // Check if the queue is empty
-    bool isFull() const;      // Check if the queue is full
-    T front_element() const;  // Get the front element of the queue
+    T& front_element();       // Get the front element of the queue
+    T& at(size_t index);      // Get the element `index` positions behind the front
+    const T& at(size_t index) const;
+    void clear();             // Remove every element
+    void swap(Queue& other);  // Exchange contents with another queue in O(1)
 
     // Display function should not be a friend, it can be a member or non-member function
     void display() const; // Print all elements in the queue for debugging
+
+    // Disable copy construction and assignment for simplicity
+    Queue(const Queue&) = delete;
+    Queue& operator=(const Queue&) = delete;
 };
 
 //================================================
@@ -330,7 +594,7 @@ public:
 
 // Queue constructor implementation
 template<typename T>
-Queue<T>::Queue(int cap) : capacity(cap), size(0), front(0), rear(-1) {
+Queue<T>::Queue(size_t cap) : capacity(cap > 0 ? cap : 1), size(0), front(0) {
     array = new T[capacity]; // Allocating memory for the queue's internal array
 }
 
@@ -340,14 +604,26 @@ Queue<T>::~Queue() {
     delete[] array; // Freeing the dynamically allocated memory for the internal array
 }
 
+// Grow implementation - moves the elements into a buffer twice the size
+template<typename T>
+void Queue<T>::grow() {
+    T* grown = new T[capacity * 2];
+    for (size_t i = 0; i < size; ++i) {
+        grown[i] = std::move(array[(front + i) % capacity]); // Oldest element lands at index 0
+    }
+    delete[] array;
+    array = grown;
+    capacity *= 2;
+    front = 0;
+}
+
 // Enqueue implementation - adds an element to the queue
 template<typename T>
 void Queue<T>::enqueue(T element) {
-    if (isFull()) {
-        throw std::runtime_error("Queue Full"); // Throwing an exception if the queue is full
+    if (size == capacity) {
+        grow(); // A full buffer doubles instead of rejecting the element
     }
-    rear = (rear + 1) % capacity; // Calculating the new rear position in a circular manner
-    array[rear] = element; // Adding the element to the queue
+    array[(front + size) % capacity] = std::move(element); // Adding the element behind the last one
     size++; // Incrementing the size of the queue
 }
 
@@ -357,7 +633,7 @@ T Queue<T>::dequeue() {
     if (isEmpty()) {
         throw std::runtime_error("Queue Empty"); // Throwing an exception if the queue is empty
     }
-    T element = array[front]; // Storing the front element to return
+    T element = std::move(array[front]); // Storing the front element to return
     front = (front + 1) % capacity; // Updating the front index in a circular manner
     size--; // Decrementing the size of the queue
     return element; // Returning the front element
@@ -369,688 +645,7471 @@ bool Queue<T>::isEmpty() const {
     return size == 0; // Queue is empty if size is 0
 }
 
-// Implementation to check if the queue is full
-template<typename T>
-bool Queue<T>::isFull() const {
-    return size == capacity; // Queue is full if size equals capacity
-}
-
 // Implementation to get the front element of the queue
 template<typename T>
-T Queue<T>::front_element() const {
+T& Queue<T>::front_element() {
     if (isEmpty()) {
         throw std::runtime_error("Queue Empty"); // Throwing an exception if the queue is empty
     }
     return array[front]; // Returning the front element
 }
 
+// Implementation to get an element by its position from the front of the queue
+template<typename T>
+T& Queue<T>::at(size_t index) {
+    if (index >= size) {
+        throw std::out_of_range("Queue index out of range"); // Throwing an exception for a bad position
+    }
+    return array[(front + index) % capacity]; // Positions wrap around like the queue itself
+}
+
+template<typename T>
+const T& Queue<T>::at(size_t index) const {
+    if (index >= size) {
+        throw std::out_of_range("Queue index out of range");
+    }
+    return array[(front + index) % capacity];
+}
+
+// Implementation to remove every element, keeping the buffer
+template<typename T>
+void Queue<T>::clear() {
+    while (!isEmpty()) {
+        dequeue();
+    }
+}
+
+// Implementation to exchange the buffers of two queues
+template<typename T>
+void Queue<T>::swap(Queue& other) {
+    std::swap(array, other.array);
+    std::swap(capacity, other.capacity);
+    std::swap(size, other.size);
+    std::swap(front, other.front);
+}
+
 // Display function to print all elements of the queue
 template<typename T>
 void Queue<T>::display() const {
-    for (int i = 0; i < size; ++i) {
+    for (size_t i = 0; i < size; ++i) {
         std::cout << array[(front + i) % capacity] << " "; // Printing elements in a circular manner
     }
     std::cout << std::endl;
 }
 
-class Inode {
-public:
-    enum class Type { File, Directory };
-    Type type;
-    std::string name;
-    size_t size;  // Size of the file, or total size of files in the directory
-    std::string date;  // For simplicity, the date is a string
-    Inode* parent;
-    Vector<Inode*> children;  // Only used if the inode is a directory
+// Forward declaration of Inode so the child index can hold pointers to it
+class Inode;
+// Forward declaration of the on-disk image record, referenced by not-yet-loaded directories
+struct ImageInode;
 
-    // Constructor
-    Inode(std::string name, Type type, size_t size = 0, std::string date = "", Inode* parent = nullptr)
-        : name(name), type(type), size(size), date(date), parent(parent) {}
+// Directories with up to this many entries keep their children and size order inline and are
+// searched by scanning the names, with no hash index
+static const size_t SMALL_DIRECTORY = 8;
 
-    // Add a child inode (only if it's a directory)
-    void addChild(Inode* child) {
-        if (this->type == Type::Directory) {
-            children.push_back(child);
-            child->parent = this;
-            // Update the size of the directory inode
-            this->size += child->size;
-        }
-    }
+// Open-addressing hash index from a child's name to the child inode.
+// Every directory with more than SMALL_DIRECTORY entries keeps one next to its children so name
+// lookups are O(1) on average instead of a linear scan with string comparisons. Uses linear probing with backward-shift
+// deletion, so no tombstones build up when entries are removed.
+class ChildIndex {
+private:
+    struct Slot {
+        size_t hash;        // Cached hash of the child's name (avoids rehashing names on growth)
+        Inode* node;        // Child inode, nullptr if the slot is free
+    };
 
-    // Method to get the full path of the inode
-    std::string getFullPath() const {
-        std::string path = "";
-        const Inode* current = this;
-        while (current) {
-            if (!current->name.empty()) {
-                path = "/" + current->name + path;
-            }
-            current = current->parent;
+    Slot* slots;            // Table of slots, capacity is always zero or a power of two
+    size_t capacity;        // Number of slots in the table
+    size_t count;           // Number of children stored in the table
+
+    // Grows the table to the given capacity and reinserts every entry
+    void rehash(size_t newCapacity);
+
+public:
+    // FNV-1a hash of a name
+    static size_t hashName(std::string_view name) {
+        size_t h = 14695981039346656037ULL;
+        for (unsigned char c : name) {
+            h ^= c;
+            h *= 1099511628211ULL;
         }
-        return path.empty() ? "/" : path;
+        return h;
     }
 
-    // Destructor
-    ~Inode() {
-        for (size_t i = 0; i < children.size(); ++i) {
-            delete children[i];
-        }
+    // Constructor: the table is allocated lazily on the first insert
+    ChildIndex() : slots(nullptr), capacity(0), count(0) {}
+    // Destructor: frees the slot table (the inodes themselves are owned by the tree)
+    ~ChildIndex() { delete[] slots; }
+
+    // Returns the number of indexed children
+    size_t size() const { return count; }
+
+    Inode* find(std::string_view name) const;   // Finds a child by name, nullptr if absent
+    void reserve(size_t children);              // Sizes the table for a known number of children
+    void insert(Inode* child);                  // Indexes a child under its name
+    bool erase(Inode* child);                   // Removes a child from the index
+
+    // Removes every entry and frees the table
+    void clear() {
+        delete[] slots;
+        slots = nullptr;
+        capacity = 0;
+        count = 0;
     }
 
     // Disable copy construction and assignment for simplicity
-    Inode(const Inode&) = delete;
-    Inode& operator=(const Inode&) = delete;
-
-    // Disable move construction and assignment for simplicity
-    Inode(Inode&&) = delete;
-    Inode& operator=(Inode&&) = delete;
+    ChildIndex(const ChildIndex&) = delete;
+    ChildIndex& operator=(const ChildIndex&) = delete;
 };
 
-
-// Definition of FileSystem class
-class FileSystem {
+// Size-ordered view over a directory's children, kept as an indexed binary max-heap.
+// Each child remembers its heap slot (Inode::orderPos) so a size change only sifts that one
+// entry. ls walks the heap largest-first without sorting or reordering the children vector.
+class SizeOrder {
 private:
-    Inode* rootInode;      // Root of the file system
-    Inode* currentInode;   // Pointer to the current inode (directory)
-    Inode* previousInode;  // Previous working directory for 'cd -'
-    static const int MAXBIN = 10;
-    Queue<Inode*> removalQueue; // Queue to store removed inodes
-
+    SmallVector<Inode*, SMALL_DIRECTORY> heap;  // Binary heap, largest total size at index 0
 
+    // Returns true if a should be listed before b (larger first, ties by name)
+    static bool before(const Inode* a, const Inode* b);
+    // Stores a node at a heap slot and records the slot in the node
+    void place(size_t pos, Inode* node);
+    void siftUp(size_t pos);    // Moves an entry towards the top while it beats its parent
+    void siftDown(size_t pos);  // Moves an entry towards the leaves while a child beats it
 
-    std::string getCurrentDate() {
-    // Get the current time as a time_point
-    auto now = std::chrono::system_clock::now();
-
-    // Convert it to a time_t object
-    auto now_c = std::chrono::system_clock::to_time_t(now);
+public:
+    // Returns the number of entries in the view
+    size_t size() const { return heap.size(); }
 
-    // Convert time_t to tm struct
-    std::tm now_tm = *std::localtime(&now_c);
+    void insert(Inode* child);  // Adds a child to the view
+    void erase(Inode* child);   // Removes a child from the view
+    void update(Inode* child);  // Restores the order after the child's total size changed
 
-    // Use stringstream for formatting
-    std::stringstream ss;
-    ss << std::put_time(&now_tm, "%Y-%m-%d %H:%M:%S");
+    // Calls visit(child) for the n largest children, largest first
+    // Only the visited entries and their heap neighbours are touched: O(n log n)
+    template <typename Visit>
+    void forLargest(size_t n, Visit visit) const;
+};
 
-    return ss.str();
-}
+// One-word reader-writer lock, one per directory.
+// Guards the directory's children, child index and size order, and the totals of its children
+// (the size order is keyed on them). Any number of readers share it; a writer excludes everyone.
+// A waiting writer sets WAITING, which holds off new readers so writers are not starved.
+// Critical sections are a few probes long, so waiters yield instead of sleeping.
+// Has the lock/lock_shared interface, so std::unique_lock and std::shared_lock work with it.
+class DirLock {
+private:
+    static const uint32_t WRITER = 1;   // Held exclusively
+    static const uint32_t WAITING = 2;  // A writer is waiting for the readers to leave
+    static const uint32_t READER = 4;   // One shared holder (the count lives above the flag bits)
+    std::atomic<uint32_t> state{0};
 
- // Helper method to calculate the total size of a directory
-    size_t calculateFolderSize(const Inode* node) const {
-        if (!node || node->type == Inode::Type::File) {
-            return node ? node->size : 0;
+public:
+    void lock_shared() {
+        uint32_t s = state.load(std::memory_order_relaxed);
+        while (true) {
+            if (s & (WRITER | WAITING)) {
+                std::this_thread::yield();
+                s = state.load(std::memory_order_relaxed);
+            } else if (state.compare_exchange_weak(s, s + READER, std::memory_order_acquire,
+                                                   std::memory_order_relaxed)) {
+                return;
+            }
         }
+    }
 
-        size_t totalSize = node->size; // Start with the directory's own size
-        for (const auto& child : node->children) {
-            totalSize += calculateFolderSize(child); // Recursively sum the sizes
-        }
-        return totalSize;
+    void unlock_shared() {
+        state.fetch_sub(READER, std::memory_order_release);
     }
 
-    // This helper method constructs the full path of an inode
-    // It starts from the given inode and traverses up to the root, appending each directory name to the path
-    std::string constructPath(const Inode* inode) const {
-        // If the inode is the root, its path is simply "/"
-        if (inode->name == "/") {
-            return "/";
+    void lock() {
+        uint32_t s = state.load(std::memory_order_relaxed);
+        while (true) {
+            if ((s & ~WAITING) == 0) {
+                // Free (perhaps with our own WAITING flag): take it and clear the flag
+                if (state.compare_exchange_weak(s, WRITER, std::memory_order_acquire, std::memory_order_relaxed)) {
+                    return;
+                }
+            } else if (!(s & WAITING) && !state.compare_exchange_weak(s, s | WAITING, std::memory_order_relaxed)) {
+                continue; // s was reloaded by the failed exchange
+            } else {
+                std::this_thread::yield();
+                s = state.load(std::memory_order_relaxed);
+            }
         }
+    }
 
-        // Initialize an empty string to hold the path
-        std::string path;
-        // Traverse up the tree until we reach the root
-        while (inode != nullptr && inode->name != "/") {
-            // Prepend the current directory name to the path
-            path = "/" + inode->name + path;
-            // Move up to the parent directory
-            inode = inode->parent;
-        }
-        // Return the constructed path
-        return path;
+    void unlock() {
+        state.fetch_and(~WRITER, std::memory_order_release);
     }
+};
 
-     // This helper function navigates to a specified path and returns the inode at that path
-     Inode* navigateToPath(const std::string& path) const {
-         // If the path is empty or root, return the rootInode
-         if (path.empty() || path == "/") {
-             return rootInode;
-         }
-
-         // Start from the root if the path is absolute, else start from the current directory
-         Inode* targetInode = (path[0] == '/') ? rootInode : currentInode;
-         std::istringstream iss(path);
-         std::string token;
-
-         // Split the path by '/' and navigate through each directory
-         while (std::getline(iss, token, '/')) {
-             // Skip empty tokens and '.'
-             if (token.empty() || token == ".") continue; 
-             // If token is '..', move up to the parent directory but not above root
-             if (token == "..") {
-                 if (targetInode != rootInode) {
-                     targetInode = targetInode->parent;
-                 }
-                 continue;
-             }
-
-             // Search for the directory in the current inode's children
-             bool found = false;
-             for (auto& child : targetInode->children) {
-                 // If the directory is found, move to it
-                 if (child->name == token && child->type == Inode::Type::Directory) {
-                     targetInode = child;
-                     found = true;
-                     break;
-                 }
-             }
-
-             // If the directory is not found in the path, return nullptr
-             if (!found) {
-                 return nullptr; 
-             }
-         }
-
-         // Return the target inode
-         return targetInode;
-     }
+// A past state of a directory, kept for the snapshots that were taken before it changed.
+// A file a snapshot has seen never changes (mv only moves it, and a write goes to a copy that
+// takes its place) and a directory's name, size and times are fixed too, so its children and
+// totals are all a snapshot needs to keep.
+struct DirVersion {
+    uint32_t epoch;             // Snapshots with ids up to this one (and above the next older version's) see this state
+    size_t totalSize;           // The directory's totals at the time
+    size_t totalInodes;
+    Vector<Inode*> children;    // Its children at the time, in no particular order
+    DirVersion* older;          // Next older version, nullptr for the oldest
+};
 
-public:
-    // Constructor
-    FileSystem(): removalQueue(MAXBIN) {
-        // Initialize the root inode as the starting point
-        rootInode = new Inode("/", Inode::Type::Directory);
-        currentInode = rootInode;  // Set currentInode to the root
-        previousInode = nullptr;   // Initialize previousInode
+// The part of an inode only directories have, allocated with the directory. Files use the
+// same pointer for their contents (FileData), so a file inode stays at 128 bytes.
+struct DirData {
+    SmallVector<Inode*, SMALL_DIRECTORY> children;  // Unordered, inline while the directory is small
+    ChildIndex childIndex;    // Name -> child lookup, empty until there are more than SMALL_DIRECTORY children
+    SizeOrder sizeOrder;      // Children ordered by total size
+    // Image record whose children are not built yet; cleared (under the lock) once they are
+    std::atomic<const ImageInode*> pendingChildren{nullptr};
+    DirVersion* versions = nullptr;       // States kept for snapshots, newest first (guarded by the lock)
+
+    DirData() = default;
+    ~DirData() { dropVersions(); }
+
+    // Frees the kept versions, oldest last, without recursing
+    void dropVersions() {
+        while (versions != nullptr) {
+            DirVersion* older = versions->older;
+            delete versions;
+            versions = older;
+        }
+    }
 
-        // Create test inodes (as children of the root) for the ls Method
-        Inode* file1 = new Inode("file1.txt", Inode::Type::File, 200, "2023-03-01");
-        Inode* file2 = new Inode("file2.txt", Inode::Type::File, 200, "2023-03-02");
-        Inode* dir1 = new Inode("dir1", Inode::Type::Directory);
+    // Disable copy construction and assignment for simplicity
+    DirData(const DirData&) = delete;
+    DirData& operator=(const DirData&) = delete;
+};
 
-        rootInode->addChild(file1);
-        rootInode->addChild(file2);
-        rootInode->addChild(dir1);
-    }
+// Fixed-size blocks holding the contents of files.
+// Blocks are carved out of 1 MiB chunks that are mapped on demand, from anonymous memory or from
+// a backing file (--blocks), and a chunk never moves once mapped, so a block's address is stable.
+// A bitmap marks the blocks in use and is searched a word (64 blocks) at a time from the lowest
+// word that can have a free bit. A file that snapshots keep shares its blocks with the copy that
+// replaced it in the tree until the copy writes them, so each block also has a reference count.
+// Allocation and release take a mutex: the reclaimer thread releases the blocks of the files it
+// frees, and directories built from an image allocate blocks for their files in any session.
+class BlockStore {
+public:
+    static constexpr size_t BLOCK_SIZE = 4096;
+    static constexpr uint32_t NO_BLOCK = UINT32_MAX;
 
-    // Destructor
-    ~FileSystem() {
-        // Free the memory allocated for the root inode, which in turn
-        // should recursively delete all child inodes
-        delete rootInode;
+private:
+    static constexpr size_t CHUNK_BLOCKS = 256;                 // Blocks per mapping
+    static constexpr size_t CHUNK_BYTES = CHUNK_BLOCKS * BLOCK_SIZE;
+    static constexpr size_t MAX_CHUNKS = 65536;                 // 64 GiB of contents
+
+    char** chunks = nullptr;    // MAX_CHUNKS slots, allocated with the first chunk so it never moves
+    size_t chunkCount = 0;
+    Vector<uint64_t> usedBits;  // One bit per block, set while the block is in use
+    Vector<uint32_t> refs;      // Files holding each block
+    size_t searchFrom = 0;      // No word before this one has a free bit
+    size_t usedBlocks = 0;
+    size_t copies = 0;          // Shared blocks copied because one of their holders wrote them
+    int backingFd = -1;         // Backing file, -1 for anonymous memory
+    std::string backingPath;
+    mutable std::mutex lock;
+
+    // Maps one more chunk and grows the bitmap and counts over it; false when that fails
+    bool addChunk() {
+        if (chunkCount == MAX_CHUNKS) {
+            return false;
+        }
+        if (chunks == nullptr) {
+            chunks = new char*[MAX_CHUNKS];
+        }
+        void* mapping;
+        if (backingFd >= 0) {
+            off_t end = static_cast<off_t>((chunkCount + 1) * CHUNK_BYTES);
+            if (ftruncate(backingFd, end) != 0) {
+                return false;
+            }
+            mapping = mmap(nullptr, CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, backingFd,
+                           static_cast<off_t>(chunkCount * CHUNK_BYTES));
+        } else {
+            mapping = mmap(nullptr, CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        }
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+        chunks[chunkCount++] = static_cast<char*>(mapping);
+        for (size_t i = 0; i < CHUNK_BLOCKS / 64; ++i) {
+            usedBits.push_back(0);
+        }
+        for (size_t i = 0; i < CHUNK_BLOCKS; ++i) {
+            refs.push_back(0);
+        }
+        return true;
     }
 
-    // Public interface to calculate the size of the current directory
-    // Method to get the size of a specific folder or file by name
-    size_t size(const std::string& name) const {
-        // Check if the name matches any child of the current inode
-        for (const auto& child : currentInode->children) {
-            if (child->name == name) {
-                // Found the child, return its size
-                return calculateFolderSize(child);
+    // Takes a free block, `preferred` if it is free; the caller holds the lock
+    uint32_t allocateLocked(uint32_t preferred) {
+        size_t block = preferred;
+        if (preferred == NO_BLOCK || preferred >= refs.size() || refs[preferred] != 0) {
+            size_t word = searchFrom;
+            while (word < usedBits.size() && usedBits[word] == ~0ULL) {
+                ++word;
             }
+            searchFrom = word;
+            if (word == usedBits.size() && !addChunk()) {
+                return NO_BLOCK;
+            }
+            block = word * 64 + __builtin_ctzll(~usedBits[word]);
         }
+        usedBits[block / 64] |= 1ULL << (block % 64);
+        refs[block] = 1;
+        ++usedBlocks;
+        return static_cast<uint32_t>(block);
+    }
 
-        // If the name doesn't match any child, handle as an error or return 0
-        std::cout << "Error: No file or folder named '" << name << "' found." << std::endl;
-        return 0;
+public:
+    BlockStore() = default;
+
+    // Destructor: unmaps the chunks (the backing file keeps whatever was written to it)
+    ~BlockStore() {
+        for (size_t i = 0; i < chunkCount; ++i) {
+            munmap(chunks[i], CHUNK_BYTES);
+        }
+        delete[] chunks;
+        if (backingFd >= 0) {
+            close(backingFd);
+        }
     }
 
-    // help method - displays help information
-    void help() const {
-        std::cout << "\nWelcome to the Virtual File System (VFS)!\n";
-        std::cout << "Here are the available commands you can use:\n\n";
-        std::cout << "help: Displays this help menu.\n";
-        std::cout << "pwd: Shows the path of the current inode.\n";
-        std::cout << "ls: Lists the children of the current inode.\n";
-        std::cout << "mkdir <foldername>: Creates a new folder under the current folder.\n";
-        std::cout << "touch <filename> <size>: Creates a new file under the current inode location with the specified size.\n";
-        std::cout << "cd <foldername/filename/../-/>: Changes the current inode. Use '..' for parent folder, '-' for previous directory, and '/' for root.\n";
-        std::cout << "rm <foldername/filename>: Removes the specified folder or file and puts it in the bin.\n";
-        std::cout << "size <foldername/filename>: Returns the total size of the folder or file.\n";
-        std::cout << "showbin: Displays the oldest inode in the bin.\n";
-        std::cout << "emptybin: Empties the bin.\n";
-        std::cout << "exit: Stops the program.\n\n";
-
-        std::cout << "Optional commands:\n";
-        std::cout << "mv <filename> <foldername>: Moves a file from the current inode location to the specified folder path.\n";
-        std::cout << "recover: Reinstates the oldest inode back from the bin to its original position in the tree.\n";
-        std::cout << "\nPlease enter a command to continue...\n";
-       
+    // Keeps the blocks in a file instead of anonymous memory; only before any block is allocated
+    // The file is truncated: it is scratch space, the contents are saved with the tree's image
+    bool openBacking(const std::string& path) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (chunkCount > 0 || backingFd >= 0) {
+            return false;
+        }
+        backingFd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (backingFd < 0) {
+            return false;
+        }
+        backingPath = path;
+        return true;
     }
 
+    // Memory of a block; valid for as long as the block is held
+    char* data(uint32_t block) const {
+        return chunks[block / CHUNK_BLOCKS] + (block % CHUNK_BLOCKS) * BLOCK_SIZE;
+    }
 
+    // Blocks that follow `block` in memory (the rest of its chunk), including itself
+    static uint32_t contiguousFrom(uint32_t block) {
+        return static_cast<uint32_t>(CHUNK_BLOCKS - block % CHUNK_BLOCKS);
+    }
 
-    // pwd method - returns the current path as a string
-    std::string pwd() {
-        // Initialize a string to hold the full path
-        std::string fullPath;
-        // Start from the current inode
-        Inode* node = currentInode;
-
-        // If the current inode is the root, return "/"
-        // This is a special case for the root directory
-        if (node == rootInode) {
-            return "/";
+    // Takes a block, `preferred` if it is free (so a file grows in place); a block that will
+    // not be overwritten whole is zeroed. Returns NO_BLOCK when no block can be mapped
+    uint32_t allocate(uint32_t preferred, bool zero) {
+        uint32_t block;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            block = allocateLocked(preferred);
         }
-
-        // Construct the path in reverse order, starting from the current inode and going up to the root
-        // This is done by prepending the name of each inode to the path, separated by "/"
-        while (node != rootInode && node != nullptr) {
-            fullPath = "/" + node->name + fullPath;
-            // Move up to the parent inode
-            node = node->parent;
+        if (zero && block != NO_BLOCK) {
+            std::memset(data(block), 0, BLOCK_SIZE);
         }
-
-        // Return the constructed path
-        return fullPath;
+        return block;
     }
-   
-  
-    // ls method - lists the contents of the current directory
-    void ls() {
-        // Check if the current inode is a directory
-        if (currentInode->type != Inode::Type::Directory) {
-            std::cout << "Error: Current inode is not a directory" << std::endl;
-            return;
-        }
 
-        // Check if the directory is empty
-        if (currentInode->children.empty()) {
-            std::cout << "Directory is empty" << std::endl;
-            return;
+    // Returns a block only the caller holds with the contents of `block`: the block itself if
+    // nobody else holds it, otherwise a copy (and the caller's hold on `block` is given up)
+    uint32_t unshare(uint32_t block) {
+        uint32_t copy;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (refs[block] == 1) {
+                return block;
+            }
+            copy = allocateLocked(NO_BLOCK);
+            if (copy == NO_BLOCK) {
+                return NO_BLOCK;
+            }
+            --refs[block];
+            ++copies;
         }
+        // The other holders keep `block` alive and never write it, so it is copied unlocked
+        std::memcpy(data(copy), data(block), BLOCK_SIZE);
+        return copy;
+    }
 
-        // Bubble sort children by size in descending order
-        bool swapped;
-        do {
-            swapped = false;
-            // Loop through each child
-            for (size_t i = 0; i < currentInode->children.size() - 1; ++i) {
-                // If the current child is smaller than the next one, swap them
-                if (currentInode->children[i]->size < currentInode->children[i + 1]->size) {
-                    std::swap(currentInode->children[i], currentInode->children[i + 1]);
-                    swapped = true;
-                }
-            }
-        } while (swapped); // Continue until no more swaps are needed
-
-        // Print details of each child
-        for (size_t i = 0; i < currentInode->children.size(); ++i) {
-            Inode* child = currentInode->children[i];
-            // Determine the type of the child (directory or file)
-            std::string fileType = (child->type == Inode::Type::Directory) ? "dir" : "file";
-            // Print the child's details
-            std::cout << fileType << "\t" << child->name << "\t" << child->size << "\t" << child->date << std::endl;
-        }
-    }
-
-     // Method to create a new directory
-     void mkdir(const std::string& folderName) {
-         // Loop through the children of the current inode to check if a directory with the same name already exists
-         for (auto& child : currentInode->children) {
-             // If a directory with the same name exists, print an error message and return
-             if (child->name == folderName && child->type == Inode::Type::Directory) {
-                 std::cout << "Error: Directory '" << folderName << "' already exists." << std::endl;
-                 return;
-             }
-         }
-
-         // If the current inode is not a directory, print an error message and return
-         if (currentInode->type != Inode::Type::Directory) {
-             std::cout << "Error: Cannot create directory here. Current location is not a directory." << std::endl;
-             return;
-         }
-
-         // Create a new directory inode with the given name and a default size of 10
-         Inode* newDir = new Inode(folderName, Inode::Type::Directory, 10); // Default size for a directory is 10
-         // Add the new directory to the children of the current inode
-         currentInode->addChild(newDir);
-     }
+    // Adds a holder to `count` blocks from `first`
+    void share(uint32_t first, uint32_t count) {
+        std::lock_guard<std::mutex> guard(lock);
+        for (uint32_t block = first; block < first + count; ++block) {
+            ++refs[block];
+        }
+    }
 
-    // Method to create a new file
-    void touch(const std::string& filename, size_t size) {
-        // Loop through the children of the current inode to check if a file or directory with the same name already exists
-        for (auto& child : currentInode->children) {
-            if (child->name == filename) {
-                // If a file or directory with the same name exists, print an error message and return
-                std::cout << "Error: A file or directory with the name '" << filename << "' already exists." << std::endl;
-                return;
+    // Drops a holder from `count` blocks from `first`, freeing those nobody else holds
+    void release(uint32_t first, uint32_t count) {
+        std::lock_guard<std::mutex> guard(lock);
+        for (uint32_t block = first; block < first + count; ++block) {
+            if (--refs[block] == 0) {
+                usedBits[block / 64] &= ~(1ULL << (block % 64));
+                --usedBlocks;
+                searchFrom = std::min<size_t>(searchFrom, block / 64);
             }
         }
+    }
 
-        // If the current inode is not a directory, print an error message and return
-        if (currentInode->type != Inode::Type::Directory) {
-            std::cout << "Error: Current inode is not a directory. Cannot create file here." << std::endl;
-            return;
-        }
+    // Counters for stats
+    size_t usedCount() const { std::lock_guard<std::mutex> guard(lock); return usedBlocks; }
+    size_t blockCount() const { std::lock_guard<std::mutex> guard(lock); return chunkCount * CHUNK_BLOCKS; }
+    size_t copyCount() const { std::lock_guard<std::mutex> guard(lock); return copies; }
+    const std::string& backing() const { return backingPath; }
 
-        // Get the current date and time
-        std::string currentDate = getCurrentDate(); // This function fetches the current date and time
+    // All-zero block, the contents of every hole
+    static inline const char ZEROS[BLOCK_SIZE] = {};
 
-        // Create a new file inode with the given name, size and current date
-        Inode* newFile = new Inode(filename, Inode::Type::File, size, currentDate);
-        // Add the new file to the children of the current inode
-        currentInode->addChild(newFile);
-    }
+    // Disable copy construction and assignment for simplicity
+    BlockStore(const BlockStore&) = delete;
+    BlockStore& operator=(const BlockStore&) = delete;
+};
 
+// A run of consecutive blocks of a file stored in consecutive blocks of the store
+struct Extent {
+    uint32_t logical;   // First block of the file in the run
+    uint32_t first;     // Store block holding it; the rest of the run follows it
+    uint32_t count;     // Blocks in the run
+};
 
+// Contents of a file, as extents sorted by their first block. File blocks that no extent covers
+// are holes and read as zeros, so a file made by touch with a size holds no blocks at all, and
+// writes that append to a file usually just lengthen its last extent.
+struct FileData {
+    BlockStore& store;
+    Vector<Extent> extents;
 
-    // Method to change the current directory
-    void cd(const std::string& path) {
-        // If the path is empty or root ("/"), change to root directory
-        if (path.empty() || path == "/") {
-            previousInode = currentInode; // Save the current directory
-            currentInode = rootInode; // Change to root directory
-            return;
+    explicit FileData(BlockStore& store) : store(store) {}
+
+    // Destructor: gives the blocks back (the reclaimer thread frees files too)
+    ~FileData() {
+        for (const Extent& extent : extents) {
+            store.release(extent.first, extent.count);
         }
+    }
 
-        // If the path is "-", change to the previous directory
-        if (path == "-") {
-            if (previousInode) { // If there is a previous directory
-                currentInode = previousInode; // Change to the previous directory
-            }
-            return;
+    // A copy sharing every block with this one, for the snapshot's copy of a file being written
+    FileData* share() const {
+        FileData* copy = new FileData(store);
+        copy->extents.reserve(extents.size());
+        for (const Extent& extent : extents) {
+            store.share(extent.first, extent.count);
+            copy->extents.push_back(extent);
         }
+        return copy;
+    }
 
-        // If the path is "..", change to the parent directory
-        if (path == "..") {
-            if (currentInode != rootInode) {  // Prevent moving above root
-                previousInode = currentInode; // Save the current directory
-                currentInode = currentInode->parent; // Change to parent directory
+    // Largest file the extents can describe (block numbers are 32 bits, with room for a run's end)
+    static constexpr size_t MAX_SIZE = (size_t(1) << 31) * BlockStore::BLOCK_SIZE;
+
+    // Index of the first extent that ends after file block `block`: the one holding it, if any
+    size_t seek(uint32_t block) const {
+        size_t low = 0, high = extents.size();
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            if (extents[mid].logical + extents[mid].count <= block) {
+                low = mid + 1;
+            } else {
+                high = mid;
             }
-            return;
         }
+        return low;
+    }
+
+    // Bytes from the start of the file to the end of the last block held
+    size_t storedEnd() const {
+        return extents.empty() ? 0 : static_cast<size_t>(extents[extents.size() - 1].logical + extents[extents.size() - 1].count) * BlockStore::BLOCK_SIZE;
+    }
 
-        // Handle absolute or relative path
-        // If the path starts with "/", it's an absolute path, start from root
-        // Otherwise, it's a relative path, start from the current directory
-        Inode* targetInode = (path[0] == '/') ? rootInode : currentInode;
-        std::istringstream iss(path);
-        std::string token;
+    // Blocks held, shared ones included
+    size_t blockCount() const {
+        size_t blocks = 0;
+        for (const Extent& extent : extents) {
+            blocks += extent.count;
+        }
+        return blocks;
+    }
 
-        // Split the path by "/"
-        while (std::getline(iss, token, '/')) {
-            // Skip empty tokens and "."
-            if (token.empty() || token == ".") continue;
+    // Points file block `block` at store block `physical`, splitting the extent that held the
+    // block (if any) and merging the new run with its neighbours where they line up
+    void map(uint32_t block, uint32_t physical) {
+        size_t i = seek(block);
+        if (i < extents.size() && extents[i].logical <= block) {
+            Extent held = extents[i];
+            uint32_t before = block - held.logical;
+            uint32_t after = held.count - before - 1;
+            extents[i] = Extent{block, physical, 1};
+            if (after > 0) {
+                extents.insert(i + 1, Extent{block + 1, held.first + before + 1, after});
+            }
+            if (before > 0) {
+                extents.insert(i++, Extent{held.logical, held.first, before});
+            }
+        } else {
+            extents.insert(i, Extent{block, physical, 1});
+        }
+        if (i + 1 < extents.size() && extents[i + 1].logical == block + 1 && extents[i + 1].first == physical + 1) {
+            extents[i].count += extents[i + 1].count;
+            extents.erase(i + 1);
+        }
+        if (i > 0 && extents[i - 1].logical + extents[i - 1].count == block &&
+            extents[i - 1].first + extents[i - 1].count == physical) {
+            extents[i - 1].count += extents[i].count;
+            extents.erase(i);
+        }
+    }
 
-            // If the token is "..", move up to the parent directory, but not above root
-            if (token == "..") {
-                if (targetInode != rootInode) {
-                    targetInode = targetInode->parent;
+    // Copies `data` into the file at byte `offset`. Holes get fresh blocks (next to the previous
+    // run when that block is free) and blocks shared with a snapshot's copy are copied first.
+    // Returns the bytes written, fewer than asked only if the store ran out of blocks
+    size_t write(size_t offset, std::string_view data) {
+        size_t written = 0;
+        while (written < data.size()) {
+            uint32_t block = static_cast<uint32_t>(offset / BlockStore::BLOCK_SIZE);
+            size_t within = offset % BlockStore::BLOCK_SIZE;
+            size_t length = std::min(BlockStore::BLOCK_SIZE - within, data.size() - written);
+            size_t i = seek(block);
+            uint32_t physical;
+            if (i < extents.size() && extents[i].logical <= block) {
+                uint32_t held = extents[i].first + (block - extents[i].logical);
+                physical = store.unshare(held);
+                if (physical != held && physical != BlockStore::NO_BLOCK) {
+                    map(block, physical);
                 }
-                continue;
+            } else {
+                bool follows = i > 0 && extents[i - 1].logical + extents[i - 1].count == block;
+                physical = store.allocate(follows ? extents[i - 1].first + extents[i - 1].count : BlockStore::NO_BLOCK,
+                                          length < BlockStore::BLOCK_SIZE);
+                if (physical != BlockStore::NO_BLOCK) {
+                    map(block, physical);
+                }
+            }
+            if (physical == BlockStore::NO_BLOCK) {
+                break;
             }
+            std::memcpy(store.data(physical) + within, data.data() + written, length);
+            offset += length;
+            written += length;
+        }
+        return written;
+    }
 
-            // Search for the directory in the current inode's children
-            bool found = false;
-            for (auto& child : targetInode->children) {
-                if (child->name == token && child->type == Inode::Type::Directory) {
-                    targetInode = child; // Found the directory, change to it
-                    found = true;
-                    break;
+    // Calls emit(data, length) for `length` bytes from `offset`, in order, with pointers straight
+    // into the blocks: one call per run of blocks that are adjacent in memory, and ZEROS for holes
+    // Past the last block held the file is all hole, however large touch made it
+    template <typename Emit>
+    void read(size_t offset, size_t length, Emit emit) const {
+        const size_t end = offset + length;
+        const size_t stored = std::min(end, storedEnd());
+        size_t i = offset < stored ? seek(static_cast<uint32_t>(offset / BlockStore::BLOCK_SIZE)) : extents.size();
+        while (offset < end) {
+            uint32_t block = offset < stored ? static_cast<uint32_t>(offset / BlockStore::BLOCK_SIZE) : 0;
+            while (i < extents.size() && extents[i].logical + extents[i].count <= block) {
+                ++i;
+            }
+            size_t pieceEnd;
+            if (offset < stored && i < extents.size() && extents[i].logical <= block) {
+                uint32_t physical = extents[i].first + (block - extents[i].logical);
+                uint32_t run = std::min(extents[i].logical + extents[i].count - block, BlockStore::contiguousFrom(physical));
+                pieceEnd = std::min(end, (static_cast<size_t>(block) + run) * BlockStore::BLOCK_SIZE);
+                emit(store.data(physical) + offset % BlockStore::BLOCK_SIZE, pieceEnd - offset);
+            } else {
+                size_t holeEnd = offset < stored && i < extents.size() ? static_cast<size_t>(extents[i].logical) * BlockStore::BLOCK_SIZE : end;
+                pieceEnd = std::min(end, holeEnd);
+                for (size_t at = offset; at < pieceEnd;) {
+                    size_t zeros = std::min(pieceEnd - at, BlockStore::BLOCK_SIZE);
+                    emit(BlockStore::ZEROS, zeros);
+                    at += zeros;
                 }
             }
+            offset = pieceEnd;
+        }
+    }
 
-            // If the directory is not found, print an error message and return
-            if (!found) {
-                std::cout << "Directory not found: " << token << std::endl;
-                return;
+    // Disable copy construction and assignment for simplicity
+    FileData(const FileData&) = delete;
+    FileData& operator=(const FileData&) = delete;
+};
+
+class Inode {
+public:
+    enum class Type { File, Directory };
+    using ChildList = SmallVector<Inode*, SMALL_DIRECTORY>;
+
+    Type type;
+    // Id of the newest snapshot whose view of the inode is already kept (or that predates it):
+    // a directory's state in DirVersions, a file by being left to the snapshots when written
+    std::atomic<uint32_t> savedEpoch{0};
+    std::string name;
+    size_t size;  // Logical length of the file (holes included), or the directory entry's own size
+    size_t totalSize;    // Aggregate bytes of this inode and everything below it
+    size_t totalInodes;  // Number of inodes in this subtree, including this one
+    int64_t ctime;     // Creation time in seconds since the epoch, 0 if unknown
+    int64_t mtime;     // Last modification time in seconds since the epoch, 0 if unknown
+    Inode* parent;
+    union {
+        DirData* dirData;     // Directories: children, child index and size order
+        FileData* fileData;   // Files: contents, nullptr until the first write
+    };
+    uint32_t orderPos;        // Slot of this inode in its parent's sizeOrder heap
+    uint32_t childPos;        // Slot of this inode in its parent's children, for O(1) removal
+    Inode* nameNext = nullptr;   // Next inode with the same name in the FileSystem's NameIndex
+    Inode* namePrev = nullptr;   // Previous one, nullptr for the first inode with the name
+    uint32_t nameGroup = 0;      // NameIndex group of this inode's name
+    mutable DirLock lock;     // Guards dirData and the children's totals
+
+    // The children of every file
+    static inline const ChildList NO_CHILDREN{};
+
+    // Constructor: directories get their DirData here
+    Inode(std::string name, Type type, size_t size = 0, int64_t time = 0, Inode* parent = nullptr)
+        : name(name), type(type), size(size), totalSize(size), totalInodes(1), ctime(time), mtime(time), parent(parent),
+          dirData(type == Type::Directory ? new DirData : nullptr) {}
+
+    // Children of the inode, in no particular order (none for a file)
+    const ChildList& children() const {
+        return type == Type::Directory ? dirData->children : NO_CHILDREN;
+    }
+
+    // Find a direct child by name, nullptr if there is none
+    // Small directories are scanned; larger ones go through the hash index
+    Inode* findChild(std::string_view childName) const {
+        if (type != Type::Directory) {
+            return nullptr;
+        }
+        if (dirData->childIndex.size() == 0) {
+            for (Inode* child : dirData->children) {
+                if (child->name == childName) {
+                    return child;
+                }
             }
+            return nullptr;
         }
+        return dirData->childIndex.find(childName);
+    }
 
-        // Change to the target directory
-        previousInode = currentInode; // Save the current directory
-        currentInode = targetInode; // Change to the target directory
+    // Sizes the child storage for a known number of children (directories loaded from an image)
+    void reserveChildren(size_t count) {
+        dirData->children.reserve(count);
+        if (count > SMALL_DIRECTORY) {
+            dirData->childIndex.reserve(count);
+        }
     }
 
-    // Method to remove a file or directory
-    void rm(const std::string& name) {
-        // Initialize index to -1
-        size_t index = -1;
-        // Loop through the children of the current inode
-        for (size_t i = 0; i < currentInode->children.size(); ++i) {
-            // If a child with the given name is found, save its index and break the loop
-            if (currentInode->children[i]->name == name) {
-                index = i;
-                break;
+    // Add a child inode (only if it's a directory)
+    void addChild(Inode* child) {
+        if (this->type == Type::Directory) {
+            linkChild(child);
+            // Add the child's subtree to the totals of this directory and every ancestor
+            growTotals(child->totalSize, child->totalInodes);
+        }
+    }
+
+    // Attach a child without touching any totals; the caller has already accounted for them
+    // (used when a whole tree is loaded from an image with its totals precomputed)
+    void linkChild(Inode* child) {
+        DirData& dir = *dirData;
+        child->childPos = static_cast<uint32_t>(dir.children.size());
+        dir.children.push_back(child);
+        // The index holds either every child or none of them
+        if (dir.childIndex.size() > 0) {
+            dir.childIndex.insert(child);
+        } else if (dir.children.size() > SMALL_DIRECTORY) {
+            for (Inode* each : dir.children) {
+                dir.childIndex.insert(each);
             }
         }
+        child->parent = this;
+        dir.sizeOrder.insert(child);
+    }
 
-        // If no child with the given name is found, print an error message and return
-        if (index == -1) {
-            std::cout << "Error: File or directory '" << name << "' not found." << std::endl;
-            return;
+    // Add a subtree's bytes and inode count to this inode and all of its ancestors
+    void growTotals(size_t bytes, size_t inodes) {
+        for (Inode* node = this; node != nullptr; node = node->parent) {
+            node->totalSize += bytes;
+            node->totalInodes += inodes;
+            // The node grew, so its place in the parent's size order may change
+            if (node->parent) {
+                node->parent->dirData->sizeOrder.update(node);
+            }
+        }
+    }
+
+    // Subtract a subtree's bytes and inode count from this inode and all of its ancestors
+    void shrinkTotals(size_t bytes, size_t inodes) {
+        for (Inode* node = this; node != nullptr; node = node->parent) {
+            node->totalSize -= bytes;
+            node->totalInodes -= inodes;
+            // The node shrank, so its place in the parent's size order may change
+            if (node->parent) {
+                node->parent->dirData->sizeOrder.update(node);
+            }
         }
+    }
 
-        // Get the inode to be removed
-        Inode* toBeRemoved = currentInode->children[index];
+    // Detach a child inode from this directory, returns false if it is not a child
+    // The child's parent pointer is left intact so its original location can still be traced
+    bool removeChild(Inode* child) {
+        if (type != Type::Directory || child->parent != this) {
+            return false;
+        }
+        DirData& dir = *dirData;
+        size_t pos = child->childPos;
+        if (pos >= dir.children.size() || dir.children[pos] != child) {
+            return false; // Removed earlier; the parent pointer outlives the entry
+        }
+        // Swap-and-pop: the last child takes over the slot, so removal is O(1) at any size
+        // (children are in no particular order; ls lists them through the size order)
+        Inode* last = dir.children[dir.children.size() - 1];
+        dir.children[pos] = last;
+        last->childPos = static_cast<uint32_t>(pos);
+        dir.children.pop_back();
+        if (dir.childIndex.size() > 0) {
+            dir.childIndex.erase(child);
+        }
+        dir.sizeOrder.erase(child);
+        // The subtree no longer counts towards this directory or its ancestors
+        shrinkTotals(child->totalSize, child->totalInodes);
+        return true;
+    }
 
-        // If the removal queue is full, print an error message and return
-        if (removalQueue.isFull()) {
-            std::cout << "Error: Removal queue is full." << std::endl;
-            // Optionally, delete toBeRemoved to prevent memory leak, if it won't be used elsewhere
-            delete toBeRemoved;
+    // Appends the absolute path of the inode to `out` ("/" for the root); every path the file
+    // system prints is built here. The ancestors are gathered first (on the stack unless the
+    // inode is more than 64 levels deep) so the exact length can be reserved, and the names are
+    // then copied in once, front to back, with no temporary strings
+    void appendPath(std::string& out) const {
+        static const size_t SHALLOW = 64;
+        const Inode* shallow[SHALLOW];
+        Vector<const Inode*> deep;
+        size_t depth = 0;
+        size_t length = 0;
+        // The root is the only inode named "/", and it only contributes the leading separator
+        for (const Inode* node = this; node != nullptr && node->name != "/"; node = node->parent) {
+            if (depth < SHALLOW) {
+                shallow[depth] = node;
+            } else {
+                deep.push_back(node);
+            }
+            ++depth;
+            length += node->name.size() + 1;
+        }
+        if (depth == 0) {
+            out += '/';
             return;
         }
+        out.reserve(out.size() + length);
+        for (size_t i = depth; i-- > 0;) {
+            const Inode* node = i < SHALLOW ? shallow[i] : deep[i - SHALLOW];
+            out += '/';
+            out += node->name;
+        }
+    }
 
-        // Add the inode to the removal queue
-        removalQueue.enqueue(toBeRemoved);
+    // Method to get the full path of the inode
+    std::string getFullPath() const {
+        std::string path;
+        appendPath(path);
+        return path;
+    }
 
-        // Remove the inode from the children vector
-        currentInode->children.erase(index);
+    // Destructor: frees the directory part, or the file's contents
+    // Children are not deleted here: inodes are owned by the FileSystem's InodePool, which frees
+    // subtrees and tears down whole slabs without recursing through the tree
+    ~Inode() {
+        if (type == Type::Directory) {
+            delete dirData;
+        } else {
+            delete fileData;
+        }
+    }
 
-        // Print a success message
-        std::cout << "Removed '" << name << "'." << std::endl;
+    // Disable copy construction and assignment for simplicity
+    Inode(const Inode&) = delete;
+    Inode& operator=(const Inode&) = delete;
+
+    // Disable move construction and assignment for simplicity
+    Inode(Inode&&) = delete;
+    Inode& operator=(Inode&&) = delete;
+};
+
+
+// ChildIndex implementation, placed after Inode because it needs the child's name
+
+// Finds a child by name: probe from the home slot until the name or an empty slot is found
+inline Inode* ChildIndex::find(std::string_view name) const {
+    if (count == 0) {
+        return nullptr;
     }
+    size_t h = hashName(name);
+    size_t mask = capacity - 1;
+    for (size_t i = h & mask; slots[i].node != nullptr; i = (i + 1) & mask) {
+        if (slots[i].hash == h && slots[i].node->name == name) {
+            return slots[i].node;
+        }
+    }
+    return nullptr;
+}
 
-    // This method displays the oldest inode in the bin
-    void showbin() const {
-        // Check if the removal queue is empty
-        if (removalQueue.isEmpty()) {
-            // If empty, print a message
-            std::cout << "Bin is empty." << std::endl;
-        } else {
-            // If not empty, get the oldest inode
-            Inode* oldest = removalQueue.front_element();
-            // Print the name of the oldest inode
-            std::cout << "Oldest inode in the bin: " << oldest->name << std::endl;
-            // Print the path of the oldest inode
-            std::cout << "Path: " << constructPath(oldest) << std::endl;
+// Indexes a child under its name, growing the table once it is three quarters full
+inline void ChildIndex::insert(Inode* child) {
+    if ((count + 1) * 4 > capacity * 3) {
+        rehash(capacity == 0 ? 8 : capacity * 2);
+    }
+    size_t h = hashName(child->name);
+    size_t mask = capacity - 1;
+    size_t i = h & mask;
+    while (slots[i].node != nullptr) {
+        i = (i + 1) & mask;
+    }
+    slots[i].hash = h;
+    slots[i].node = child;
+    ++count;
+}
+
+// Removes a child, then shifts later entries of the probe run back so lookups never hit a hole
+inline bool ChildIndex::erase(Inode* child) {
+    if (count == 0) {
+        return false;
+    }
+    size_t mask = capacity - 1;
+    size_t i = hashName(child->name) & mask;
+    while (slots[i].node != child) {
+        if (slots[i].node == nullptr) {
+            return false; // Not indexed
         }
+        i = (i + 1) & mask;
     }
 
+    // Backward-shift deletion: move any entry whose home slot is at or before the hole into it
+    size_t hole = i;
+    for (size_t j = (hole + 1) & mask; slots[j].node != nullptr; j = (j + 1) & mask) {
+        size_t home = slots[j].hash & mask;
+        // Distance from the home slot to j versus the hole to j (both measured cyclically)
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            slots[hole] = slots[j];
+            hole = j;
+        }
+    }
+    slots[hole].node = nullptr;
+    --count;
+    return true;
+}
 
-    // This method recovers the oldest inode from the bin
-    void recover() {
-        // Check if the removal queue is empty
-        if (removalQueue.isEmpty()) {
-            // If empty, print an error message and return
-            std::cout << "Error: Bin is empty." << std::endl;
-            return;
+// Sizes the table so `children` entries fit without another rehash
+inline void ChildIndex::reserve(size_t children) {
+    size_t wanted = 8;
+    while (children * 4 > wanted * 3) {
+        wanted *= 2;
+    }
+    if (wanted > capacity) {
+        rehash(wanted);
+    }
+}
+
+// Grows the table and reinserts every entry using its cached hash
+inline void ChildIndex::rehash(size_t newCapacity) {
+    Slot* oldSlots = slots;
+    size_t oldCapacity = capacity;
+
+    slots = new Slot[newCapacity];
+    capacity = newCapacity;
+    for (size_t i = 0; i < capacity; ++i) {
+        slots[i].node = nullptr;
+    }
+
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < oldCapacity; ++i) {
+        if (oldSlots[i].node != nullptr) {
+            size_t j = oldSlots[i].hash & mask;
+            while (slots[j].node != nullptr) {
+                j = (j + 1) & mask;
+            }
+            slots[j] = oldSlots[i];
         }
+    }
+    delete[] oldSlots;
+}
 
-        // Dequeue the oldest inode from the removal queue
-        Inode* inodeToRecover = removalQueue.dequeue();
-        // Get the full path of the inode to be recovered
-        std::string originalPath = inodeToRecover->getFullPath();
-        // Extract the parent path from the original path
-        std::string parentPath = originalPath.substr(0, originalPath.find_last_of('/'));
-
-        // Navigate to the parent inode
-        Inode* parentInode = navigateToPath(parentPath);
-        // Check if the parent inode exists and is a directory
-        if (!parentInode || parentInode->type != Inode::Type::Directory) {
-            // If not, print an error message, clean up the inode to be recovered, and return
-            std::cout << "Error: Original path does not exist anymore." << std::endl;
-            delete inodeToRecover;
-            return;
+
+// SizeOrder implementation, placed after Inode because it compares sizes and names
+
+// Larger total size first; equal sizes are listed by name so the order is deterministic
+inline bool SizeOrder::before(const Inode* a, const Inode* b) {
+    if (a->totalSize != b->totalSize) {
+        return a->totalSize > b->totalSize;
+    }
+    return a->name < b->name;
+}
+
+// Stores a node in a heap slot and keeps its back-reference in sync
+inline void SizeOrder::place(size_t pos, Inode* node) {
+    heap[pos] = node;
+    node->orderPos = static_cast<uint32_t>(pos);
+}
+
+// Moves the entry at pos up while it should be listed before its parent
+inline void SizeOrder::siftUp(size_t pos) {
+    Inode* node = heap[pos];
+    while (pos > 0) {
+        size_t parentPos = (pos - 1) / 2;
+        if (!before(node, heap[parentPos])) {
+            break;
         }
+        place(pos, heap[parentPos]);
+        pos = parentPos;
+    }
+    place(pos, node);
+}
 
-        // Add the inode to be recovered to the parent inode's children
-        parentInode->addChild(inodeToRecover);
-        // Print a success message
-        std::cout << "Recovered '" << inodeToRecover->name << "' to its original location." << std::endl;
+// Moves the entry at pos down while one of its children should be listed before it
+inline void SizeOrder::siftDown(size_t pos) {
+    Inode* node = heap[pos];
+    size_t count = heap.size();
+    while (true) {
+        size_t best = 2 * pos + 1;
+        if (best >= count) {
+            break;
+        }
+        if (best + 1 < count && before(heap[best + 1], heap[best])) {
+            ++best;
+        }
+        if (!before(heap[best], node)) {
+            break;
+        }
+        place(pos, heap[best]);
+        pos = best;
     }
+    place(pos, node);
+}
 
-    // Method to move a file to a different folder
-    void mv(const std::string& filename, const std::string& foldername) {
-        // Initialize pointers to the file and folder nodes
-        Inode* fileNode = nullptr;
-        Inode* folderNode = nullptr;
+// Appends the child as a leaf and sifts it up into place
+inline void SizeOrder::insert(Inode* child) {
+    heap.push_back(child);
+    siftUp(heap.size() - 1);
+}
 
-        // Loop through the children of the current inode to find the file and folder nodes
-        for (auto& child : currentInode->children) {
-            // If a child node matches the filename and is a file, assign it to fileNode
-            if (child->name == filename && child->type == Inode::Type::File) {
-                fileNode = child;
-            } 
-            // If a child node matches the foldername and is a directory, assign it to folderNode
-            else if (child->name == foldername && child->type == Inode::Type::Directory) {
-                folderNode = child;
+// Replaces the child with the last leaf, then repairs the order around that slot
+inline void SizeOrder::erase(Inode* child) {
+    size_t pos = child->orderPos;
+    size_t last = heap.size() - 1;
+    Inode* moved = heap[last];
+    heap.erase(last);
+    if (pos != last) {
+        place(pos, moved);
+        update(moved);
+    }
+}
+
+// The child's size changed in one direction, at most one of the sifts moves it
+inline void SizeOrder::update(Inode* child) {
+    siftUp(child->orderPos);
+    siftDown(child->orderPos);
+}
+
+// Streams the n largest children using a small frontier heap of candidate slots:
+// the next largest entry is always the root or a child of an already visited slot
+template <typename Visit>
+void SizeOrder::forLargest(size_t n, Visit visit) const {
+    Vector<size_t> frontier;
+    // Frontier ordering: slot a beats slot b if its inode should be listed first
+    auto beats = [this](size_t a, size_t b) { return before(heap[a], heap[b]); };
+
+    if (!heap.empty()) {
+        frontier.push_back(0);
+    }
+    while (n > 0 && !frontier.empty()) {
+        // Pop the best candidate: move the last entry to the top and sift it down
+        size_t pos = frontier[0];
+        size_t lastSlot = frontier[frontier.size() - 1];
+        frontier.erase(frontier.size() - 1);
+        if (!frontier.empty()) {
+            size_t i = 0;
+            size_t count = frontier.size();
+            while (true) {
+                size_t best = 2 * i + 1;
+                if (best >= count) {
+                    break;
+                }
+                if (best + 1 < count && beats(frontier[best + 1], frontier[best])) {
+                    ++best;
+                }
+                if (!beats(frontier[best], lastSlot)) {
+                    break;
+                }
+                frontier[i] = frontier[best];
+                i = best;
             }
+            frontier[i] = lastSlot;
         }
 
-        // Check if the file and folder nodes were found
-        if (!fileNode) {
-            // If the file node was not found, print an error message and return
-            std::cout << "Error: File '" << filename << "' not found." << std::endl;
-            return;
+        visit(heap[pos]);
+        --n;
+
+        // Both heap children of the visited slot become candidates
+        for (size_t next = 2 * pos + 1; next <= 2 * pos + 2 && next < heap.size(); ++next) {
+            frontier.push_back(next);
+            size_t i = frontier.size() - 1;
+            while (i > 0 && beats(next, frontier[(i - 1) / 2])) {
+                frontier[i] = frontier[(i - 1) / 2];
+                i = (i - 1) / 2;
+            }
+            frontier[i] = next;
         }
-        if (!folderNode) {
-            // If the folder node was not found, print an error message and return
-            std::cout << "Error: Folder '" << foldername << "' not found." << std::endl;
-            return;
+    }
+}
+
+// Slab allocator for Inode objects.
+// Inodes are carved out of fixed-size slabs instead of one heap allocation each. Freed slots go
+// on an intrusive free list and are reused by the next allocation, and teardown destroys the
+// live inodes slab by slab and then releases each slab with a single free.
+class InodePool {
+private:
+    static const size_t SLAB_INODES = 1024;  // Inodes per slab
+
+    // One inode-sized slot; the inode lives at offset 0 so an Inode* converts back to its slot
+    // The free-list link shares the inode's bytes, since a slot holds one or the other
+    struct Slot {
+        union {
+            alignas(Inode) unsigned char bytes[sizeof(Inode)];
+            Slot* nextFree;     // Next slot on the free list while the slot is unused
+        };
+        bool used;          // True while the slot holds a constructed inode
+    };
+
+    struct Slab {
+        Slot slots[SLAB_INODES];
+    };
+
+    Vector<Slab*> slabs;    // Every slab owned by the pool
+    Slot* freeList;         // Unused slots, most recently freed first
+    size_t liveInodes;      // Inodes constructed and not destroyed by the owning thread
+    size_t allocations;     // Inodes ever created
+    size_t frees;           // Inodes ever destroyed by the owning thread
+    // Slots freed by the reclaimer thread: pushed as whole chains, adopted by create() in one
+    // exchange when the local free list runs dry
+    std::atomic<Slot*> remoteFree;
+    std::atomic<size_t> remoteFrees; // Inodes ever destroyed by the reclaimer
+
+    // Allocates a new slab and threads all of its slots onto the free list
+    void addSlab() {
+        Slab* slab = static_cast<Slab*>(std::malloc(sizeof(Slab)));
+        if (slab == nullptr) {
+            throw std::bad_alloc();
+        }
+        slabs.push_back(slab);
+        // Push in reverse so allocations walk the slab front to back
+        for (size_t i = SLAB_INODES; i > 0; --i) {
+            Slot* slot = &slab->slots[i - 1];
+            slot->used = false;
+            slot->nextFree = freeList;
+            freeList = slot;
         }
+    }
 
-        // Add the file node to the folder node's children
-        folderNode->addChild(fileNode);
+public:
+    // Constructor: slabs are allocated on demand
+    InodePool() : freeList(nullptr), liveInodes(0), allocations(0), frees(0), remoteFree(nullptr), remoteFrees(0) {}
+    // Destructor: destroys whatever is still alive and releases the slabs
+    ~InodePool() { releaseAll(); }
+
+    // Constructs an inode in a free slot, adding a slab when none is left
+    template <typename... Args>
+    Inode* create(Args&&... args) {
+        if (freeList == nullptr) {
+            freeList = remoteFree.exchange(nullptr, std::memory_order_acquire);
+        }
+        if (freeList == nullptr) {
+            addSlab();
+        }
+        Slot* slot = freeList;
+        // The link is read first: the inode is constructed over it (and put back if that throws)
+        Slot* next = slot->nextFree;
+        Inode* inode;
+        try {
+            inode = new (slot->bytes) Inode(std::forward<Args>(args)...);
+        } catch (...) {
+            slot->nextFree = next;
+            throw;
+        }
+        freeList = next;
+        slot->used = true;
+        ++liveInodes;
+        ++allocations;
+        return inode;
+    }
 
-        // Loop through the current inode's children to find and remove the file node
-        for (size_t i = 0; i < currentInode->children.size(); ++i) {
-            // If a child node matches the file node, remove it from the current inode's children
-            if (currentInode->children[i] == fileNode) {
-                currentInode->children.erase(i); // Assuming your Vector class has an erase method that takes an index
-                // Print a success message and return
-                std::cout << "Successfully moved '" << filename << "' to '" << foldername << "'." << std::endl;
-                return; // Exit the function after moving the file
+    // Destroys a single inode and returns its slot to the free list
+    void destroy(Inode* inode) {
+        Slot* slot = reinterpret_cast<Slot*>(inode);
+        inode->~Inode();
+        slot->used = false;
+        slot->nextFree = freeList;
+        freeList = slot;
+        --liveInodes;
+        ++frees;
+    }
+
+    // Destroys an inode and everything below it, using an explicit stack instead of recursion
+    void destroySubtree(Inode* root) {
+        Stack<Inode*> pending;
+        pending.push(root);
+        while (!pending.isEmpty()) {
+            Inode* node = pending.pop();
+            for (Inode* child : node->children()) {
+                pending.push(child);
             }
+            destroy(node);
         }
     }
 
+    // Slots destroyed by the reclaimer thread that have not been handed back yet
+    struct FreeChain {
+        Slot* first = nullptr;
+        Slot* last = nullptr;
+        size_t count = 0;
+    };
+
+    // Reclaimer side: destroys an inode that nothing else can reach and adds its slot to `chain`
+    void destroyDetached(Inode* inode, FreeChain& chain) {
+        Slot* slot = reinterpret_cast<Slot*>(inode);
+        inode->~Inode();
+        slot->used = false;
+        slot->nextFree = chain.first;
+        chain.first = slot;
+        if (chain.last == nullptr) {
+            chain.last = slot;
+        }
+        ++chain.count;
+    }
 
+    // Reclaimer side: hands a whole chain back to the pool with a single atomic push
+    void publish(FreeChain& chain) {
+        if (chain.count == 0) {
+            return;
+        }
+        chain.last->nextFree = remoteFree.load(std::memory_order_relaxed);
+        while (!remoteFree.compare_exchange_weak(chain.last->nextFree, chain.first, std::memory_order_release,
+                                                 std::memory_order_relaxed)) {
+        }
+        remoteFrees.fetch_add(chain.count, std::memory_order_relaxed);
+        chain = FreeChain();
+    }
 
-    // This method is used to empty the bin
-    void emptybin() {
-        // While loop will run until the removalQueue is not empty
-        while (!removalQueue.isEmpty()) {
-            // Dequeue the inode from the removalQueue and assign it to removedInode
-            Inode* removedInode = removalQueue.dequeue();
-            delete removedInode; // Memory allocated to the inode is freed here
+    // Destroys every live inode slab by slab, then frees the slabs themselves
+    // The reclaimer thread must be stopped first
+    void releaseAll() {
+        for (Slab* slab : slabs) {
+            for (size_t i = 0; i < SLAB_INODES; ++i) {
+                if (slab->slots[i].used) {
+                    reinterpret_cast<Inode*>(slab->slots[i].bytes)->~Inode();
+                }
+            }
+            std::free(slab);
         }
+        frees += liveCount();
+        liveInodes = 0;
+        frees += remoteFrees.exchange(0);
+        slabs.clear();
+        freeList = nullptr;
+        remoteFree = nullptr;
     }
 
+    // Forgets every inode and slab without destroying or freeing them, for a process that is
+    // about to exit: the operating system takes the memory back at once, instead of the
+    // destructor visiting every inode. The reclaimer thread must be stopped first
+    void abandon() {
+        slabs.clear();
+        freeList = nullptr;
+        remoteFree = nullptr;
+        liveInodes = 0;
+    }
 
-    // exit method - handles exiting the program
-    void exit() {
-        std::cout << "Exiting the Virtual File System. Goodbye!\n";
+    // Allocator counters
+    size_t liveCount() const { return liveInodes - remoteFrees.load(std::memory_order_relaxed); }
+    size_t slabCount() const { return slabs.size(); }
+    size_t slotCount() const { return slabs.size() * SLAB_INODES; }
+    size_t slabBytes() const { return slabs.size() * sizeof(Slab); }
+    size_t allocationCount() const { return allocations; }
+    size_t freeCount() const { return frees + remoteFrees.load(std::memory_order_relaxed); }
+    // Share of allocated slots that are not holding an inode, in percent
+    double fragmentation() const {
+        return slotCount() == 0 ? 0.0 : 100.0 * (slotCount() - liveCount()) / slotCount();
     }
 
+    // Disable copy construction and assignment for simplicity
+    InodePool(const InodePool&) = delete;
+    InodePool& operator=(const InodePool&) = delete;
 };
 
-int main() {
-    FileSystem vfs; // Create a FileSystem instance
+// Splits a path into its components without copying: each component is a view into the path.
+// Empty components (from leading, trailing or repeated '/') are skipped.
+class PathTokenizer {
+private:
+    std::string_view rest;  // Part of the path not consumed yet
 
-    vfs.help(); // Display help information at the start of the program
+public:
+    explicit PathTokenizer(std::string_view path) : rest(path) {}
 
-    while (true) {
-        std::string user_input;
-        std::string command;
-        std::cout << ">";
-        std::getline(std::cin, user_input);
+    // Stores the next component in `component`, returns false once the path is exhausted
+    bool next(std::string_view& component) {
+        while (!rest.empty() && rest.front() == '/') {
+            rest.remove_prefix(1);
+        }
+        if (rest.empty()) {
+            return false;
+        }
+        size_t end = rest.find('/');
+        if (end == std::string_view::npos) {
+            end = rest.size();
+        }
+        component = rest.substr(0, end);
+        rest.remove_prefix(end);
+        return true;
+    }
+};
 
-        std::stringstream sstr(user_input);
-        sstr >> command;
+// Dentry-style cache of resolved paths: (starting directory, path) -> directory inode.
+// Direct-mapped, so a lookup is a single hash probe and a colliding insert simply replaces the
+// old entry. Entries are stamped with the tree generation and ignored once it has moved on, so
+// anything that can detach or free a directory only has to bump the generation.
+class PathCache {
+private:
+    static const size_t SLOTS = 4096;  // Number of cache entries (a power of two)
+
+    struct Entry {
+        size_t hash;            // Hash of the base pointer and the path
+        const Inode* base;      // Directory the path was resolved from
+        std::string path;       // The path as it was given
+        Inode* target;          // Directory the path resolved to
+        unsigned long long generation;  // Tree generation the entry is valid for
+    };
+
+    Entry* entries;         // Table of SLOTS entries, allocated on first insert
+    size_t hits;            // Lookups answered from the cache
+    size_t misses;          // Lookups that had to walk the tree
+
+    // Hash of a (base directory, path) key
+    static size_t hashKey(const Inode* base, std::string_view path) {
+        return ChildIndex::hashName(path) ^ (reinterpret_cast<size_t>(base) * 0x9E3779B97F4A7C15ULL);
+    }
 
-        try {
-            // If the command is 'help', call the help function
-            if (command == "help")        vfs.help();
-            // If the command is 'pwd', print the current path
-            else if (command == "pwd")    std::cout << "Current path: " << vfs.pwd() << std::endl;
-            // If the command is 'ls', list the files in the current directory
-            else if (command == "ls")     vfs.ls();
-            // If the command is 'mkdir', create a new directory
-            else if (command == "mkdir")  {
-                std::string folderName;
-                sstr >> folderName;
-                if (!folderName.empty()) {
-                    vfs.mkdir(folderName);
-                } else {
-                    std::cout << "Usage: mkdir <foldername>" << std::endl;
-                }
+public:
+    PathCache() : entries(nullptr), hits(0), misses(0) {}
+    ~PathCache() { delete[] entries; }
+
+    // Returns the cached target for the key, or nullptr if absent or stale
+    Inode* find(const Inode* base, std::string_view path, unsigned long long generation) {
+        if (entries != nullptr) {
+            size_t h = hashKey(base, path);
+            const Entry& entry = entries[h & (SLOTS - 1)];
+            if (entry.target != nullptr && entry.generation == generation && entry.hash == h &&
+                entry.base == base && entry.path == path) {
+                ++hits;
+                return entry.target;
             }
-            // If the command is 'touch', create a new file
-            else if (command == "touch")  {
-                std::string filename;
-                size_t size;
-                sstr >> filename >> size;
-                vfs.touch(filename, size);
-            }
-            // If the command is 'cd', change the current directory
-            else if (command == "cd")     {
-                std::string path;
-                sstr >> path;
-                vfs.cd(path);
-            }
-            // If the command is 'rm', remove a file or directory
-            else if (command == "rm") {
-                std::string name;
-                sstr >> name;
-                vfs.rm(name);
-            }
-            // If the command is 'size', print the size of a file or directory
-            else if (command == "size") {
-                std::string name;
-                sstr >> name;
-                std::cout << "Size of '" << name << "': " << vfs.size(name) << " bytes\n";
-            }
-            // If the command is 'showbin', show the oldest inode in the bin
-            else if (command == "showbin") {
-            vfs.showbin();
-        }
-            // If the command is 'recover', recover the oldest inode from the bin
-            else if (command == "recover") {
-                vfs.recover();
-            }
-            // If the command is 'mv', move a file to a different directory
-            else if (command == "mv") {
-            std::string filename, foldername;
-            sstr >> filename >> foldername;
-            vfs.mv(filename, foldername);
-            } 
-            // If the command is 'emptybin', empty the bin
-            else if (command == "emptybin") {
-                vfs.emptybin();
-                std::cout << "Bin emptied successfully." << std::endl;
-            }
-            // If the command is 'exit', exit the program
-            else if (command == "exit")   { 
-                vfs.exit(); return(EXIT_SUCCESS); 
+        }
+        ++misses;
+        return nullptr;
+    }
+
+    // Remembers a successful resolution, replacing whatever shared its slot
+    void insert(const Inode* base, std::string_view path, Inode* target, unsigned long long generation) {
+        if (entries == nullptr) {
+            entries = new Entry[SLOTS]();
+        }
+        size_t h = hashKey(base, path);
+        Entry& entry = entries[h & (SLOTS - 1)];
+        entry.hash = h;
+        entry.base = base;
+        entry.path.assign(path.data(), path.size());
+        entry.target = target;
+        entry.generation = generation;
+    }
+
+    // Cache counters
+    size_t hitCount() const { return hits; }
+    size_t missCount() const { return misses; }
+
+    // Disable copy construction and assignment for simplicity
+    PathCache(const PathCache&) = delete;
+    PathCache& operator=(const PathCache&) = delete;
+};
+
+// Hash map from strings to values
+// Same scheme as ChildIndex (open addressing, linear probing, backward-shift deletion, cached
+// FNV-1a hashes), but the map owns its keys so it can index entries that are not in the tree
+template <typename Value>
+class StringMap {
+private:
+    struct Slot {
+        size_t hash = 0;        // Cached hash of the key
+        bool used = false;
+        std::string key;
+        Value value = Value();
+    };
+    Slot* slots;            // Table of slots, capacity is always zero or a power of two
+    size_t capacity;        // Number of slots in the table
+    size_t count;           // Number of keys stored in the table
+
+    // Returns the slot holding `key`, or the empty slot where it would go
+    size_t probe(std::string_view key, size_t hash) const {
+        size_t mask = capacity - 1;
+        size_t i = hash & mask;
+        while (slots[i].used && (slots[i].hash != hash || slots[i].key != key)) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    // Grows the table and reinserts every entry using its cached hash
+    void rehash(size_t newCapacity) {
+        Slot* oldSlots = slots;
+        size_t oldCapacity = capacity;
+        slots = new Slot[newCapacity];
+        capacity = newCapacity;
+        for (size_t i = 0; i < oldCapacity; ++i) {
+            if (oldSlots[i].used) {
+                size_t j = oldSlots[i].hash & (capacity - 1);
+                while (slots[j].used) {
+                    j = (j + 1) & (capacity - 1);
                 }
-            // If the command is not recognized, print an error message
-            else                          std::cout << command << ": command not found" << std::endl;
+                slots[j] = std::move(oldSlots[i]);
+            }
         }
-        // If an exception is thrown, print the exception message
-        catch (std::exception &e) {
-            std::cout << "Exception: " << e.what() << std::endl;
+        delete[] oldSlots;
+    }
+
+public:
+    // Constructor: the table is allocated lazily on the first assignment
+    StringMap() : slots(nullptr), capacity(0), count(0) {}
+    ~StringMap() { delete[] slots; }
+
+    // Returns the number of keys in the map
+    size_t size() const { return count; }
+
+    // Returns the value stored under `key`, nullptr if there is none
+    Value* find(std::string_view key) {
+        if (count == 0) {
+            return nullptr;
         }
+        size_t i = probe(key, ChildIndex::hashName(key));
+        return slots[i].used ? &slots[i].value : nullptr;
+    }
+    const Value* find(std::string_view key) const {
+        return const_cast<StringMap*>(this)->find(key);
     }
-}
 
+    // Stores `value` under `key`, replacing any previous value
+    void assign(std::string_view key, Value value) {
+        // Keep the load factor at or below 3/4
+        if ((count + 1) * 4 > capacity * 3) {
+            rehash(capacity == 0 ? 16 : capacity * 2);
+        }
+        size_t hash = ChildIndex::hashName(key);
+        size_t i = probe(key, hash);
+        if (!slots[i].used) {
+            slots[i].used = true;
+            slots[i].hash = hash;
+            slots[i].key.assign(key.data(), key.size());
+            ++count;
+        }
+        slots[i].value = std::move(value);
+    }
 
+    // Removes `key`, returns false if it was not in the map
+    bool erase(std::string_view key) {
+        if (count == 0) {
+            return false;
+        }
+        size_t mask = capacity - 1;
+        size_t hole = probe(key, ChildIndex::hashName(key));
+        if (!slots[hole].used) {
+            return false;
+        }
 
+        // Backward-shift deletion: move any entry whose home slot is at or before the hole into it
+        for (size_t j = (hole + 1) & mask; slots[j].used; j = (j + 1) & mask) {
+            size_t home = slots[j].hash & mask;
+            if (((j - home) & mask) >= ((j - hole) & mask)) {
+                slots[hole] = std::move(slots[j]);
+                hole = j;
+            }
+        }
+        slots[hole] = Slot();
+        --count;
+        return true;
+    }
 
+    // Removes every key
+    void clear() {
+        delete[] slots;
+        slots = nullptr;
+        capacity = 0;
+        count = 0;
+    }
 
+    // Exchanges the contents with another map in O(1)
+    void swap(StringMap& other) {
+        std::swap(slots, other.slots);
+        std::swap(capacity, other.capacity);
+        std::swap(count, other.count);
+    }
 
+    // Disable copy construction and assignment for simplicity
+    StringMap(const StringMap&) = delete;
+    StringMap& operator=(const StringMap&) = delete;
+};
 
+// Tree-wide index of inode names for find
+// Inodes that share a name form a group: an intrusive list through Inode::nameNext/namePrev,
+// headed by the group's first inode. The heads are kept in a ChildIndex, so an exact name is one
+// hash probe. Every group's name is also split into trigrams, padded with a '\0' at each end so
+// prefixes and suffixes have trigrams of their own; a glob only checks the groups that hold all
+// of its literal trigrams. Group ids are never reused, so the trigram lists only ever grow at
+// the end and stay sorted; groups emptied by rm are left as holes until the index is rebuilt.
+class NameIndex {
+private:
+    ChildIndex heads;                       // Name -> first inode of its group
+    Vector<Inode*> groups;                  // Group id -> first inode, nullptr once the group emptied
+    StringMap<Vector<uint32_t>> trigrams;   // Trigram -> ascending ids of the groups whose name holds it
+    size_t entries = 0;                     // Inodes in the index
+    size_t emptyGroups = 0;                 // Groups that are holes
+    bool built = false;                     // False until the first find builds the index
+
+    // Calls visit(trigram) for every trigram of a name padded with '\0' at both ends
+    template <typename Visit>
+    static void forTrigrams(std::string_view name, Visit visit) {
+        std::string padded;
+        padded.reserve(name.size() + 2);
+        padded += '\0';
+        padded.append(name.data(), name.size());
+        padded += '\0';
+        for (size_t i = 0; i + 3 <= padded.size(); ++i) {
+            visit(std::string_view(padded).substr(i, 3));
+        }
+    }
 
+    // Calls visit(node) for every inode in a group
+    template <typename Visit>
+    static void forGroup(const Inode* head, Visit& visit);
 
+public:
+    NameIndex() = default;
+
+    // True once the index has been built; until then nothing is indexed
+    bool active() const { return built; }
+    // Number of indexed inodes
+    size_t size() const { return entries; }
+    // True when rm has emptied more groups than are left, so a rebuild would shrink the index
+    bool sparse() const { return emptyGroups > 1024 && emptyGroups * 2 > groups.size(); }
+
+    // Marks the index as built; every inode in the tree has to be inserted right after
+    void activate() { built = true; }
+    // Drops every entry and turns the index off until it is built again
+    void clear();
+
+    void insert(Inode* node);   // Indexes an inode under its name
+    void erase(Inode* node);    // Removes an inode from the index
+
+    // Calls visit(node) for every indexed inode whose name matches the pattern: a glob if it
+    // holds '*' or '?', an exact name otherwise
+    template <typename Visit>
+    void find(std::string_view pattern, Visit visit) const;
+
+    // Matches a name against a glob where '*' is any run of characters and '?' any one character
+    // (also used by find on snapshots, which walk the tree instead of the index)
+    // On a mismatch only the most recent '*' is widened, so the match is linear in practice
+    static bool globMatch(std::string_view pattern, std::string_view name) {
+        size_t p = 0, n = 0;
+        size_t star = std::string_view::npos, resume = 0;
+        while (n < name.size()) {
+            if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+                ++p;
+                ++n;
+            } else if (p < pattern.size() && pattern[p] == '*') {
+                star = p++;
+                resume = n;
+            } else if (star != std::string_view::npos) {
+                p = star + 1;
+                n = ++resume;
+            } else {
+                return false;
+            }
+        }
+        while (p < pattern.size() && pattern[p] == '*') {
+            ++p;
+        }
+        return p == pattern.size();
+    }
+
+    // Disable copy construction and assignment for simplicity
+    NameIndex(const NameIndex&) = delete;
+    NameIndex& operator=(const NameIndex&) = delete;
+};
+
+// Drops every entry; the inodes' list links are reset as they are inserted again
+inline void NameIndex::clear() {
+    heads.clear();
+    groups.clear();
+    groups.shrink_to_fit();
+    trigrams.clear();
+    entries = 0;
+    emptyGroups = 0;
+    built = false;
+}
+
+// Adds the inode to its name's group, starting a new group (and its trigrams) for a new name
+inline void NameIndex::insert(Inode* node) {
+    ++entries;
+    node->namePrev = nullptr;
+    if (Inode* head = heads.find(node->name)) {
+        // Linked in right after the head, so the head (and the heads table) stay as they are
+        node->nameGroup = head->nameGroup;
+        node->nameNext = head->nameNext;
+        node->namePrev = head;
+        if (head->nameNext != nullptr) {
+            head->nameNext->namePrev = node;
+        }
+        head->nameNext = node;
+        return;
+    }
+    uint32_t id = static_cast<uint32_t>(groups.size());
+    node->nameGroup = id;
+    node->nameNext = nullptr;
+    groups.push_back(node);
+    heads.insert(node);
+    forTrigrams(node->name, [&](std::string_view trigram) {
+        Vector<uint32_t>* list = trigrams.find(trigram);
+        if (list == nullptr) {
+            trigrams.assign(trigram, Vector<uint32_t>());
+            list = trigrams.find(trigram);
+        }
+        // A name can repeat a trigram; the id is the newest, so a repeat is always at the back
+        if (list->empty() || list->back() != id) {
+            list->push_back(id);
+        }
+    });
+}
+
+// Unlinks the inode from its group; a removed head hands the group to the next inode
+inline void NameIndex::erase(Inode* node) {
+    --entries;
+    if (node->namePrev != nullptr) {
+        node->namePrev->nameNext = node->nameNext;
+        if (node->nameNext != nullptr) {
+            node->nameNext->namePrev = node->namePrev;
+        }
+        return;
+    }
+    heads.erase(node);
+    Inode* next = node->nameNext;
+    groups[node->nameGroup] = next;
+    if (next != nullptr) {
+        next->namePrev = nullptr;
+        heads.insert(next);
+    } else {
+        ++emptyGroups;
+    }
+}
+
+template <typename Visit>
+inline void NameIndex::forGroup(const Inode* head, Visit& visit) {
+    for (const Inode* node = head; node != nullptr; node = node->nameNext) {
+        visit(node);
+    }
+}
+
+// Exact names are a single probe of the heads table. A glob collects the trigram lists of its
+// literal runs (padded like the names, so a leading or trailing literal is anchored), intersects
+// them starting from the shortest, and matches the glob against the surviving groups' names.
+// A glob without a literal run of three characters checks the name of every group.
+template <typename Visit>
+void NameIndex::find(std::string_view pattern, Visit visit) const {
+    if (pattern.find_first_of("*?") == std::string_view::npos) {
+        if (const Inode* head = heads.find(pattern)) {
+            forGroup(head, visit);
+        }
+        return;
+    }
+
+    // Trigram lists that every match must appear in
+    Vector<const Vector<uint32_t>*> lists;
+    std::string padded;
+    padded += '\0';
+    padded.append(pattern.data(), pattern.size());
+    padded += '\0';
+    size_t runStart = 0;
+    for (size_t i = 0; i <= padded.size(); ++i) {
+        if (i < padded.size() && padded[i] != '*' && padded[i] != '?') {
+            continue;
+        }
+        for (size_t k = runStart; k + 3 <= i; ++k) {
+            const Vector<uint32_t>* list = trigrams.find(std::string_view(padded).substr(k, 3));
+            if (list == nullptr) {
+                return; // No name holds this trigram
+            }
+            lists.push_back(list);
+        }
+        runStart = i + 1;
+    }
+
+    auto check = [&](uint32_t id) {
+        const Inode* head = groups[id];
+        if (head != nullptr && globMatch(pattern, head->name)) {
+            forGroup(head, visit);
+        }
+    };
+    if (lists.empty()) {
+        for (size_t id = 0; id < groups.size(); ++id) {
+            check(static_cast<uint32_t>(id));
+        }
+        return;
+    }
+
+    // Intersect from the shortest list; each longer list is searched with a moving lower bound
+    std::sort(lists.begin(), lists.end(), [](const Vector<uint32_t>* a, const Vector<uint32_t>* b) {
+        return a->size() < b->size();
+    });
+    Vector<uint32_t> candidates(lists[0]->size());
+    for (uint32_t id : *lists[0]) {
+        candidates.push_back(id);
+    }
+    for (size_t l = 1; l < lists.size() && !candidates.empty(); ++l) {
+        const uint32_t* from = lists[l]->begin();
+        const uint32_t* end = lists[l]->end();
+        size_t kept = 0;
+        for (uint32_t id : candidates) {
+            from = std::lower_bound(from, end, id);
+            if (from == end) {
+                break;
+            }
+            if (*from == id) {
+                candidates[kept++] = id;
+            }
+        }
+        while (candidates.size() > kept) {
+            candidates.pop_back();
+        }
+    }
+    for (uint32_t id : candidates) {
+        check(id);
+    }
+}
+
+// One removed inode in the bin; entries are numbered by a sequence that never repeats
+struct BinEntry {
+    Inode* node = nullptr;      // Removed inode with its subtree, nullptr once recovered (tombstone)
+    Inode* parent = nullptr;    // Directory it was removed from, nullptr if unknown
+    std::string path;           // Original absolute path
+    uint64_t olderByName = 0;   // Sequence number of the next older entry with the same name
+    uint64_t olderByPath = 0;   // Sequence number of the next older entry with the same path
+};
+
+// An emptied bin on its way to the reclaimer: the entries whose subtrees are freed, and the
+// indexes that pointed into them, which are freed along with them
+struct ReclaimBatch {
+    Queue<BinEntry> entries;
+    StringMap<uint64_t> byName;
+    StringMap<uint64_t> byPath;
+    size_t inodes = 0;              // Inodes in the live entries' subtrees
+    ReclaimBatch* next = nullptr;   // Link in the handoff stack
+};
+
+// Background thread that frees emptied bins so 'emptybin' does not wait for the deletes
+// Batches are handed over on a lock-free stack; the mutex and condition variable are only used
+// to put the thread to sleep when there is no work. Inodes are destroyed in bounded chunks and
+// each chunk's slots go back to the pool's remote free list in one atomic push.
+class Reclaimer {
+private:
+    static const size_t CHUNK = 4096;          // Inodes freed between handoffs to the pool
+
+    InodePool& pool;
+    std::atomic<ReclaimBatch*> incoming;       // Handoff stack, newest batch first
+    ReclaimBatch* current = nullptr;           // Batch being freed (worker thread only)
+    ReclaimBatch* waiting = nullptr;           // Batches taken off the stack, oldest first
+    Stack<Inode*> work;                        // Inodes of the current batch still to free
+    std::thread worker;
+    std::mutex sleepLock;
+    std::condition_variable wakeup;
+    std::atomic<bool> stopping;
+    std::atomic<size_t> queuedInodes;          // Inodes ever handed over
+    std::atomic<size_t> freedInodes;           // Inodes ever freed
+    std::atomic<size_t> finishedBatches;
+    std::atomic<uint64_t> busyNanos;           // Time spent freeing
+
+    // Takes every handed-over batch, keeping them in handoff order; returns false if there is none
+    bool takeIncoming() {
+        ReclaimBatch* taken = incoming.exchange(nullptr, std::memory_order_acquire);
+        if (taken == nullptr) {
+            return false;
+        }
+        // The stack is newest first, so reversing it gives handoff order
+        ReclaimBatch* ordered = waiting;
+        ReclaimBatch* reversed = nullptr;
+        while (taken != nullptr) {
+            ReclaimBatch* next = taken->next;
+            taken->next = reversed;
+            reversed = taken;
+            taken = next;
+        }
+        if (ordered == nullptr) {
+            waiting = reversed;
+        } else {
+            while (ordered->next != nullptr) {
+                ordered = ordered->next;
+            }
+            ordered->next = reversed;
+        }
+        return true;
+    }
+
+    // Worker loop: free one chunk at a time until asked to stop
+    void run() {
+        while (!stopping.load(std::memory_order_acquire)) {
+            if (current == nullptr) {
+                if (waiting == nullptr && !takeIncoming()) {
+                    std::unique_lock<std::mutex> lock(sleepLock);
+                    wakeup.wait(lock, [this]() {
+                        return stopping.load(std::memory_order_acquire) ||
+                               incoming.load(std::memory_order_acquire) != nullptr;
+                    });
+                    continue;
+                }
+                current = waiting;
+                waiting = waiting->next;
+                for (size_t i = 0; i < current->entries.getSize(); ++i) {
+                    if (current->entries.at(i).node != nullptr) {
+                        work.push(current->entries.at(i).node);
+                    }
+                }
+            }
+
+            // One bounded chunk: children are pushed before their parent is destroyed
+            auto start = std::chrono::steady_clock::now();
+            InodePool::FreeChain chain;
+            while (chain.count < CHUNK && !work.isEmpty()) {
+                Inode* node = work.pop();
+                for (Inode* child : node->children()) {
+                    work.push(child);
+                }
+                pool.destroyDetached(node, chain);
+            }
+            size_t freed = chain.count;
+            pool.publish(chain);
+            if (work.isEmpty()) {
+                delete current; // The bin's entries and indexes go with it
+                current = nullptr;
+                finishedBatches.fetch_add(1, std::memory_order_relaxed);
+            }
+            busyNanos.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                    std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+            freedInodes.fetch_add(freed, std::memory_order_release);
+        }
+    }
+
+    // Deletes a list of batches without touching their inodes
+    static void discard(ReclaimBatch* batch) {
+        while (batch != nullptr) {
+            ReclaimBatch* next = batch->next;
+            delete batch;
+            batch = next;
+        }
+    }
+
+public:
+    explicit Reclaimer(InodePool& pool)
+        : pool(pool), incoming(nullptr), stopping(false), queuedInodes(0), freedInodes(0),
+          finishedBatches(0), busyNanos(0) {}
+
+    ~Reclaimer() { stop(); }
+
+    // Hands a batch to the worker thread (started on first use); O(1) for the caller
+    void hand(ReclaimBatch* batch) {
+        if (!worker.joinable()) {
+            stopping.store(false, std::memory_order_relaxed);
+            worker = std::thread(&Reclaimer::run, this);
+        }
+        queuedInodes.fetch_add(batch->inodes, std::memory_order_relaxed);
+        batch->next = incoming.load(std::memory_order_relaxed);
+        while (!incoming.compare_exchange_weak(batch->next, batch, std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+        }
+        // Taking the lock orders the push before the worker's check, so the wakeup cannot be lost
+        std::lock_guard<std::mutex> lock(sleepLock);
+        wakeup.notify_one();
+    }
+
+    // Waits until every handed-over inode has been freed
+    void drain() {
+        while (backlog() > 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    // Stops the worker thread. Batches it did not finish are dropped; their inodes stay
+    // allocated in the pool, which frees them in releaseAll.
+    void stop() {
+        if (worker.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(sleepLock);
+                stopping.store(true, std::memory_order_release);
+            }
+            wakeup.notify_one();
+            worker.join();
+        }
+        discard(current);
+        discard(waiting);
+        discard(incoming.exchange(nullptr));
+        current = waiting = nullptr;
+        while (!work.isEmpty()) {
+            work.pop();
+        }
+        queuedInodes.store(freedInodes.load());
+    }
+
+    // Counters for 'stats'
+    size_t backlog() const {
+        return queuedInodes.load(std::memory_order_relaxed) - freedInodes.load(std::memory_order_acquire);
+    }
+    size_t freed() const { return freedInodes.load(std::memory_order_relaxed); }
+    size_t batches() const { return finishedBatches.load(std::memory_order_relaxed); }
+    double busySeconds() const { return busyNanos.load(std::memory_order_relaxed) / 1e9; }
+
+    // Disable copy construction and assignment for simplicity
+    Reclaimer(const Reclaimer&) = delete;
+    Reclaimer& operator=(const Reclaimer&) = delete;
+};
+
+// Chase-Lev work-stealing deque of pointers.
+// The owning worker pushes and pops at the bottom (newest first, so it walks depth-first and
+// stays in cache); idle workers steal from the top (oldest first, so they take large subtrees).
+// The ring grows by copying into one twice the size. A thief may still be reading the old ring,
+// so replaced rings are only freed with the deque.
+template <typename T>
+class WorkDeque {
+private:
+    struct Ring {
+        size_t mask;                    // Capacity - 1, the capacity is a power of two
+        std::atomic<T*>* slots;
+        Ring* retired;                  // Ring this one replaced
+    };
+
+    std::atomic<int64_t> top{0};        // Next slot to steal
+    std::atomic<int64_t> bottom{0};     // Next slot to push
+    std::atomic<Ring*> ring;
+
+    static Ring* makeRing(size_t capacity, Ring* retired) {
+        Ring* r = new Ring;
+        r->mask = capacity - 1;
+        r->slots = new std::atomic<T*>[capacity];
+        r->retired = retired;
+        return r;
+    }
+
+public:
+    explicit WorkDeque(size_t capacity = 256) : ring(makeRing(capacity, nullptr)) {}
+
+    ~WorkDeque() {
+        for (Ring* r = ring.load(); r != nullptr;) {
+            Ring* older = r->retired;
+            delete[] r->slots;
+            delete r;
+            r = older;
+        }
+    }
+
+    // Owner only: adds an item at the bottom
+    void push(T* item) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Ring* r = ring.load(std::memory_order_relaxed);
+        if (static_cast<size_t>(b - t) > r->mask) {
+            Ring* grown = makeRing(2 * (r->mask + 1), r);
+            for (int64_t i = t; i < b; ++i) {
+                grown->slots[i & grown->mask].store(r->slots[i & r->mask].load(std::memory_order_relaxed),
+                                                    std::memory_order_relaxed);
+            }
+            ring.store(grown, std::memory_order_release);
+            r = grown;
+        }
+        r->slots[b & r->mask].store(item, std::memory_order_relaxed);
+        bottom.store(b + 1); // Publishes the item to thieves
+    }
+
+    // Owner only: takes the newest item, nullptr if the deque is empty
+    T* pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Ring* r = ring.load(std::memory_order_relaxed);
+        bottom.store(b);
+        int64_t t = top.load();
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed); // Was already empty
+            return nullptr;
+        }
+        T* item = r->slots[b & r->mask].load(std::memory_order_relaxed);
+        if (t == b) {
+            // Last item: race the thieves for it through top
+            if (!top.compare_exchange_strong(t, t + 1)) {
+                item = nullptr;
+            }
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Any thread: takes the oldest item, nullptr if the deque is empty or another thread won it
+    T* steal() {
+        int64_t t = top.load();
+        int64_t b = bottom.load();
+        if (t >= b) {
+            return nullptr;
+        }
+        Ring* r = ring.load(std::memory_order_acquire);
+        T* item = r->slots[t & r->mask].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    // Disable copy construction and assignment for simplicity
+    WorkDeque(const WorkDeque&) = delete;
+    WorkDeque& operator=(const WorkDeque&) = delete;
+};
+
+// One directory of a du walk
+// Its subdirectories' records are allocated together, in child order, by the worker that
+// scanned it; the report walks them in that order once the counts are in
+struct DuRecord {
+    Inode* dir = nullptr;
+    DuRecord* parent = nullptr;
+    DuRecord* subdirs = nullptr;        // Array of subdirCount records
+    size_t subdirCount = 0;
+    std::atomic<size_t> bytes{0};       // Recounted bytes of the subtree
+    std::atomic<size_t> inodes{0};      // Recounted inodes of the subtree
+    std::atomic<size_t> pending{0};     // Subdirectories still counting, plus one for the scan itself
+};
+
+// Stream buffer that collects output in one large block and writes it to a file descriptor
+// only when the block fills up or the stream is flushed, so batch runs make few write calls
+// Large pieces (file contents from 'read') skip the block and go out straight from the caller's memory
+class OutputBuffer : public std::streambuf {
+private:
+    int fd;                 // Destination file descriptor
+    char* buffer;           // Output block
+    size_t capacity;        // Size of the output block
+
+    // Writes all of `length` bytes at `data`, returns false on a write error
+    bool writeAll(const char* data, size_t length) {
+        while (length > 0) {
+            ssize_t written = write(fd, data, length);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += written;
+            length -= written;
+        }
+        return true;
+    }
+
+    // Writes everything buffered so far, returns false on a write error
+    bool drain() {
+        bool ok = writeAll(pbase(), pptr() - pbase());
+        setp(buffer, buffer + capacity);
+        return ok;
+    }
+
+protected:
+    // Called when the block is full: write it out, then store the pending character
+    int_type overflow(int_type ch) override {
+        if (!drain()) {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    // Called on flush
+    int sync() override {
+        return drain() ? 0 : -1;
+    }
+
+    // Called for multi-byte writes: pieces of at least a quarter block are written directly
+    // (after what is buffered, to keep the order) instead of being copied into the block
+    std::streamsize xsputn(const char* data, std::streamsize count) override {
+        size_t length = static_cast<size_t>(count);
+        if (length < capacity / 4) {
+            return std::streambuf::xsputn(data, count);
+        }
+        return drain() && writeAll(data, length) ? count : 0;
+    }
+
+public:
+    explicit OutputBuffer(int fd, size_t capacity = 1 << 20)
+        : fd(fd), buffer(new char[capacity]), capacity(capacity) {
+        setp(buffer, buffer + capacity);
+    }
+
+    ~OutputBuffer() {
+        drain();
+        delete[] buffer;
+    }
+
+    // Disable copy construction and assignment for simplicity
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+};
+
+// Formats timestamps as "YYYY-MM-DD HH:MM:SS" in local time
+// Inodes created in the same second share a timestamp, so formatted strings are kept in a small
+// direct-mapped table keyed by the second and a listing formats each distinct second once
+class TimeFormatter {
+private:
+    static const size_t SLOTS = 256;
+    struct Slot {
+        int64_t second = 0;         // Timestamp this slot holds
+        bool used = false;
+        char text[20];              // Formatted timestamp, NUL-terminated
+    };
+    Slot slots[SLOTS];
+
+public:
+    // Returns the formatted timestamp; the view stays valid until another second maps to its slot
+    std::string_view format(int64_t second) {
+        Slot& slot = slots[static_cast<uint64_t>(second) % SLOTS];
+        if (!slot.used || slot.second != second) {
+            std::time_t t = static_cast<std::time_t>(second);
+            std::tm local;
+            localtime_r(&t, &local);
+            if (std::strftime(slot.text, sizeof(slot.text), "%Y-%m-%d %H:%M:%S", &local) == 0) {
+                slot.text[0] = '\0';
+            }
+            slot.second = second;
+            slot.used = true;
+        }
+        return slot.text;
+    }
+};
+
+// On-disk image of a tree, written by 'save' and memory-mapped by 'load':
+//   ImageHeader | ImageInode[inodeCount] | ImageBinEntry[binCount] | name/path/contents pool
+// Inodes are stored breadth-first, so the children of every directory form one contiguous
+// range of the table, referenced by index. Names, and the bytes files hold, are offsets into the pool.
+// The root is entry 0 and the bin entries, oldest first, are entries 1..binCount.
+struct ImageHeader {
+    char magic[8];                  // "VFSIMAGE"
+    uint32_t version;               // IMAGE_VERSION
+    uint32_t recordSize;            // sizeof(ImageInode), guards against layout changes
+    uint64_t inodeCount;            // Entries in the inode table
+    uint64_t poolBytes;             // Size of the pool
+    uint64_t binCount;              // Inodes that were in the bin
+    uint64_t sequence;              // Journal records already reflected in the image
+};
+
+// Where a bin entry was removed from, so 'recover' still works after a load
+// The original parent is either in the tree or inside another bin entry's subtree (when it was
+// removed after the entry), and parentBase says which
+struct ImageBinEntry {
+    uint64_t pathOffset;            // Original absolute path of the entry in the string pool
+    uint64_t parentOffset;          // Path of the original parent in the string pool
+    uint32_t pathLength;
+    uint32_t parentLength;
+    uint32_t parentBase;            // 0: parent unknown, 1: absolute path in the tree,
+                                    // n > 1: path relative to bin entry n - 2
+    uint32_t padding;
+};
+
+struct ImageInode {
+    uint64_t size;                  // Own size of the inode
+    uint64_t totalSize;             // Aggregate size of the subtree
+    uint64_t totalInodes;           // Inodes in the subtree
+    uint64_t nameOffset;            // Name in the string pool
+    int64_t ctime;                  // Creation time, seconds since the epoch
+    int64_t mtime;                  // Modification time, seconds since the epoch
+    uint64_t dataOffset;            // Contents of a file in the pool, up to its last block held
+    uint64_t dataLength;            // (the rest of the file, and any zero block, is a hole)
+    uint32_t nameLength;
+    uint32_t firstChild;            // Index of the first child in the table
+    uint32_t childCount;            // Number of children (0 for files)
+    uint8_t type;                   // 0 = file, 1 = directory
+    uint8_t padding[3];
+};
+
+static const uint32_t IMAGE_VERSION = 5;
+
+// Checks a mapped image's header, and that its tables and pool fit in the `length` bytes mapped
+// (both engines load images; inode records are checked one by one as they are built)
+static bool validImage(const char* base, size_t length) {
+    if (length < sizeof(ImageHeader)) {
+        return false;
+    }
+    const ImageHeader* header = reinterpret_cast<const ImageHeader*>(base);
+    const ImageInode* records = reinterpret_cast<const ImageInode*>(base + sizeof(ImageHeader));
+    bool ok = std::memcmp(header->magic, "VFSIMAGE", sizeof(header->magic)) == 0 &&
+              header->version == IMAGE_VERSION && header->recordSize == sizeof(ImageInode) &&
+              header->inodeCount > 0 && header->inodeCount <= UINT32_MAX &&
+              header->binCount < header->inodeCount &&
+              (length - sizeof(ImageHeader)) / sizeof(ImageInode) >= header->inodeCount &&
+              (length - sizeof(ImageHeader) - header->inodeCount * sizeof(ImageInode)) / sizeof(ImageBinEntry) >= header->binCount &&
+              length - sizeof(ImageHeader) - header->inodeCount * sizeof(ImageInode) -
+                  header->binCount * sizeof(ImageBinEntry) >= header->poolBytes &&
+              records[0].type == 1;
+    const ImageBinEntry* binRecords = reinterpret_cast<const ImageBinEntry*>(records + header->inodeCount);
+    for (size_t i = 0; ok && i < header->binCount; ++i) {
+        ok = binRecords[i].pathOffset + binRecords[i].pathLength <= header->poolBytes &&
+             binRecords[i].parentOffset + binRecords[i].parentLength <= header->poolBytes;
+    }
+    return ok;
+}
+
+// Checks that an image record's fields stay inside a pool of `poolBytes`
+static bool validImageRecord(const ImageInode& record, uint64_t poolBytes) {
+    return record.nameLength > 0 && record.type <= 1 && (record.type == 1 || record.childCount == 0) &&
+           record.nameOffset + record.nameLength <= poolBytes &&
+           (record.dataLength == 0 || (record.type == 0 && record.dataLength <= record.size &&
+                                       record.dataOffset + record.dataLength <= poolBytes));
+}
+
+// Append-only log of the mutations made since the last checkpoint
+//   JournalHeader | record | record | ...
+// A record is a u32 body length and a u32 checksum of the body, followed by the body: an
+// operation byte and its arguments (strings as a varint length plus bytes, numbers as varints).
+// Records collect in memory and a whole group is written with one write and one fsync, either
+// when enough records are pending or when the oldest of them has waited long enough.
+// A group that fails to commit is cut off the file again and kept for the next commit, so no
+// later group ever lands behind a torn one (replay stops at the first bad record).
+class Journal {
+public:
+    enum class Op : uint8_t { Mkdir = 1, Touch, Rm, Mv, Recover, Emptybin, Write };
+
+    // Most bytes of written data one record carries; a larger write is logged as several
+    // records so the body length always fits its u32
+    static constexpr size_t MAX_WRITE_DATA = size_t(1) << 30;
+
+    // One decoded record; the views point into the journal contents being replayed
+    struct Record {
+        Op op;
+        std::string_view dir;       // Absolute path of the directory the command ran in
+        std::string_view name;      // Entry the command named (mkdir, touch, rm, mv, write; recover:
+                                    // name, absolute path, or empty for the oldest entry)
+        std::string_view target;    // Destination folder (mv), bytes written (write)
+        uint64_t size = 0;          // File size (touch), offset (write)
+        int64_t time = 0;           // Creation time (mkdir, touch), modification time (write)
+    };
+
+private:
+    // Sequence numbers count records over the whole history, so an image can say how many of
+    // them it already contains and replay skips those even if the journal was not truncated
+    struct JournalHeader {
+        char magic[8];              // "VFSJRNL3"
+        uint64_t firstSequence;     // Sequence number of the first record in the file
+    };
+
+    int fd = -1;                    // Journal file, -1 while no journal is open
+    std::string pending;            // Encoded records not yet written
+    size_t pendingRecords = 0;
+    uint64_t nextSequence = 0;      // Sequence number the next appended record gets
+    size_t groupOps = 64;           // Commit once this many records are pending...
+    std::chrono::milliseconds groupWindow{10}; // ...or once the oldest has waited this long
+    std::chrono::steady_clock::time_point oldestPending;
+    size_t recordCount = 0;         // Records written since startup
+    size_t commitCount = 0;         // Group commits (one fsync each) since startup
+    size_t bytesWritten = 0;
+    size_t failedCommits = 0;       // Commits that failed and were kept for a retry
+    size_t droppedBytes = 0;        // Torn or corrupt tail cut off when the journal was opened
+    uint64_t committedSize = 0;     // File size after the last successful commit
+    bool broken = false;            // A failed group could not be cut off; nothing more is written
+
+    void putVarint(uint64_t value) {
+        while (value >= 0x80) {
+            pending.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        pending.push_back(static_cast<char>(value));
+    }
+
+    void putString(std::string_view text) {
+        putVarint(text.size());
+        pending.append(text.data(), text.size());
+    }
+
+    static bool getVarint(std::string_view& in, uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && !in.empty(); shift += 7) {
+            unsigned char byte = in.front();
+            in.remove_prefix(1);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (byte < 0x80) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool getString(std::string_view& in, std::string_view& text) {
+        uint64_t length;
+        if (!getVarint(in, length) || length > in.size()) {
+            return false;
+        }
+        text = in.substr(0, length);
+        in.remove_prefix(length);
+        return true;
+    }
+
+    static uint32_t checksum(std::string_view body) {
+        return static_cast<uint32_t>(ChildIndex::hashName(body));
+    }
+
+    // Decodes a record body, returns false if it is malformed
+    static bool decode(std::string_view body, Record& record) {
+        if (body.empty() || body[0] < static_cast<char>(Op::Mkdir) || body[0] > static_cast<char>(Op::Write)) {
+            return false;
+        }
+        record = Record();
+        record.op = static_cast<Op>(body[0]);
+        body.remove_prefix(1);
+        uint64_t time = 0;
+        bool ok = true;
+        switch (record.op) {
+            case Op::Mkdir:
+                ok = getString(body, record.dir) && getString(body, record.name) && getVarint(body, time);
+                break;
+            case Op::Rm:
+                ok = getString(body, record.dir) && getString(body, record.name);
+                break;
+            case Op::Touch:
+                ok = getString(body, record.dir) && getString(body, record.name) &&
+                     getVarint(body, record.size) && getVarint(body, time);
+                break;
+            case Op::Mv:
+                ok = getString(body, record.dir) && getString(body, record.name) && getString(body, record.target);
+                break;
+            case Op::Recover:
+                ok = getString(body, record.name);
+                break;
+            case Op::Emptybin:
+                break;
+            case Op::Write:
+                ok = getString(body, record.dir) && getString(body, record.name) && getVarint(body, record.size) &&
+                     getString(body, record.target) && getVarint(body, time);
+                break;
+        }
+        record.time = static_cast<int64_t>(time);
+        return ok && body.empty();
+    }
+
+    // Writes all of `data` at the current file offset
+    bool writeAll(const char* data, size_t length) {
+        while (length > 0) {
+            ssize_t written = ::write(fd, data, length);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += written;
+            length -= written;
+        }
+        return true;
+    }
+
+    // Replaces the file contents with an empty journal starting at `sequence`
+    bool writeHeader(uint64_t sequence) {
+        JournalHeader header = {};
+        std::memcpy(header.magic, "VFSJRNL3", sizeof(header.magic));
+        header.firstSequence = sequence;
+        if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0 ||
+            !writeAll(reinterpret_cast<const char*>(&header), sizeof(header)) || fsync(fd) != 0) {
+            return false;
+        }
+        nextSequence = sequence;
+        committedSize = sizeof(header);
+        broken = false;
+        return true;
+    }
+
+public:
+    Journal() = default;
+
+    // Destructor: commits whatever is still pending
+    ~Journal() {
+        close();
+    }
+
+    // Sets the group commit thresholds
+    void configure(size_t ops, std::chrono::milliseconds window) {
+        groupOps = ops > 0 ? ops : 1;
+        groupWindow = window;
+    }
+
+    // Opens (or creates) a journal and replays every record from sequence `applied` on through
+    // `apply`. A torn or corrupt tail left by a crash is cut off. Returns an error message, or an
+    // empty string on success.
+    template <typename Apply>
+    std::string open(const std::string& path, uint64_t applied, Apply apply) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            return "Cannot open journal '" + path + "'.";
+        }
+        std::string contents;
+        char block[1 << 16];
+        ssize_t bytes;
+        while ((bytes = ::read(fd, block, sizeof(block))) != 0) {
+            if (bytes < 0) {
+                if (errno == EINTR) continue;
+                close();
+                return "Cannot read journal '" + path + "'.";
+            }
+            contents.append(block, bytes);
+        }
+
+        // A new (or never written) journal starts at the image's sequence number
+        if (contents.size() < sizeof(JournalHeader)) {
+            if (!contents.empty() || !writeHeader(applied)) {
+                close();
+                return "'" + path + "' is not a journal.";
+            }
+            return std::string();
+        }
+        JournalHeader header;
+        std::memcpy(&header, contents.data(), sizeof(header));
+        if (std::memcmp(header.magic, "VFSJRNL3", sizeof(header.magic)) != 0) {
+            close();
+            return "'" + path + "' is not a journal.";
+        }
+        if (header.firstSequence > applied) {
+            close();
+            return "Journal '" + path + "' starts after the image; records are missing.";
+        }
+
+        size_t offset = sizeof(JournalHeader);
+        uint64_t sequence = header.firstSequence;
+        Record record;
+        while (contents.size() - offset >= 2 * sizeof(uint32_t)) {
+            uint32_t length, sum;
+            std::memcpy(&length, contents.data() + offset, sizeof(length));
+            std::memcpy(&sum, contents.data() + offset + sizeof(length), sizeof(sum));
+            if (length > contents.size() - offset - 2 * sizeof(uint32_t)) {
+                break;
+            }
+            std::string_view body(contents.data() + offset + 2 * sizeof(uint32_t), length);
+            if (checksum(body) != sum || !decode(body, record)) {
+                break;
+            }
+            // Records the image already contains are skipped
+            if (sequence >= applied) {
+                apply(record);
+            }
+            ++sequence;
+            offset += 2 * sizeof(uint32_t) + length;
+        }
+
+        if (offset < contents.size()) {
+            droppedBytes = contents.size() - offset;
+            if (ftruncate(fd, offset) != 0 || fsync(fd) != 0) {
+                close();
+                return "Cannot repair journal '" + path + "'.";
+            }
+        }
+        lseek(fd, offset, SEEK_SET);
+        nextSequence = sequence;
+        committedSize = offset;
+        return std::string();
+    }
+
+    // Commits pending records and closes the file
+    void close() {
+        if (fd >= 0) {
+            commit();
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    // Adds a record to the current group, committing the group if it is full or old enough
+    // Returns false if a commit was attempted and failed, or the journal can no longer be written
+    bool append(Op op, std::string_view dir = {}, std::string_view name = {}, std::string_view target = {},
+                uint64_t size = 0, int64_t time = 0) {
+        if (broken) {
+            return false;
+        }
+        size_t start = pending.size();
+        pending.append(2 * sizeof(uint32_t), '\0'); // Length and checksum, filled in below
+        pending.push_back(static_cast<char>(op));
+        switch (op) {
+            case Op::Mkdir:
+                putString(dir);
+                putString(name);
+                putVarint(static_cast<uint64_t>(time));
+                break;
+            case Op::Rm:
+                putString(dir);
+                putString(name);
+                break;
+            case Op::Touch:
+                putString(dir);
+                putString(name);
+                putVarint(size);
+                putVarint(static_cast<uint64_t>(time));
+                break;
+            case Op::Mv:
+                putString(dir);
+                putString(name);
+                putString(target);
+                break;
+            case Op::Recover:
+                putString(name);
+                break;
+            case Op::Emptybin:
+                break;
+            case Op::Write:
+                putString(dir);
+                putString(name);
+                putVarint(size);
+                putString(target);
+                putVarint(static_cast<uint64_t>(time));
+                break;
+        }
+        std::string_view body(pending.data() + start + 2 * sizeof(uint32_t), pending.size() - start - 2 * sizeof(uint32_t));
+        if (body.size() > UINT32_MAX) {
+            pending.resize(start); // A truncated length would read back as a torn tail
+            return false;
+        }
+        uint32_t length = static_cast<uint32_t>(body.size());
+        uint32_t sum = checksum(body);
+        std::memcpy(&pending[start], &length, sizeof(length));
+        std::memcpy(&pending[start + sizeof(length)], &sum, sizeof(sum));
+        ++nextSequence;
+
+        auto now = std::chrono::steady_clock::now();
+        if (pendingRecords++ == 0) {
+            oldestPending = now;
+        }
+        if (pendingRecords >= groupOps || now - oldestPending >= groupWindow) {
+            return commit();
+        }
+        return true;
+    }
+
+    // Writes and syncs the pending group; returns false on an I/O error
+    // A short write, ENOSPC or a failed sync cuts the file back to the last committed group and
+    // keeps the records pending, so the next commit writes them again in the same place
+    bool commit() {
+        if (pendingRecords == 0 || fd < 0) {
+            return true;
+        }
+        if (broken) {
+            return false;
+        }
+        if (!writeAll(pending.data(), pending.size()) || fdatasync(fd) != 0) {
+            ++failedCommits;
+            if (ftruncate(fd, committedSize) != 0 || lseek(fd, committedSize, SEEK_SET) < 0) {
+                broken = true;
+            }
+            return false;
+        }
+        recordCount += pendingRecords;
+        bytesWritten += pending.size();
+        committedSize += pending.size();
+        ++commitCount;
+        pending.clear();
+        pendingRecords = 0;
+        return true;
+    }
+
+    // Milliseconds until the oldest pending record is due for its group commit, -1 if none is pending
+    long long untilDue() const {
+        if (pendingRecords == 0 || fd < 0) {
+            return -1;
+        }
+        auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - oldestPending);
+        return waited >= groupWindow ? 0 : (groupWindow - waited).count();
+    }
+
+    // Empties the journal after a checkpoint; pending records are part of the checkpoint image
+    bool truncate() {
+        pending.clear();
+        pendingRecords = 0;
+        return writeHeader(nextSequence);
+    }
+
+    bool isOpen() const { return fd >= 0; }
+    uint64_t sequence() const { return nextSequence; }      // Records logged over the whole history
+    size_t records() const { return recordCount; }
+    size_t commits() const { return commitCount; }
+    size_t bytes() const { return bytesWritten; }
+    size_t pendingCount() const { return pendingRecords; }
+    size_t failed() const { return failedCommits; }
+    size_t dropped() const { return droppedBytes; }
+
+    // Disable copy construction and assignment for simplicity
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+};
+
+// Commands with their own call, error and latency counters in 'stats'
+enum class Command : uint8_t {
+    Pwd, Ls, Mkdir, Touch, Cd, Rm, Size, Find, Du, Showbin, Recover, Mv, Emptybin, Save, Load, Checkpoint,
+    Snapshot, Write, Read,
+    Count
+};
+
+// Names of the commands, in the order of the enum
+static const char* const COMMAND_NAMES[] = {
+    "pwd", "ls", "mkdir", "touch", "cd", "rm", "size", "find", "du", "showbin", "recover", "mv", "emptybin",
+    "save", "load", "checkpoint", "snapshot", "write", "read",
+};
+
+#ifndef VFS_NO_STATS
+// Log-linear latency histogram in the style of HdrHistogram: values below 32 get a bucket each,
+// and every power of two above that is split into 16 equal buckets, so a recorded value is known
+// to within 1/16 of itself and the whole 64-bit range fits in a fixed table.
+// Each histogram has one writer (its session's thread) and is read by 'stats' from another, so
+// the counters are relaxed atomics that the writer updates with a plain load and store.
+class LatencyHistogram {
+public:
+    static const size_t SUB_BUCKETS = 16;
+    static const size_t BUCKETS = 61 * SUB_BUCKETS;    // Bucket of UINT64_MAX is the last one
+
+    // Returns the bucket a value falls into
+    static size_t bucketOf(uint64_t value) {
+        if (value < 2 * SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+        unsigned shift = 63 - __builtin_clzll(value) - 4;    // Keeps the top 5 bits of the value
+        return shift * SUB_BUCKETS + static_cast<size_t>(value >> shift);
+    }
+
+    // Returns the largest value that falls into a bucket
+    static uint64_t bucketLimit(size_t bucket) {
+        if (bucket < 2 * SUB_BUCKETS) {
+            return bucket;
+        }
+        unsigned shift = static_cast<unsigned>(bucket / SUB_BUCKETS - 1);
+        uint64_t top = bucket % SUB_BUCKETS + SUB_BUCKETS + 1;
+        return (top << shift) - 1;  // Wraps to UINT64_MAX for the last bucket
+    }
+
+private:
+    std::atomic<uint64_t>* counts;          // BUCKETS counters
+    std::atomic<uint64_t> total{0};         // Values recorded
+    std::atomic<uint64_t> sum{0};           // Sum of the values, for the mean
+    std::atomic<uint64_t> largest{0};       // Largest value recorded
+
+    // Adds to a counter that only this histogram's writer changes
+    static void add(std::atomic<uint64_t>& counter, uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+public:
+    LatencyHistogram() : counts(new std::atomic<uint64_t>[BUCKETS]()) {}
+    ~LatencyHistogram() { delete[] counts; }
+
+    // Records one value
+    void record(uint64_t value) {
+        add(counts[bucketOf(value)], 1);
+        add(total, 1);
+        add(sum, value);
+        if (value > largest.load(std::memory_order_relaxed)) {
+            largest.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    // Adds another histogram's values to this one
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            if (uint64_t n = other.counts[i].load(std::memory_order_relaxed)) {
+                add(counts[i], n);
+            }
+        }
+        add(total, other.total.load(std::memory_order_relaxed));
+        add(sum, other.sum.load(std::memory_order_relaxed));
+        largest.store(std::max(largest.load(std::memory_order_relaxed), other.largest.load(std::memory_order_relaxed)),
+                      std::memory_order_relaxed);
+    }
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t max() const { return largest.load(std::memory_order_relaxed); }
+    uint64_t mean() const { return count() == 0 ? 0 : sum.load(std::memory_order_relaxed) / count(); }
+
+    // Returns the value below which the given fraction of the values fall (the bucket's upper end)
+    uint64_t percentile(double fraction) const {
+        uint64_t rank = static_cast<uint64_t>(fraction * count() + 0.5);
+        rank = std::max<uint64_t>(rank, 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return std::min(bucketLimit(i), max());
+            }
+        }
+        return max();
+    }
+
+    // Calls visit(limit, count) for every bucket that holds values, smallest first
+    template <typename Visit>
+    void forBuckets(Visit visit) const {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            if (uint64_t n = counts[i].load(std::memory_order_relaxed)) {
+                visit(bucketLimit(i), n);
+            }
+        }
+    }
+
+    // Disable copy construction and assignment for simplicity
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+};
+
+// Calls, errors and latencies (in nanoseconds) of every command run by one session
+class CommandStats {
+public:
+    struct Counters {
+        std::atomic<uint64_t> errors{0};    // Calls that reported an error
+        LatencyHistogram latency;           // One value per call
+    };
+
+private:
+    Counters counters[static_cast<size_t>(Command::Count)];
+
+public:
+    // Records one call of a command
+    void record(Command command, uint64_t nanoseconds, bool failed) {
+        Counters& counter = counters[static_cast<size_t>(command)];
+        counter.latency.record(nanoseconds);
+        if (failed) {
+            counter.errors.store(counter.errors.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+
+    // Adds another session's counters to these
+    void merge(const CommandStats& other) {
+        for (size_t i = 0; i < static_cast<size_t>(Command::Count); ++i) {
+            counters[i].latency.merge(other.counters[i].latency);
+            counters[i].errors.store(counters[i].errors.load(std::memory_order_relaxed) +
+                                     other.counters[i].errors.load(std::memory_order_relaxed),
+                                     std::memory_order_relaxed);
+        }
+    }
+
+    const Counters& operator[](Command command) const { return counters[static_cast<size_t>(command)]; }
+};
+#endif
+
+class FileSystem;
+
+// A named point-in-time view of a FileSystem's tree (see FileSystem::snapshot)
+struct Snapshot {
+    std::string name;
+    uint32_t epoch;        // Id of the snapshot; ids only grow, so later snapshots have larger ones
+    size_t viewers = 0;    // Sessions viewing the snapshot, which cannot be deleted until they leave it
+};
+
+// What the 'snapshot' command does
+enum class SnapshotOp { Take, List, Drop, View };
+
+// One client of a FileSystem: its working directories, path cache and output stream.
+// Any number of sessions can run commands on the same tree from different threads, each
+// session from one thread at a time. A session joins the tree at its root when constructed
+// and must be destroyed before the FileSystem.
+class Session {
+public:
+    Session(FileSystem& vfs, std::ostream& output);
+    ~Session();
+
+    // Returns the stream this session's command output is written to
+    std::ostream& output() { return out; }
+
+    // Disable copy construction and assignment for simplicity
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+private:
+    friend class FileSystem;
+
+    FileSystem& vfs;
+    std::ostream& out;            // Where command output goes (the terminal, or a buffered sink in batch mode)
+    Inode* currentInode;          // Working directory, always in the tree (or in the viewed snapshot)
+    Inode* previousInode;         // Previous working directory for 'cd -', may have been removed since
+    Snapshot* view = nullptr;     // Snapshot the read-only commands look at, nullptr for the live tree
+    PathCache pathCache;          // Resolved paths, valid for the current tree generation
+    TimeFormatter timeFormatter;  // Formats the timestamps ls prints
+#ifndef VFS_NO_STATS
+    CommandStats commandStats;    // Calls, errors and latencies of the commands run in this session
+#endif
+    // Held by this session for the length of each command, and by commands that need the whole
+    // tree to themselves (see FileSystem::ExclusiveAccess)
+    std::mutex gate;
+    Session* nextSession = nullptr;   // Registry of the sessions on the same tree
+    Session* prevSession = nullptr;
+};
+
+// Definition of FileSystem class
+// Concurrency: commands that only read the tree or add to it (pwd, ls, cd, size, find, read, mkdir,
+// touch, showbin) run in parallel from different sessions. Each holds its own session's gate, and takes
+// the DirLock of each directory it looks at, one directory at a time, so lock order never matters.
+// Commands that detach, move, free or change inodes, or need a still tree (rm, mv, write, recover,
+// emptybin, du, save, load, checkpoint, snapshot, stats), take every session's gate first and run alone.
+class FileSystem {
+private:
+    friend class Session;
+
+    std::ostream& out;     // Where diagnostics that belong to no command go (corrupt image records)
+    BlockStore blocks;     // Contents of the files; outlives the inodes, which give their blocks back
+    InodePool inodePool;   // Owns every inode in the tree and in the bin
+    std::mutex poolLock;   // Serializes inodePool.create between concurrent mkdir/touch
+    Inode* rootInode;      // Root of the file system
+    std::mutex sessionsLock;       // Guards the session registry; held by ExclusiveAccess
+    Session* sessions = nullptr;   // Every session on this tree
+#ifndef VFS_NO_STATS
+    CommandStats retiredStats;     // Command counters of the sessions that have left
+#endif
+    static const uint64_t NO_ENTRY = UINT64_MAX;
+    Queue<BinEntry> bin;                // Removed inodes, oldest first; recovered entries stay as tombstones
+    uint64_t binFront = 0;              // Sequence number of bin.at(0)
+    size_t binLive = 0;                 // Entries that are not tombstones
+    size_t binInodes = 0;               // Inodes in the live entries' subtrees
+    Reclaimer reclaimer{inodePool};     // Frees emptied bins in the background
+    static const size_t SYNC_RECLAIM_LIMIT = 4096; // Bins up to this size are freed inline by emptybin
+    StringMap<uint64_t> binByName;      // Name -> newest live entry with that name
+    StringMap<uint64_t> binByPath;      // Original path -> newest live entry with that path
+    unsigned long long treeGeneration = 0; // Bumped whenever a directory may be detached or freed
+    // Memory-mapped image the tree was loaded from; directories are built from it on first use
+    void* imageMapping = nullptr;
+    size_t imageLength = 0;
+    const ImageInode* imageRecords = nullptr;
+    const char* imagePool = nullptr;
+    uint64_t imageInodes = 0;
+    uint64_t imagePoolBytes = 0;
+    // Write-ahead journal of mutations; stays closed unless the shell was started with --journal
+    Journal journal;
+    std::mutex journalLock;                // Serializes appends from concurrent mkdir/touch
+    std::string checkpointPath;            // Image written by 'checkpoint'
+    uint64_t imageSequence = 0;            // Journal sequence number of the last loaded image
+    bool replaying = false;                // True while journal records are being re-applied
+    // Every inode in the tree by name, for find; built by the first find and kept up to date after
+    NameIndex nameIndex;
+    std::mutex indexLock;                  // Serializes index updates from concurrent mkdir/touch
+    bool fastExit = false;                 // Destructor leaves the inodes to the operating system
+    // Point-in-time views of the tree; while any exists, directories keep their old states
+    Vector<Snapshot*> snapshots;
+    uint32_t snapshotsTaken = 0;           // Ids handed out so far, the next snapshot gets the next one
+    uint32_t newestEpoch = 0;              // Id of the newest snapshot that still exists, 0 if there is none
+    Vector<Inode*> versionedDirs;          // Directories holding versions, so they can all be dropped at once
+    size_t versionCount = 0;               // Versions kept, and the child entries they hold
+    size_t versionChildren = 0;
+    std::mutex versionLock;                // Serializes the three above between concurrent mkdir/touch
+    Vector<Inode*> retained;               // Bin entries emptied, and files replaced by writes, while a snapshot could still see them
+    size_t retainedInodes = 0;             // Inodes in their subtrees
+
+    // Scoped ownership of the whole tree: holds the registry lock and every session's gate, so
+    // no other command is running when the constructor returns
+    class ExclusiveAccess {
+    private:
+        FileSystem& vfs;
+
+    public:
+        explicit ExclusiveAccess(FileSystem& vfs) : vfs(vfs) {
+            vfs.sessionsLock.lock();
+            for (Session* session = vfs.sessions; session != nullptr; session = session->nextSession) {
+                session->gate.lock();
+            }
+        }
+
+        ~ExclusiveAccess() {
+            for (Session* session = vfs.sessions; session != nullptr; session = session->nextSession) {
+                session->gate.unlock();
+            }
+            vfs.sessionsLock.unlock();
+        }
+
+        ExclusiveAccess(const ExclusiveAccess&) = delete;
+        ExclusiveAccess& operator=(const ExclusiveAccess&) = delete;
+    };
+
+    // Times one command into its session's counters, including any wait for the tree
+    // A command that reports an error calls fail(). With VFS_NO_STATS this compiles to nothing.
+    class CommandTimer {
+#ifndef VFS_NO_STATS
+    private:
+        CommandStats& stats;
+        Command command;
+        bool failed = false;
+        std::chrono::steady_clock::time_point start;
+
+    public:
+        CommandTimer(Session& session, Command command)
+            : stats(session.commandStats), command(command), start(std::chrono::steady_clock::now()) {}
+
+        ~CommandTimer() {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            stats.record(command, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), failed);
+        }
+
+        void fail() { failed = true; }
+#else
+    public:
+        CommandTimer(Session&, Command) {}
+        void fail() {}
+#endif
+
+        CommandTimer(const CommandTimer&) = delete;
+        CommandTimer& operator=(const CommandTimer&) = delete;
+    };
+
+    // Adds a session to the registry, starting at the root
+    void join(Session& session) {
+        std::lock_guard<std::mutex> guard(sessionsLock);
+        session.currentInode = rootInode;
+        session.previousInode = nullptr;
+        session.nextSession = sessions;
+        if (sessions != nullptr) {
+            sessions->prevSession = &session;
+        }
+        sessions = &session;
+    }
+
+    // Removes a session from the registry, keeping its command counters
+    void leave(Session& session) {
+        std::lock_guard<std::mutex> guard(sessionsLock);
+        if (session.view != nullptr) {
+            --session.view->viewers;
+        }
+#ifndef VFS_NO_STATS
+        retiredStats.merge(session.commandStats);
+#endif
+        if (session.prevSession != nullptr) {
+            session.prevSession->nextSession = session.nextSession;
+        } else {
+            sessions = session.nextSession;
+        }
+        if (session.nextSession != nullptr) {
+            session.nextSession->prevSession = session.prevSession;
+        }
+    }
+
+    // Looks a name up in a directory under its read lock, nullptr if there is no such child
+    // Given a snapshot id, the directory is looked at as that snapshot saw it
+    Inode* lookup(Inode* dir, std::string_view name, uint32_t epoch = 0) {
+        expand(dir);
+        std::shared_lock<DirLock> guard(dir->lock);
+        if (epoch != 0) {
+            if (const DirVersion* version = versionAt(dir, epoch)) {
+                for (Inode* child : version->children) {
+                    if (child->name == name) {
+                        return child;
+                    }
+                }
+                return nullptr;
+            }
+        }
+        return dir->findChild(name);
+    }
+
+    // Adds (or, with grow false, subtracts) a subtree's bytes and inodes to dir and its ancestors
+    // Inode::growTotals does the same without locks; this version runs alongside other commands,
+    // taking each parent's lock in turn (the root's totals are guarded by its own lock)
+    void adjustTotals(Inode* dir, size_t bytes, size_t inodes, bool grow) {
+        for (Inode* node = dir; node != nullptr; node = node->parent) {
+            Inode* parent = node->parent;
+            std::lock_guard<DirLock> guard(parent != nullptr ? parent->lock : node->lock);
+            if (grow) {
+                node->totalSize += bytes;
+                node->totalInodes += inodes;
+            } else {
+                node->totalSize -= bytes;
+                node->totalInodes -= inodes;
+            }
+            if (parent != nullptr) {
+                parent->dirData->sizeOrder.update(node);
+            }
+        }
+    }
+
+
+
+ // Builds the children of a directory loaded from an image, if that has not happened yet
+    // Every path that looks at a directory's children calls this first, holding no DirLock
+    Inode* expand(Inode* dir) {
+        if (dir->type != Inode::Type::Directory || dir->dirData->pendingChildren.load(std::memory_order_acquire) == nullptr) {
+            return dir;
+        }
+        // Several sessions can reach the directory at once; whoever gets the lock first builds it
+        size_t lostBytes = 0, lostInodes = 0;
+        {
+            std::lock_guard<DirLock> guard(dir->lock);
+            const ImageInode* pending = dir->dirData->pendingChildren.load(std::memory_order_relaxed);
+            if (pending == nullptr) {
+                return dir;
+            }
+            const ImageInode& record = *pending;
+            size_t index = &record - imageRecords;
+
+            // Records are validated as they are reached: the child range must lie after the
+            // directory itself (so the image cannot form a cycle) and inside the table
+            bool ok = record.firstChild > index &&
+                      record.firstChild + static_cast<uint64_t>(record.childCount) <= imageInodes;
+            for (size_t k = record.firstChild; ok && k < record.firstChild + record.childCount; ++k) {
+                ok = validRecord(imageRecords[k]);
+            }
+            if (!ok) {
+                out << "Error: Image record " << index << " is corrupt; its directory is left empty." << '\n';
+                lostBytes = record.totalSize - record.size;
+                lostInodes = record.totalInodes - 1;
+            } else {
+                dir->reserveChildren(record.childCount);
+                for (size_t k = record.firstChild; k < record.firstChild + record.childCount; ++k) {
+                    const ImageInode& child = imageRecords[k];
+                    std::string_view name(imagePool + child.nameOffset, child.nameLength);
+                    if (dir->findChild(name)) {
+                        out << "Error: Image record " << k << " repeats the name '" << name << "'; skipped." << '\n';
+                        lostBytes += child.totalSize;
+                        lostInodes += child.totalInodes;
+                        continue;
+                    }
+                    dir->linkChild(buildInode(child));
+                }
+            }
+            dir->dirData->pendingChildren.store(nullptr, std::memory_order_release);
+        }
+        // The stored totals counted the lost children, take them back out
+        if (lostInodes > 0) {
+            adjustTotals(dir, lostBytes, lostInodes, false);
+        }
+        return dir;
+    }
+
+    // Checks that an image record's fields stay inside the mapped image
+    bool validRecord(const ImageInode& record) const {
+        return validImageRecord(record, imagePoolBytes);
+    }
+
+    // Creates the inode for a validated image record; its children stay in the image until expanded
+    Inode* buildInode(const ImageInode& record) {
+        Inode* node;
+        {
+            std::lock_guard<std::mutex> guard(poolLock);
+            node = inodePool.create(std::string(imagePool + record.nameOffset, record.nameLength),
+                                    record.type == 1 ? Inode::Type::Directory : Inode::Type::File,
+                                    record.size, record.ctime);
+        }
+        node->mtime = record.mtime;
+        // Totals come straight from the image, so nothing is recomputed or propagated
+        node->totalSize = record.totalSize;
+        node->totalInodes = record.totalInodes;
+        if (record.childCount > 0) {
+            node->dirData->pendingChildren = &record;
+        }
+        if (record.dataLength > 0) {
+            loadContents(node, std::string_view(imagePool + record.dataOffset, record.dataLength));
+        }
+        return node;
+    }
+
+    // Copies a file's contents from the image into blocks, leaving all-zero blocks as holes
+    void loadContents(Inode* file, std::string_view contents) {
+        file->fileData = new FileData(blocks);
+        for (size_t offset = 0; offset < contents.size(); offset += BlockStore::BLOCK_SIZE) {
+            std::string_view piece = contents.substr(offset, BlockStore::BLOCK_SIZE);
+            if (std::memcmp(piece.data(), BlockStore::ZEROS, piece.size()) != 0 &&
+                file->fileData->write(offset, piece) < piece.size()) {
+                out << "Error: Out of block storage; '" << file->name << "' is loaded without all of its contents." << '\n';
+                return;
+            }
+        }
+    }
+
+    // Unmaps the image once no directory can refer to it any more
+    void releaseImage() {
+        if (imageMapping != nullptr) {
+            munmap(imageMapping, imageLength);
+            imageMapping = nullptr;
+            imageRecords = nullptr;
+            imagePool = nullptr;
+        }
+    }
+
+    // Writes the tree and the bin to an image file (save and checkpoint)
+    // The image is written to a temporary file, synced, and renamed over the target
+    bool writeImage(Session& session, const std::string& path) {
+        std::string tempPath = path + ".tmp";
+        int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            session.out << "Error: Cannot create '" << tempPath << "'." << '\n';
+            return false;
+        }
+
+        ImageHeader header = {};
+        std::memcpy(header.magic, "VFSIMAGE", sizeof(header.magic));
+        header.version = IMAGE_VERSION;
+        header.recordSize = sizeof(ImageInode);
+        header.inodeCount = rootInode->totalInodes;
+        header.binCount = binLive;
+        header.sequence = journal.isOpen() ? journal.sequence() : imageSequence;
+
+        // Records are streamed through a buffered writer; names collect in the pool
+        bool ok;
+        {
+            OutputBuffer sink(fd);
+            std::ostream image(&sink);
+            image.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+            // Breadth-first walk: `order` doubles as the queue, so a node's children are
+            // appended right where the table expects them
+            // The bin entries are extra top-level entries right after the root
+            Vector<Inode*> order;
+            order.reserve(rootInode->totalInodes);
+            order.push_back(rootInode);
+            std::string pool;
+            Vector<ImageBinEntry> binEntries(header.binCount);
+            Vector<uint32_t> rank(bin.getSize()); // Position of each live entry among the saved ones
+            for (size_t i = 0, live = 0; i < bin.getSize(); ++i) {
+                rank.push_back(static_cast<uint32_t>(live));
+                live += bin.at(i).node != nullptr;
+            }
+            for (size_t i = 0; i < bin.getSize(); ++i) {
+                const BinEntry& removed = bin.at(i);
+                if (removed.node == nullptr) {
+                    continue; // Tombstone of a recovered entry
+                }
+                ImageBinEntry entry = {};
+                entry.pathOffset = pool.size();
+                entry.pathLength = static_cast<uint32_t>(removed.path.size());
+                pool += removed.path;
+                if (removed.parent != nullptr) {
+                    // A parent outside the tree is stored relative to the entry that holds it
+                    std::string parentPath;
+                    const Inode* top = detachedRoot(removed.parent);
+                    if (top == rootInode) {
+                        entry.parentBase = 1;
+                        parentPath = constructPath(removed.parent);
+                    } else {
+                        entry.parentBase = 2 + rank[binSequence(top) - binFront];
+                        for (const Inode* node = removed.parent; node != top; node = node->parent) {
+                            parentPath = parentPath.empty() ? node->name : node->name + "/" + parentPath;
+                        }
+                    }
+                    entry.parentOffset = pool.size();
+                    entry.parentLength = static_cast<uint32_t>(parentPath.size());
+                    pool += parentPath;
+                }
+                binEntries.push_back(entry);
+                order.push_back(removed.node);
+                header.inodeCount += removed.node->totalInodes;
+            }
+            for (size_t i = 0; i < order.size(); ++i) {
+                Inode* node = expand(order[i]); // Directories not used since a load are built here
+                ImageInode record = {};
+                record.size = node->size;
+                record.totalSize = node->totalSize;
+                record.totalInodes = node->totalInodes;
+                record.nameOffset = pool.size();
+                record.nameLength = static_cast<uint32_t>(node->name.size());
+                pool += node->name;
+                record.ctime = node->ctime;
+                record.mtime = node->mtime;
+                record.firstChild = static_cast<uint32_t>(order.size());
+                record.childCount = static_cast<uint32_t>(node->children().size());
+                record.type = node->type == Inode::Type::Directory ? 1 : 0;
+                if (record.type == 0 && node->fileData != nullptr) {
+                    record.dataOffset = pool.size();
+                    record.dataLength = std::min(node->size, node->fileData->storedEnd());
+                    node->fileData->read(0, record.dataLength, [&](const char* data, size_t length) {
+                        pool.append(data, length);
+                    });
+                }
+                for (Inode* child : node->children()) {
+                    order.push_back(child);
+                }
+                image.write(reinterpret_cast<const char*>(&record), sizeof(record));
+            }
+            for (const ImageBinEntry& entry : binEntries) {
+                image.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+            }
+            image.write(pool.data(), pool.size());
+            image.flush();
+            ok = image.good();
+            header.poolBytes = pool.size();
+        }
+
+        // The pool size is only known at the end, so the header is rewritten in place
+        ok = ok && pwrite(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+        ok = ok && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        if (!ok || rename(tempPath.c_str(), path.c_str()) != 0) {
+            unlink(tempPath.c_str());
+            session.out << "Error: Failed to write image '" << path << "'." << '\n';
+            return false;
+        }
+        session.out << "Saved " << header.inodeCount << " inodes to '" << path << "'." << '\n';
+        return true;
+    }
+
+    // Writes the checkpoint image and empties the journal (checkpoint and load)
+    bool writeCheckpoint(Session& session) {
+        if (!journal.isOpen()) {
+            session.out << "Error: No journal is open." << '\n';
+            return false;
+        }
+        if (!writeImage(session, checkpointPath)) {
+            return false;
+        }
+        if (!journal.truncate()) {
+            session.out << "Error: Cannot truncate the journal." << '\n';
+            return false;
+        }
+        session.out << "Checkpoint written; journal truncated." << '\n';
+        return true;
+    }
+
+ // Helper method that recomputes the totals of a subtree from scratch
+    // Returns false (and reports the inode) if any maintained total disagrees with the recount
+    bool verifyTotals(Inode* node, size_t& bytes, size_t& inodes) {
+        expand(node);
+        bool ok = true;
+        bytes = node->size; // Start with the inode's own size
+        inodes = 1;
+        for (const auto& child : node->children()) {
+            size_t childBytes, childInodes;
+            ok = verifyTotals(child, childBytes, childInodes) && ok; // Recursively sum the subtrees
+            bytes += childBytes;
+            inodes += childInodes;
+        }
+        if (bytes != node->totalSize || inodes != node->totalInodes) {
+            out << "Totals mismatch at '" << node->getFullPath() << "': maintained "
+                      << node->totalSize << " bytes/" << node->totalInodes << " inodes, recomputed "
+                      << bytes << " bytes/" << inodes << " inodes" << '\n';
+            ok = false;
+        }
+        return ok;
+    }
+
+    // This helper method constructs the full path of an inode
+    std::string constructPath(const Inode* inode) const {
+        return inode->getFullPath();
+    }
+
+    // Shared path resolver used by cd, recover and load
+    // Resolves a path to a directory, starting at the root for absolute paths or at `base` otherwise.
+    // Returns nullptr if a component is missing or not a directory; `failed` is then set to that component.
+    // Results are cached in the session's path cache, if one is given.
+    // Given a snapshot id, the path is resolved in that snapshot (with no cache: it only holds live paths).
+    Inode* resolvePath(PathCache* cache, Inode* base, std::string_view path, std::string_view* failed = nullptr,
+                       uint32_t epoch = 0) {
+        Inode* start = (!path.empty() && path[0] == '/') ? rootInode : base;
+
+        // Repeated resolutions of the same path are a single probe of the cache
+        if (cache != nullptr) {
+            if (Inode* cached = cache->find(start, path, treeGeneration)) {
+                return cached;
+            }
+        }
+
+        Inode* targetInode = start;
+        PathTokenizer tokens(path);
+        std::string_view token;
+        while (tokens.next(token)) {
+            // Skip '.'
+            if (token == ".") continue;
+            // If token is '..', move up to the parent directory but not above root
+            if (token == "..") {
+                if (targetInode != rootInode) {
+                    targetInode = targetInode->parent;
+                }
+                continue;
+            }
+
+            // Look the directory up in the current inode's child index
+            Inode* child = lookup(targetInode, token, epoch);
+            if (!child || child->type != Inode::Type::Directory) {
+                if (failed) {
+                    *failed = token;
+                }
+                return nullptr;
+            }
+            targetInode = child;
+        }
+
+        if (cache != nullptr) {
+            cache->insert(start, path, targetInode, treeGeneration);
+        }
+        return targetInode;
+    }
+
+    // Puts a removed inode into the bin and indexes it by name and original path
+    void binInsert(Inode* node, Inode* parent, std::string path) {
+        uint64_t sequence = binFront + bin.getSize();
+        BinEntry entry;
+        entry.node = node;
+        entry.parent = parent;
+        const uint64_t* newest = binByName.find(node->name);
+        entry.olderByName = newest ? *newest : NO_ENTRY;
+        newest = binByPath.find(path);
+        entry.olderByPath = newest ? *newest : NO_ENTRY;
+        entry.path = std::move(path);
+        binByName.assign(node->name, sequence);
+        binByPath.assign(entry.path, sequence);
+        bin.enqueue(std::move(entry));
+        ++binLive;
+        binInodes += node->totalInodes;
+    }
+
+    // Points an index key at the next older live entry after `sequence` was recovered
+    // Tombstones are skipped here rather than unlinked when they are made
+    void binUnlink(StringMap<uint64_t>& index, const std::string& key, uint64_t sequence,
+                   uint64_t BinEntry::*older) {
+        uint64_t* head = index.find(key);
+        if (head == nullptr || *head != sequence) {
+            return; // A newer live entry still owns the key
+        }
+        uint64_t next = bin.at(sequence - binFront).*older;
+        while (next != NO_ENTRY && next >= binFront && bin.at(next - binFront).node == nullptr) {
+            next = bin.at(next - binFront).*older;
+        }
+        if (next == NO_ENTRY || next < binFront) {
+            index.erase(key);
+        } else {
+            *head = next;
+        }
+    }
+
+    // Turns a recovered entry into a tombstone and drops tombstones from the front of the bin
+    void binRelease(uint64_t sequence) {
+        BinEntry& entry = bin.at(sequence - binFront);
+        binUnlink(binByName, entry.node->name, sequence, &BinEntry::olderByName);
+        binUnlink(binByPath, entry.path, sequence, &BinEntry::olderByPath);
+        binInodes -= entry.node->totalInodes;
+        entry.node = nullptr;
+        entry.path = std::string();
+        --binLive;
+        while (!bin.isEmpty() && bin.front_element().node == nullptr) {
+            bin.dequeue();
+            ++binFront;
+        }
+    }
+
+    // Forgets every bin entry (the inodes themselves are freed by the caller)
+    void clearBin() {
+        binFront += bin.getSize();
+        bin.clear();
+        binLive = 0;
+        binInodes = 0;
+        binByName.clear();
+        binByPath.clear();
+    }
+
+    // Returns the root if a directory is still reachable from it, otherwise the top of the
+    // removed subtree that holds the directory (a bin entry). Inodes inside a removed subtree keep
+    // their parent pointers, so each step checks that the parent still lists the inode.
+    const Inode* detachedRoot(const Inode* dir) const {
+        const Inode* node = dir;
+        while (node != rootInode && node->parent != nullptr) {
+            std::shared_lock<DirLock> guard(node->parent->lock);
+            if (node->parent->findChild(node->name) != node) {
+                break;
+            }
+            node = node->parent;
+        }
+        return node;
+    }
+
+    bool attached(const Inode* dir) const {
+        return detachedRoot(dir) == rootInode;
+    }
+
+    // Returns the sequence number of the live bin entry holding `node`
+    uint64_t binSequence(const Inode* node) {
+        uint64_t sequence = *binByName.find(node->name);
+        while (bin.at(sequence - binFront).node != node) {
+            sequence = bin.at(sequence - binFront).olderByName;
+        }
+        return sequence;
+    }
+
+    // Records a successful mutation in the journal, along with the directory it happened in
+    // Records re-applied during replay are not logged a second time. A failure is reported to
+    // the session whose command made the change.
+    void logMutation(Session& session, const Inode* dir, Journal::Op op, std::string_view name = {},
+                     std::string_view target = {}, uint64_t size = 0, int64_t time = 0) {
+        if (!journal.isOpen() || replaying) {
+            return;
+        }
+        std::string dirPath;
+        if (op != Journal::Op::Recover && op != Journal::Op::Emptybin) {
+            dirPath = constructPath(dir);
+        }
+        std::lock_guard<std::mutex> guard(journalLock);
+        if (!journal.append(op, dirPath, name, target, size, time)) {
+            session.out << "Error: Cannot write the journal; recent changes are not durable." << '\n';
+        }
+    }
+
+    // Adds (or, with add false, removes) an inode and everything below it to the name index,
+    // once the index is built. Directories not built from the image yet are built on the way.
+    // Runs under ExclusiveAccess (rm, recover and the first find), so no lock is needed.
+    void indexSubtree(Inode* top, bool add) {
+        if (!nameIndex.active()) {
+            return;
+        }
+        Stack<Inode*> pending;
+        pending.push(top);
+        while (!pending.isEmpty()) {
+            Inode* node = expand(pending.pop());
+            if (add) {
+                nameIndex.insert(node);
+            } else {
+                nameIndex.erase(node);
+            }
+            for (Inode* child : node->children()) {
+                pending.push(child);
+            }
+        }
+    }
+
+    // Indexes an inode that mkdir or touch just linked into the tree
+    void indexCreated(Inode* node) {
+        std::lock_guard<std::mutex> guard(indexLock);
+        if (nameIndex.active()) {
+            nameIndex.insert(node);
+        }
+    }
+
+    // Builds the name index over the whole tree (the root has no name and is left out)
+    // Runs under ExclusiveAccess
+    void buildNameIndex() {
+        nameIndex.clear();
+        nameIndex.activate();
+        for (Inode* child : expand(rootInode)->children()) {
+            indexSubtree(child, true);
+        }
+    }
+
+    // Collects the full path of every indexed inode whose name matches the pattern
+    // The paths are written back to back into one buffer, `ends` holding where each one stops,
+    // so a million matches cost a few buffer growths rather than a million strings.
+    // The caller holds the index lock or runs alone; no command that runs alongside find can
+    // rename or move an inode.
+    void collectMatches(const std::string& pattern, std::string& text, Vector<size_t>& ends) {
+        nameIndex.find(pattern, [&](const Inode* node) {
+            node->appendPath(text);
+            ends.push_back(text.size());
+        });
+    }
+
+    // Tree-wide gauges reported by stats
+    struct TreeGauges {
+        size_t directories = 0;     // Directories in the tree, the root included
+        size_t maxDepth = 0;        // Depth of the deepest inode (children of the root are at depth 1)
+        size_t maxFanout = 0;       // Most entries in a single directory
+    };
+
+    // Walks the tree for the gauges. Directories that are still in the image are walked through
+    // their records (checked the same way expand checks them), so nothing is built.
+    // Runs under ExclusiveAccess
+    TreeGauges treeGauges() const {
+        struct Pending {
+            const Inode* node;          // Inode to visit, or nullptr for an image record
+            const ImageInode* record;   // Image record of a directory or file not built yet
+            size_t depth;
+        };
+        TreeGauges gauges;
+        Stack<Pending> pending;
+        pending.push({rootInode, nullptr, 0});
+        while (!pending.isEmpty()) {
+            Pending item = pending.pop();
+            gauges.maxDepth = std::max(gauges.maxDepth, item.depth);
+            const ImageInode* record = item.record;
+            if (item.node != nullptr) {
+                if (item.node->type != Inode::Type::Directory) {
+                    continue;
+                }
+                ++gauges.directories;
+                record = item.node->dirData->pendingChildren.load(std::memory_order_acquire);
+                if (record == nullptr) {
+                    gauges.maxFanout = std::max(gauges.maxFanout, item.node->children().size());
+                    for (const Inode* child : item.node->children()) {
+                        pending.push({child, nullptr, item.depth + 1});
+                    }
+                    continue;
+                }
+            } else if (record->type != 1) {
+                continue;
+            } else {
+                ++gauges.directories;
+            }
+            size_t index = record - imageRecords;
+            if (record->firstChild <= index || record->firstChild + static_cast<uint64_t>(record->childCount) > imageInodes) {
+                continue; // Corrupt; expand would leave the directory empty
+            }
+            gauges.maxFanout = std::max<size_t>(gauges.maxFanout, record->childCount);
+            for (size_t k = record->firstChild; k < record->firstChild + record->childCount; ++k) {
+                if (validRecord(imageRecords[k])) {
+                    pending.push({nullptr, &imageRecords[k], item.depth + 1});
+                }
+            }
+        }
+        return gauges;
+    }
+
+    // Re-applies one journal record in the directory it was recorded in
+    // Returns false if that directory does not exist
+    bool replayRecord(Session& replay, const Journal::Record& record) {
+        Inode* dir = rootInode;
+        if (!record.dir.empty() && !(dir = resolvePath(&replay.pathCache, rootInode, record.dir))) {
+            return false;
+        }
+        replay.currentInode = dir;
+        switch (record.op) {
+            case Journal::Op::Mkdir:    createDirectory(replay, std::string(record.name), record.time); break;
+            case Journal::Op::Touch:    createFile(replay, std::string(record.name), record.size, record.time); break;
+            case Journal::Op::Rm:       rm(replay, std::string(record.name)); break;
+            case Journal::Op::Mv:       mv(replay, std::string(record.name), std::string(record.target)); break;
+            case Journal::Op::Recover:  recover(replay, std::string(record.name)); break;
+            case Journal::Op::Emptybin: emptybin(replay); break;
+            case Journal::Op::Write:    writeFile(replay, std::string(record.name), record.size, record.target, record.time); break;
+        }
+        return true;
+    }
+
+    // Creates a directory with the given creation time in the session's directory (mkdir and replay)
+    // Runs alongside other sessions: the directory is write-locked while the entry is added and
+    // logged, then the totals are carried up to the root one lock at a time
+    // Returns false if the directory could not be created
+    bool createDirectory(Session& session, const std::string& folderName, int64_t time) {
+        Inode* dir = expand(session.currentInode);
+        preservePath(dir);
+        std::unique_lock<DirLock> guard(dir->lock);
+
+        // Check the child index for an existing entry with the same name
+        // Names are unique within a directory, so a file with that name also blocks the directory
+        if (Inode* existing = dir->findChild(folderName)) {
+            if (existing->type == Inode::Type::Directory) {
+                session.out << "Error: Directory '" << folderName << "' already exists." << '\n';
+            } else {
+                session.out << "Error: A file with the name '" << folderName << "' already exists." << '\n';
+            }
+            return false;
+        }
+
+        // If the current inode is not a directory, print an error message and return
+        if (dir->type != Inode::Type::Directory) {
+            session.out << "Error: Cannot create directory here. Current location is not a directory." << '\n';
+            return false;
+        }
+
+        // Create a new directory inode with the given name and a default size of 10
+        const size_t size = 10; // Default size for a directory is 10
+        Inode* newDir;
+        {
+            std::lock_guard<std::mutex> poolGuard(poolLock);
+            newDir = inodePool.create(folderName, Inode::Type::Directory, size, time);
+        }
+        // No snapshot so far has seen the directory, so none needs its current state kept
+        newDir->savedEpoch.store(newestEpoch, std::memory_order_relaxed);
+        // Add the new directory to the children of the current inode
+        dir->linkChild(newDir);
+        // Logged under the lock, so records for one directory are journaled in the order they applied
+        logMutation(session, dir, Journal::Op::Mkdir, folderName, {}, 0, time);
+        guard.unlock();
+        adjustTotals(dir, size, 1, true);
+        indexCreated(newDir);
+        return true;
+    }
+
+    // Creates a file with the given creation time in the session's directory (touch and replay)
+    // Locks the same way as createDirectory; returns false if the file could not be created
+    bool createFile(Session& session, const std::string& filename, size_t size, int64_t time) {
+        Inode* dir = expand(session.currentInode);
+        preservePath(dir);
+        std::unique_lock<DirLock> guard(dir->lock);
+
+        // Check the child index for a file or directory with the same name
+        if (dir->findChild(filename)) {
+            // If a file or directory with the same name exists, print an error message and return
+            session.out << "Error: A file or directory with the name '" << filename << "' already exists." << '\n';
+            return false;
+        }
+
+        // If the current inode is not a directory, print an error message and return
+        if (dir->type != Inode::Type::Directory) {
+            session.out << "Error: Current inode is not a directory. Cannot create file here." << '\n';
+            return false;
+        }
+
+        // Create a new file inode with the given name, size and creation time
+        Inode* newFile;
+        {
+            std::lock_guard<std::mutex> poolGuard(poolLock);
+            newFile = inodePool.create(filename, Inode::Type::File, size, time);
+        }
+        // No snapshot has seen the file, so a write to it can change it in place
+        newFile->savedEpoch.store(newestEpoch, std::memory_order_relaxed);
+        // Add the new file to the children of the current inode
+        dir->linkChild(newFile);
+        logMutation(session, dir, Journal::Op::Touch, filename, {}, size, time);
+        guard.unlock();
+        adjustTotals(dir, size, 1, true);
+        indexCreated(newFile);
+        return true;
+    }
+
+    // Writes bytes into a file of the session's directory at an offset, stamping it with the given
+    // modification time (write and replay). A file that grows carries the growth up the totals
+    // like any other size change. Runs alone (under ExclusiveAccess, or during replay), so the
+    // totals are updated without locks. Returns false if the bytes could not all be written
+    bool writeFile(Session& session, const std::string& filename, size_t offset, std::string_view data, int64_t time) {
+        Inode* dir = expand(session.currentInode);
+        Inode* file = dir->findChild(filename);
+        if (file == nullptr) {
+            session.out << "Error: File '" << filename << "' not found." << '\n';
+            return false;
+        }
+        if (file->type != Inode::Type::File) {
+            session.out << "Error: '" << filename << "' is a directory." << '\n';
+            return false;
+        }
+        if (offset > FileData::MAX_SIZE || data.size() > FileData::MAX_SIZE - offset) {
+            session.out << "Error: Files cannot grow past " << FileData::MAX_SIZE << " bytes." << '\n';
+            return false;
+        }
+
+        preservePath(dir);
+        if (file->savedEpoch.load(std::memory_order_relaxed) < newestEpoch) {
+            file = replaceForSnapshots(dir, file);
+        }
+        if (file->fileData == nullptr) {
+            file->fileData = new FileData(blocks);
+        }
+        size_t written = file->fileData->write(offset, data);
+        if (offset + written > file->size) {
+            size_t growth = offset + written - file->size;
+            file->size += growth;
+            file->totalSize += growth;
+            dir->dirData->sizeOrder.update(file);
+            dir->growTotals(growth, 0);
+        }
+        file->mtime = time;
+        for (size_t logged = 0; logged < written; logged += Journal::MAX_WRITE_DATA) {
+            size_t chunk = std::min(written - logged, Journal::MAX_WRITE_DATA);
+            logMutation(session, dir, Journal::Op::Write, filename, data.substr(logged, chunk), offset + logged, time);
+        }
+        if (written < data.size()) {
+            session.out << "Error: Out of block storage; wrote " << written << " of " << data.size() << " bytes to '"
+                        << filename << "'." << '\n';
+            return false;
+        }
+        session.out << "Wrote " << written << " bytes to '" << filename << "'." << '\n';
+        return true;
+    }
+
+    // Puts a copy of a file in its place, before a write to a file that snapshots can see. The
+    // copy shares every block with the original (a block is copied when the copy first writes
+    // it), and the original stays unchanged for the snapshots' versions of the directory, which
+    // list it, until the last snapshot is deleted. Runs under ExclusiveAccess.
+    Inode* replaceForSnapshots(Inode* dir, Inode* file) {
+        Inode* copy;
+        {
+            std::lock_guard<std::mutex> poolGuard(poolLock);
+            copy = inodePool.create(file->name, Inode::Type::File, file->size, file->ctime);
+        }
+        copy->mtime = file->mtime;
+        copy->savedEpoch.store(newestEpoch, std::memory_order_relaxed);
+        if (file->fileData != nullptr) {
+            copy->fileData = file->fileData->share();
+        }
+        indexSubtree(file, false);
+        dir->removeChild(file);
+        dir->addChild(copy);
+        indexSubtree(copy, true);
+        retained.push_back(file);
+        ++retainedInodes;
+        return copy;
+    }
+
+    // This helper function navigates to a specified path and returns the inode at that path
+    Inode* navigateToPath(Session& session, const std::string& path) {
+        // If the path is empty or root, return the rootInode
+        if (path.empty() || path == "/") {
+            return rootInode;
+        }
+        return resolvePath(&session.pathCache, session.currentInode, path);
+    }
+
+    // The state of a directory that snapshot `epoch` saw: the oldest version kept for that snapshot
+    // or a later one, or nullptr if the directory has not changed since (the live state is then
+    // that state). The caller holds the directory's lock.
+    static const DirVersion* versionAt(const Inode* dir, uint32_t epoch) {
+        const DirVersion* seen = nullptr;
+        for (const DirVersion* version = dir->dirData->versions; version != nullptr && version->epoch >= epoch;
+             version = version->older) {
+            seen = version;
+        }
+        return seen;
+    }
+
+    // Keeps the directory's children and totals for the snapshots taken since it last changed.
+    // Called before anything changes them; once done in an epoch it is a single atomic load.
+    // The version is made under the directory's write lock, and whoever changes the directory
+    // preserves it first, so the state kept is the one the snapshots saw
+    void preserve(Inode* dir) {
+        DirData& data = *dir->dirData;
+        if (dir->savedEpoch.load(std::memory_order_acquire) >= newestEpoch) {
+            return;
+        }
+        expand(dir);
+        std::lock_guard<DirLock> guard(dir->lock);
+        if (dir->savedEpoch.load(std::memory_order_relaxed) >= newestEpoch) {
+            return;
+        }
+        DirVersion* version = new DirVersion;
+        version->epoch = newestEpoch;
+        version->totalSize = dir->totalSize;
+        version->totalInodes = dir->totalInodes;
+        version->children.reserve(dir->children().size());
+        for (Inode* child : dir->children()) {
+            version->children.push_back(child);
+        }
+        version->older = data.versions;
+        bool first = data.versions == nullptr;
+        data.versions = version;
+        dir->savedEpoch.store(newestEpoch, std::memory_order_release);
+
+        std::lock_guard<std::mutex> counters(versionLock);
+        if (first) {
+            versionedDirs.push_back(dir);
+        }
+        ++versionCount;
+        versionChildren += version->children.size();
+    }
+
+    // Preserves a directory and every ancestor: the path a change in the directory carries its
+    // totals up, and the only directories the change touches. Free while there are no snapshots.
+    void preservePath(Inode* dir) {
+        if (newestEpoch == 0) {
+            return;
+        }
+        for (Inode* node = dir; node != nullptr; node = node->parent) {
+            preserve(node);
+        }
+    }
+
+    // Copies the children of a directory as snapshot `epoch` saw them
+    void snapshotChildren(Inode* dir, uint32_t epoch, Vector<Inode*>& children) {
+        expand(dir);
+        std::shared_lock<DirLock> guard(dir->lock);
+        if (const DirVersion* version = versionAt(dir, epoch)) {
+            children.reserve(version->children.size());
+            for (Inode* child : version->children) {
+                children.push_back(child);
+            }
+        } else {
+            children.reserve(dir->children().size());
+            for (Inode* child : dir->children()) {
+                children.push_back(child);
+            }
+        }
+    }
+
+    // Total bytes (and, through `inodes`, the inode count) of an inode as snapshot `epoch` saw them
+    // Files a snapshot has seen never change, so only a directory can have a kept state
+    size_t snapshotTotal(const Inode* node, uint32_t epoch, size_t* inodes = nullptr) const {
+        if (node->type != Inode::Type::Directory) {
+            if (inodes != nullptr) {
+                *inodes = 1;
+            }
+            return node->totalSize;
+        }
+        std::shared_lock<DirLock> guard(node->lock);
+        const DirVersion* version = versionAt(node, epoch);
+        if (inodes != nullptr) {
+            *inodes = version != nullptr ? version->totalInodes : node->totalInodes;
+        }
+        return version != nullptr ? version->totalSize : node->totalSize;
+    }
+
+    // Recomputes the totals of a subtree as a snapshot saw it and compares them with the kept ones
+    bool verifySnapshotTotals(Inode* node, uint32_t epoch, size_t& bytes, size_t& inodes) {
+        bool ok = true;
+        bytes = node->size;
+        inodes = 1;
+        if (node->type == Inode::Type::Directory) {
+            Vector<Inode*> children;
+            snapshotChildren(node, epoch, children);
+            for (Inode* child : children) {
+                size_t childBytes, childInodes;
+                ok = verifySnapshotTotals(child, epoch, childBytes, childInodes) && ok;
+                bytes += childBytes;
+                inodes += childInodes;
+            }
+        }
+        size_t keptInodes;
+        size_t keptBytes = snapshotTotal(node, epoch, &keptInodes);
+        if (bytes != keptBytes || inodes != keptInodes) {
+            out << "Snapshot " << epoch << " totals mismatch at '" << node->getFullPath() << "': kept "
+                << keptBytes << " bytes/" << keptInodes << " inodes, recomputed " << bytes << " bytes/" << inodes
+                << " inodes" << '\n';
+            ok = false;
+        }
+        return ok;
+    }
+
+    // Frees every kept directory version, and the inodes emptied from the bin (or files replaced
+    // by writes) while snapshots could still see them. Runs under ExclusiveAccess, once the last snapshot is deleted.
+    void releaseVersions() {
+        for (Inode* dir : versionedDirs) {
+            dir->dirData->dropVersions();
+        }
+        versionedDirs.clear();
+        versionedDirs.shrink_to_fit();
+        versionCount = 0;
+        versionChildren = 0;
+        for (Inode* node : retained) {
+            inodePool.destroySubtree(node);
+        }
+        retained.clear();
+        retained.shrink_to_fit();
+        retainedInodes = 0;
+        ++treeGeneration;
+    }
+
+    // Reports a command that needs the live tree while the session is viewing a snapshot
+    bool viewingSnapshot(Session& session, const char* command) {
+        if (session.view == nullptr) {
+            return false;
+        }
+        session.out << "Error: '" << command << "' is not available while viewing snapshot '"
+                    << session.view->name << "'." << '\n';
+        return true;
+    }
+
+    // Prints one ls line: type, name, total size and modification time
+    void printEntry(Session& session, const Inode* child, size_t total) {
+        // Determine the type of the child (directory or file)
+        const char* fileType = (child->type == Inode::Type::Directory) ? "dir" : "file";
+        // Print the child's details
+        session.out << fileType << "\t" << child->name << "\t" << total << "\t";
+        // Timestamps are formatted here, once per distinct second
+        if (child->mtime != 0) {
+            session.out << session.timeFormatter.format(child->mtime);
+        }
+        session.out << '\n';
+    }
+
+    // ls in the snapshot the session is viewing. The directory's size order follows the live
+    // tree, so the snapshot's children are sorted here, in the same order.
+    void listSnapshot(Session& session, size_t limit) {
+        uint32_t epoch = session.view->epoch;
+        Vector<Inode*> children;
+        snapshotChildren(session.currentInode, epoch, children);
+        if (children.empty()) {
+            session.out << "Directory is empty" << '\n';
+            return;
+        }
+        struct Entry {
+            const Inode* node;
+            size_t total;
+        };
+        Vector<Entry> entries(children.size());
+        for (Inode* child : children) {
+            entries.push_back({child, snapshotTotal(child, epoch)});
+        }
+        size_t count = std::min(limit, entries.size());
+        std::partial_sort(entries.begin(), entries.begin() + count, entries.end(), [](const Entry& a, const Entry& b) {
+            return a.total != b.total ? a.total > b.total : a.node->name < b.node->name;
+        });
+        for (size_t i = 0; i < count; ++i) {
+            printEntry(session, entries[i].node, entries[i].total);
+        }
+    }
+
+    // find in the snapshot the session is viewing. The name index only covers the live tree, so
+    // the snapshot is walked, each path built on the way down (a file moved since keeps its old one)
+    void findInSnapshot(Session& session, const std::string& pattern, std::string& text, Vector<size_t>& ends) {
+        uint32_t epoch = session.view->epoch;
+        Vector<std::pair<Inode*, std::string>> pending;  // Directories to walk, with their paths
+        pending.push_back({rootInode, std::string()});
+        Vector<Inode*> children;
+        while (!pending.empty()) {
+            std::pair<Inode*, std::string> dir = std::move(pending[pending.size() - 1]);
+            pending.pop_back();
+            children.clear();
+            snapshotChildren(dir.first, epoch, children);
+            for (Inode* child : children) {
+                std::string path = dir.second + '/' + child->name;
+                if (NameIndex::globMatch(pattern, child->name)) {
+                    text += path;
+                    ends.push_back(text.size());
+                }
+                if (child->type == Inode::Type::Directory) {
+                    pending.push_back({child, std::move(path)});
+                }
+            }
+        }
+    }
+
+public:
+    // Returns the current time in seconds since the epoch (shared with the compact engine)
+    // Timestamps stay binary; they are only formatted when ls prints them
+    static int64_t currentTime() {
+        return static_cast<int64_t>(std::time(nullptr));
+    }
+
+    // Returns local midnight of the given date in seconds since the epoch
+    static int64_t localDate(int year, int month, int day) {
+        std::tm date = {};
+        date.tm_year = year - 1900;
+        date.tm_mon = month - 1;
+        date.tm_mday = day;
+        date.tm_isdst = -1;
+        return static_cast<int64_t>(std::mktime(&date));
+    }
+
+    // Constructor
+    explicit FileSystem(std::ostream& output = std::cout): out(output) {
+        // Initialize the root inode as the starting point
+        rootInode = inodePool.create("/", Inode::Type::Directory);
+
+        // Create test inodes (as children of the root) for the ls Method
+        Inode* file1 = inodePool.create("file1.txt", Inode::Type::File, 200, localDate(2023, 3, 1));
+        Inode* file2 = inodePool.create("file2.txt", Inode::Type::File, 200, localDate(2023, 3, 2));
+        Inode* dir1 = inodePool.create("dir1", Inode::Type::Directory);
+
+        rootInode->addChild(file1);
+        rootInode->addChild(file2);
+        rootInode->addChild(dir1);
+    }
+
+    // Destructor (every Session on the tree is gone by now)
+    ~FileSystem() {
+        // Release every inode (tree and bin) slab by slab, no recursive deletes
+        // Whatever the reclaimer has not freed yet is still in the pool and goes with it
+        reclaimer.stop();
+        for (Snapshot* snapshot : snapshots) {
+            delete snapshot;
+        }
+        if (fastExit) {
+            inodePool.abandon();
+        } else {
+            inodePool.releaseAll();
+        }
+        releaseImage();
+        // The journal commits its pending group when it is destroyed, in either case
+    }
+
+    // Lets the destructor skip destroying the inodes one by one, when the process exits right
+    // after it. Saves seconds on trees of millions of inodes; leak checkers will report the slabs
+    void setFastExit(bool enabled) {
+        fastExit = enabled;
+    }
+
+    // Keeps the contents of files in a memory-mapped backing file instead of anonymous memory
+    // (--blocks), so they can page out to it; has to come before anything is written or loaded
+    bool openBlockFile(Session& session, const std::string& path) {
+        if (!blocks.openBacking(path)) {
+            session.out << "Error: Cannot open block file '" << path << "'." << '\n';
+            return false;
+        }
+        return true;
+    }
+
+    // Public interface to calculate the size of the current directory
+    // Method to get the size of a specific folder or file by name
+    size_t size(Session& session, const std::string& name) {
+        CommandTimer timer(session, Command::Size);
+        std::lock_guard<std::mutex> access(session.gate);
+        // Check if the name matches any child of the current inode
+        // The child's total is guarded by the directory's lock, so it is read under it
+        Inode* dir = expand(session.currentInode);
+        Inode* child;
+        size_t total = 0;
+        if (session.view != nullptr) {
+            // In a snapshot, both the child and its total are the ones the snapshot saw
+            child = lookup(dir, name, session.view->epoch);
+            if (child) {
+                return snapshotTotal(child, session.view->epoch);
+            }
+        } else {
+            std::shared_lock<DirLock> guard(dir->lock);
+            child = dir->findChild(name);
+            if (child) {
+                total = child->totalSize;
+            }
+        }
+        if (child) {
+#ifdef VFS_DEBUG
+            // Debug builds cross-check the maintained totals against a full recomputation
+            size_t bytes, inodes;
+            verifyTotals(child, bytes, inodes);
+#endif
+            // Found the child, return its aggregate size (maintained on every change)
+            return total;
+        }
+
+        // If the name doesn't match any child, handle as an error or return 0
+        session.out << "Error: No file or folder named '" << name << "' found." << '\n';
+        timer.fail();
+        return 0;
+    }
+
+    // Recomputes every total in the tree and compares it with the maintained values
+    bool verify() {
+        ExclusiveAccess access(*this);
+        size_t bytes, inodes;
+        bool ok = verifyTotals(rootInode, bytes, inodes);
+        // The name index, once built, holds every inode in the tree except the root
+        if (nameIndex.active() && nameIndex.size() != rootInode->totalInodes - 1) {
+            out << "Name index mismatch: " << nameIndex.size() << " inodes indexed, "
+                << rootInode->totalInodes - 1 << " in the tree" << '\n';
+            ok = false;
+        }
+        // Every snapshot's kept totals must add up over the children it kept
+        for (Snapshot* snapshot : snapshots) {
+            ok = verifySnapshotTotals(rootInode, snapshot->epoch, bytes, inodes) && ok;
+        }
+        return ok;
+    }
+
+    // find method - prints the full path of every inode in the tree whose name matches the
+    // pattern ('*' and '?' are wildcards, anything else must match exactly), and returns the count
+    // The name index is built by the first find, which runs alone; later finds run alongside
+    // other sessions. In a snapshot the tree is walked instead.
+    size_t find(Session& session, const std::string& pattern) {
+        CommandTimer timer(session, Command::Find);
+        std::string text;
+        Vector<size_t> ends;
+        bool found = false;
+        {
+            std::lock_guard<std::mutex> access(session.gate);
+            if (session.view != nullptr) {
+                findInSnapshot(session, pattern, text, ends);
+                found = true;
+            } else {
+                std::lock_guard<std::mutex> guard(indexLock);
+                if (nameIndex.active()) {
+                    collectMatches(pattern, text, ends);
+                    found = true;
+                }
+            }
+        }
+        if (!found) {
+            ExclusiveAccess access(*this);
+            if (!nameIndex.active()) {
+                buildNameIndex();
+            }
+            collectMatches(pattern, text, ends);
+        }
+
+        // Sorted so the listing does not depend on the order the index happens to hold
+        // Only views into the buffer are sorted; the paths themselves are never copied
+        Vector<std::string_view> paths(ends.size());
+        size_t start = 0;
+        for (size_t end : ends) {
+            paths.push_back(std::string_view(text.data() + start, end - start));
+            start = end;
+        }
+        std::sort(paths.begin(), paths.end());
+        for (std::string_view path : paths) {
+            session.out << path << '\n';
+        }
+        if (paths.empty()) {
+            session.out << "No matches for '" << pattern << "'." << '\n';
+        }
+        return paths.size();
+    }
+
+    // du method - recounts the size of every directory under a path (default: the current one)
+    // Prints each directory's recounted bytes, children before their parent, then the total, and
+    // reports every maintained total that disagrees with the recount. Directories are tasks on
+    // per-thread work-stealing deques, so the walk is iterative and spreads over `threads` threads.
+    // Runs alone, so the recount and the maintained totals describe the same tree.
+    void du(Session& session, const std::string& path = "", size_t threads = 1) {
+        CommandTimer timer(session, Command::Du);
+        ExclusiveAccess access(*this);
+        // du checks the maintained totals, which only the live tree has
+        if (viewingSnapshot(session, "du")) {
+            timer.fail();
+            return;
+        }
+        std::string_view missing;
+        Inode* start = path.empty() ? session.currentInode
+                                    : resolvePath(&session.pathCache, session.currentInode, path, &missing);
+        if (!start) {
+            session.out << "Directory not found: " << missing << '\n';
+            timer.fail();
+            return;
+        }
+        const size_t MAX_THREADS = 256;
+        threads = std::min(std::max<size_t>(threads, 1), MAX_THREADS);
+
+        struct Mismatch {
+            const Inode* node;
+            size_t bytes;
+            size_t inodes;
+        };
+        Vector<Mismatch> mismatches;
+        std::mutex mismatchLock;
+        auto report = [&](const Inode* node, size_t bytes, size_t inodes) {
+            std::lock_guard<std::mutex> guard(mismatchLock);
+            mismatches.push_back({node, bytes, inodes});
+        };
+
+        DuRecord root;
+        root.dir = start;
+        WorkDeque<DuRecord>* deques = new WorkDeque<DuRecord>[threads];
+        Vector<DuRecord*>* blocks = new Vector<DuRecord*>[threads]; // Record arrays made by each worker
+        std::atomic<size_t> outstanding{1};                         // Directories queued, not yet scanned
+        deques[0].push(&root);
+
+        // Scans one directory: counts its files, queues its subdirectories, and completes every
+        // record whose last outstanding part this was, adding it to its parent on the way up
+        auto scan = [&](DuRecord* record, size_t id) {
+            Inode* dir = expand(record->dir);
+            size_t bytes = dir->size;
+            size_t inodes = 1;
+            size_t subdirCount = 0;
+            for (Inode* child : dir->children()) {
+                if (child->type == Inode::Type::Directory) {
+                    ++subdirCount;
+                } else {
+                    bytes += child->size;
+                    ++inodes;
+                    if (child->totalSize != child->size || child->totalInodes != 1) {
+                        report(child, child->size, 1);
+                    }
+                }
+            }
+            record->bytes.store(bytes, std::memory_order_relaxed);
+            record->inodes.store(inodes, std::memory_order_relaxed);
+            record->pending.store(subdirCount + 1, std::memory_order_relaxed);
+
+            if (subdirCount > 0) {
+                DuRecord* subdirs = new DuRecord[subdirCount];
+                blocks[id].push_back(subdirs);
+                record->subdirs = subdirs;
+                record->subdirCount = subdirCount;
+                size_t k = 0;
+                for (Inode* child : dir->children()) {
+                    if (child->type == Inode::Type::Directory) {
+                        subdirs[k].dir = child;
+                        subdirs[k].parent = record;
+                        ++k;
+                    }
+                }
+                outstanding.fetch_add(subdirCount);
+                for (size_t i = subdirCount; i-- > 0;) {
+                    deques[id].push(&subdirs[i]);
+                }
+            }
+
+            for (DuRecord* node = record; node != nullptr &&
+                 node->pending.fetch_sub(1, std::memory_order_acq_rel) == 1; node = node->parent) {
+                size_t nodeBytes = node->bytes.load(std::memory_order_relaxed);
+                size_t nodeInodes = node->inodes.load(std::memory_order_relaxed);
+                if (nodeBytes != node->dir->totalSize || nodeInodes != node->dir->totalInodes) {
+                    report(node->dir, nodeBytes, nodeInodes);
+                }
+                if (node->parent != nullptr) {
+                    node->parent->bytes.fetch_add(nodeBytes, std::memory_order_relaxed);
+                    node->parent->inodes.fetch_add(nodeInodes, std::memory_order_relaxed);
+                }
+            }
+        };
+
+        // Each worker drains its own deque, then steals from the others until every queued
+        // directory has been scanned
+        auto work = [&](size_t id) {
+            while (outstanding.load() > 0) {
+                DuRecord* task = deques[id].pop();
+                for (size_t i = 1; task == nullptr && i < threads; ++i) {
+                    task = deques[(id + i) % threads].steal();
+                }
+                if (task == nullptr) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                scan(task, id);
+                outstanding.fetch_sub(1);
+            }
+        };
+        Vector<std::thread> workers;
+        for (size_t id = 1; id < threads; ++id) {
+            workers.emplace_back(work, id);
+        }
+        work(0);
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+
+        // Report in one iterative post-order pass over the records, building paths as it goes
+        size_t directories = 0;
+        std::string dirPath = constructPath(start);
+        Vector<std::pair<DuRecord*, size_t>> stack;  // (record, next subdirectory to visit)
+        Vector<size_t> pathLengths;
+        stack.push_back({&root, 0});
+        while (!stack.empty()) {
+            std::pair<DuRecord*, size_t>& top = stack[stack.size() - 1];
+            if (top.second < top.first->subdirCount) {
+                DuRecord* next = &top.first->subdirs[top.second++];
+                pathLengths.push_back(dirPath.size());
+                if (dirPath != "/") {
+                    dirPath += '/';
+                }
+                dirPath += next->dir->name;
+                stack.push_back({next, 0});
+                continue;
+            }
+            session.out << top.first->bytes.load() << '\t' << dirPath << '\n';
+            ++directories;
+            stack.pop_back();
+            if (!pathLengths.empty()) {
+                dirPath.resize(pathLengths[pathLengths.size() - 1]);
+                pathLengths.pop_back();
+            }
+        }
+        session.out << "Total: " << root.bytes.load() << " bytes in " << root.inodes.load() << " inodes, "
+                    << directories << " directories" << '\n';
+        for (const Mismatch& mismatch : mismatches) {
+            session.out << "Totals mismatch at '" << constructPath(mismatch.node) << "': maintained "
+                        << mismatch.node->totalSize << " bytes/" << mismatch.node->totalInodes << " inodes, recounted "
+                        << mismatch.bytes << " bytes/" << mismatch.inodes << " inodes" << '\n';
+        }
+
+        for (size_t id = 0; id < threads; ++id) {
+            for (DuRecord* block : blocks[id]) {
+                delete[] block;
+            }
+        }
+        delete[] blocks;
+        delete[] deques;
+    }
+
+    // stats method - prints the tree gauges, the allocator, cache, bin, reclaimer and journal
+    // counters, and the calls, errors and latency percentiles of every command run so far (by
+    // any session, including ones that have left). With json the same is printed as one JSON
+    // object, for monitoring.
+    void stats(Session& session, bool json = false) {
+        ExclusiveAccess access(*this);
+        TreeGauges gauges = treeGauges();
+#ifndef VFS_NO_STATS
+        CommandStats commands;
+        commands.merge(retiredStats);
+        for (Session* other = sessions; other != nullptr; other = other->nextSession) {
+            commands.merge(other->commandStats);
+        }
+#endif
+        std::ostream& out = session.out;
+        std::ios::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        double busy = reclaimer.busySeconds();
+        size_t throughput = static_cast<size_t>(busy > 0 ? reclaimer.freed() / busy : 0.0);
+
+        if (json) {
+            out << "{\"tree\":{\"inodes\":" << rootInode->totalInodes << ",\"directories\":" << gauges.directories
+                << ",\"max_depth\":" << gauges.maxDepth << ",\"max_fanout\":" << gauges.maxFanout << "}";
+            out << ",\"bin\":{\"entries\":" << binLive << ",\"inodes\":" << binInodes
+                << ",\"tombstones\":" << bin.getSize() - binLive << "}";
+            out << ",\"snapshots\":{\"count\":" << snapshots.size() << ",\"versions\":" << versionCount
+                << ",\"version_children\":" << versionChildren << ",\"retained_inodes\":" << retainedInodes << "}";
+            out << ",\"blocks\":{\"block_bytes\":" << BlockStore::BLOCK_SIZE << ",\"used\":" << blocks.usedCount()
+                << ",\"stored_bytes\":" << blocks.usedCount() * BlockStore::BLOCK_SIZE
+                << ",\"mapped\":" << blocks.blockCount() << ",\"cow_copies\":" << blocks.copyCount() << "}";
+            out << ",\"allocator\":{\"live_inodes\":" << inodePool.liveCount() << ",\"slabs\":" << inodePool.slabCount()
+                << ",\"slab_bytes\":" << inodePool.slabBytes()
+                << ",\"free_slots\":" << inodePool.slotCount() - inodePool.liveCount()
+                << ",\"fragmentation_pct\":" << std::fixed << std::setprecision(1) << inodePool.fragmentation()
+                << ",\"allocations\":" << inodePool.allocationCount() << ",\"frees\":" << inodePool.freeCount() << "}";
+            out << ",\"path_cache\":{\"hits\":" << session.pathCache.hitCount()
+                << ",\"misses\":" << session.pathCache.missCount() << "}";
+            out << ",\"reclaimer\":{\"backlog_inodes\":" << reclaimer.backlog() << ",\"freed_inodes\":" << reclaimer.freed()
+                << ",\"batches\":" << reclaimer.batches() << ",\"inodes_per_second\":" << throughput << "}";
+            out << ",\"journal\":";
+            if (journal.isOpen()) {
+                out << "{\"records\":" << journal.records() << ",\"group_commits\":" << journal.commits()
+                    << ",\"failed_commits\":" << journal.failed() << ",\"bytes\":" << journal.bytes()
+                    << ",\"pending\":" << journal.pendingCount() << "}";
+            } else {
+                out << "null";
+            }
+            out << ",\"commands\":";
+#ifndef VFS_NO_STATS
+            // Every command is listed, so the keys do not depend on what has run; the buckets are
+            // the non-empty histogram buckets as [largest nanoseconds, count] pairs
+            out << "{";
+            for (size_t i = 0; i < static_cast<size_t>(Command::Count); ++i) {
+                const CommandStats::Counters& counter = commands[static_cast<Command>(i)];
+                const LatencyHistogram& latency = counter.latency;
+                out << (i > 0 ? "," : "") << "\"" << COMMAND_NAMES[i] << "\":{\"calls\":" << latency.count()
+                    << ",\"errors\":" << counter.errors.load(std::memory_order_relaxed)
+                    << ",\"mean_ns\":" << latency.mean() << ",\"p50_ns\":" << latency.percentile(0.5)
+                    << ",\"p90_ns\":" << latency.percentile(0.9) << ",\"p99_ns\":" << latency.percentile(0.99)
+                    << ",\"p999_ns\":" << latency.percentile(0.999) << ",\"max_ns\":" << latency.max() << ",\"buckets\":[";
+                bool first = true;
+                latency.forBuckets([&](uint64_t limit, uint64_t count) {
+                    out << (first ? "" : ",") << "[" << limit << "," << count << "]";
+                    first = false;
+                });
+                out << "]}";
+            }
+            out << "}";
+#else
+            out << "null";
+#endif
+            out << "}" << '\n';
+            out.flags(flags);
+            out.precision(precision);
+            return;
+        }
+
+        out << "Tree:\n";
+        out << "  inodes:        " << rootInode->totalInodes << "\n";
+        out << "  directories:   " << gauges.directories << "\n";
+        out << "  max depth:     " << gauges.maxDepth << "\n";
+        out << "  max fan-out:   " << gauges.maxFanout << "\n";
+        out << "Inode allocator:\n";
+        out << "  live inodes:   " << inodePool.liveCount() << "\n";
+        out << "  slabs:         " << inodePool.slabCount() << " (" << inodePool.slabBytes() / 1024 << " KiB)\n";
+        out << "  free slots:    " << inodePool.slotCount() - inodePool.liveCount() << "\n";
+        out << "  fragmentation: " << std::fixed << std::setprecision(1) << inodePool.fragmentation() << "%\n";
+        out << "  allocations:   " << inodePool.allocationCount() << "\n";
+        out << "  frees:         " << inodePool.freeCount() << "\n";
+        out << "Path cache:\n";
+        out << "  hits:          " << session.pathCache.hitCount() << "\n";
+        out << "  misses:        " << session.pathCache.missCount() << '\n';
+        out << "Bin:\n";
+        out << "  entries:       " << binLive << "\n";
+        out << "  inodes:        " << binInodes << "\n";
+        out << "  tombstones:    " << bin.getSize() - binLive << '\n';
+        out << "Snapshots:\n";
+        out << "  snapshots:     " << snapshots.size() << "\n";
+        out << "  versions:      " << versionCount << " (" << versionChildren << " child entries)\n";
+        out << "  retained:      " << retainedInodes << " inodes" << '\n';
+        out << "Block store:\n";
+        out << "  blocks:        " << blocks.usedCount() << " used of " << blocks.blockCount() << " mapped ("
+            << BlockStore::BLOCK_SIZE << " bytes each)\n";
+        // Sizes and totals count logical lengths; this is what the contents actually occupy
+        out << "  stored:        " << blocks.usedCount() * BlockStore::BLOCK_SIZE << " bytes\n";
+        out << "  cow copies:    " << blocks.copyCount() << "\n";
+        out << "  backing:       " << (blocks.backing().empty() ? "anonymous memory" : blocks.backing()) << '\n';
+        out << "Reclaimer:\n";
+        out << "  backlog:       " << reclaimer.backlog() << " inodes\n";
+        out << "  freed:         " << reclaimer.freed() << " inodes in " << reclaimer.batches() << " batches\n";
+        out << "  throughput:    " << throughput << " inodes/s" << '\n';
+        if (journal.isOpen()) {
+            out << "Journal:\n";
+            out << "  records:       " << journal.records() << "\n";
+            out << "  group commits: " << journal.commits() << "\n";
+            out << "  failed:        " << journal.failed() << " commits, retried with the next group\n";
+            out << "  bytes:         " << journal.bytes() << "\n";
+            out << "  pending:       " << journal.pendingCount() << '\n';
+        }
+#ifndef VFS_NO_STATS
+        // Only the commands that have run are listed; latencies are in microseconds
+        out << "Commands (latency in us):\n";
+        out << "  " << std::left << std::setw(12) << "command" << std::right << std::setw(10) << "calls"
+            << std::setw(8) << "errors" << std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10) << "p90"
+            << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(10) << "max" << '\n';
+        for (size_t i = 0; i < static_cast<size_t>(Command::Count); ++i) {
+            const CommandStats::Counters& counter = commands[static_cast<Command>(i)];
+            const LatencyHistogram& latency = counter.latency;
+            if (latency.count() == 0) {
+                continue;
+            }
+            out << "  " << std::left << std::setw(12) << COMMAND_NAMES[i] << std::right << std::setw(10) << latency.count()
+                << std::setw(8) << counter.errors.load(std::memory_order_relaxed);
+            const uint64_t values[] = {latency.mean(), latency.percentile(0.5), latency.percentile(0.9),
+                                       latency.percentile(0.99), latency.percentile(0.999), latency.max()};
+            for (uint64_t nanoseconds : values) {
+                out << std::setw(10) << nanoseconds / 1000.0;
+            }
+            out << '\n';
+        }
+#else
+        out << "Commands: not counted (built with VFS_NO_STATS)" << '\n';
+#endif
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+    // help method - displays help information
+    void help(Session& session) const {
+        printHelp(session.out);
+    }
+
+    // Prints the command list (shared with the compact engine)
+    static void printHelp(std::ostream& out) {
+        out << "\nWelcome to the Virtual File System (VFS)!\n";
+        out << "Here are the available commands you can use:\n\n";
+        out << "help: Displays this help menu.\n";
+        out << "pwd: Shows the path of the current inode.\n";
+        out << "ls [-n <count>]: Lists the children of the current inode, largest first (only the <count> largest with -n).\n";
+        out << "mkdir <foldername>: Creates a new folder under the current folder.\n";
+        out << "touch <filename> <size>: Creates a new file under the current inode location with the specified size.\n";
+        out << "cd <foldername/filename/../-/>: Changes the current inode. Use '..' for parent folder, '-' for previous directory, and '/' for root.\n";
+        out << "rm <foldername/filename> ...: Removes the specified folders or files and puts them in the bin.\n";
+        out << "size <foldername/filename>: Returns the total size of the folder or file.\n";
+        out << "find <pattern>: Lists the full path of every file and folder whose name matches the pattern ('*' and '?' are wildcards).\n";
+        out << "du [-j <threads>] [path]: Recounts every folder under the path (default: the current folder) using <threads> threads, and reports totals that disagree.\n";
+        out << "showbin: Displays the oldest inode in the bin and the number of entries.\n";
+        out << "emptybin: Empties the bin.\n";
+        out << "stats [--json]: Shows tree, allocator, cache and bin counters, and the calls, errors and latencies of each command.\n";
+        out << "save <file>: Writes the tree to a binary image file.\n";
+        out << "load <file>: Replaces the tree with the contents of an image file.\n";
+        out << "checkpoint: Writes the --image file and empties the --journal file.\n";
+        out << "snapshot [<name> | -d <name> | -v [<name>]]: Takes a named snapshot of the tree; with no argument lists the snapshots, -d deletes one, and -v views one read-only with ls, cd, size, find, read and pwd ('-v' alone returns to the live tree).\n";
+        out << "exit: Stops the program.\n\n";
+
+        out << "Optional commands:\n";
+        out << "mv <filename> <foldername>: Moves a file from the current inode location to the specified folder path.\n";
+        out << "recover [name/path]: Reinstates an inode from the bin to its original position in the tree: the oldest one, the newest one with that name, or the one removed from that path.\n";
+        out << "write <filename> <offset> <data | @hostfile>: Writes the rest of the line (or the contents of a host file) into a file at the offset, growing the file to fit.\n";
+        out << "read <filename> [<offset> <length>]: Prints the contents of a file (or length bytes from the offset); unwritten parts read as zeros.\n";
+        out << "\nPlease enter a command to continue...\n";
+       
+    }
+
+
+
+    // pwd method - returns the current path as a string
+    std::string pwd(Session& session) {
+        CommandTimer timer(session, Command::Pwd);
+        std::lock_guard<std::mutex> access(session.gate);
+        return constructPath(session.currentInode);
+    }
+   
+  
+    // ls method - lists the contents of the current directory, largest first
+    // If a limit is given, only the `limit` largest entries are listed
+    void ls(Session& session, size_t limit = static_cast<size_t>(-1)) {
+        CommandTimer timer(session, Command::Ls);
+        std::lock_guard<std::mutex> access(session.gate);
+        // Check if the current inode is a directory
+        if (session.currentInode->type != Inode::Type::Directory) {
+            session.out << "Error: Current inode is not a directory" << '\n';
+            timer.fail();
+            return;
+        }
+
+        if (session.view != nullptr) {
+            listSnapshot(session, limit);
+            return;
+        }
+
+        // The listing reads the directory and its children's totals, so it holds the read lock
+        Inode* dir = expand(session.currentInode);
+        std::shared_lock<DirLock> guard(dir->lock);
+
+        // Check if the directory is empty
+        if (dir->children().empty()) {
+            session.out << "Directory is empty" << '\n';
+            return;
+        }
+
+        // Print details of each child in size order, taken from the directory's maintained view
+        dir->dirData->sizeOrder.forLargest(limit, [&](const Inode* child) {
+            printEntry(session, child, child->totalSize);
+        });
+    }
+
+    // Method to create a new directory
+    void mkdir(Session& session, const std::string& folderName) {
+        CommandTimer timer(session, Command::Mkdir);
+        std::lock_guard<std::mutex> access(session.gate);
+        // The directory is stamped with the current time
+        if (viewingSnapshot(session, "mkdir") || !createDirectory(session, folderName, currentTime())) {
+            timer.fail();
+        }
+    }
+
+    // Method to create a new file
+    void touch(Session& session, const std::string& filename, size_t size) {
+        CommandTimer timer(session, Command::Touch);
+        std::lock_guard<std::mutex> access(session.gate);
+        // The file is stamped with the current time
+        if (viewingSnapshot(session, "touch") || !createFile(session, filename, size, currentTime())) {
+            timer.fail();
+        }
+    }
+
+
+
+    // Method to store bytes in a file at an offset
+    void write(Session& session, const std::string& filename, size_t offset, std::string_view data) {
+        CommandTimer timer(session, Command::Write);
+        ExclusiveAccess access(*this);
+        // The file is stamped with the current time
+        if (viewingSnapshot(session, "write") || !writeFile(session, filename, offset, data, currentTime())) {
+            timer.fail();
+        }
+    }
+
+    // read method - prints `length` bytes of a file from `offset` (by default all of it), cut
+    // short at the end of the file, followed by a newline unless the last byte printed is one.
+    // The bytes go from the blocks to the session's output stream with no copy in between, a
+    // run of adjacent blocks per write; holes read as zeros. In a snapshot view the file is the
+    // one the snapshot saw. Writers run alone, so the contents cannot change while they print.
+    void read(Session& session, const std::string& filename, size_t offset = 0, size_t length = SIZE_MAX) {
+        CommandTimer timer(session, Command::Read);
+        std::lock_guard<std::mutex> access(session.gate);
+        Inode* file = lookup(session.currentInode, filename, session.view != nullptr ? session.view->epoch : 0);
+        if (file == nullptr) {
+            session.out << "Error: File '" << filename << "' not found." << '\n';
+            timer.fail();
+            return;
+        }
+        if (file->type != Inode::Type::File) {
+            session.out << "Error: '" << filename << "' is a directory." << '\n';
+            timer.fail();
+            return;
+        }
+        if (offset >= file->size || length == 0) {
+            return;
+        }
+        length = std::min(length, file->size - offset);
+        char last = '\0';
+        auto emit = [&](const char* data, size_t count) {
+            session.out.write(data, static_cast<std::streamsize>(count));
+            last = data[count - 1];
+        };
+        if (file->fileData != nullptr) {
+            file->fileData->read(offset, length, emit);
+        } else {
+            for (size_t left = length; left > 0;) {
+                size_t count = std::min(left, BlockStore::BLOCK_SIZE);
+                emit(BlockStore::ZEROS, count);
+                left -= count;
+            }
+        }
+        if (last != '\n') {
+            session.out << '\n';
+        }
+    }
+
+    // Method to change the current directory
+    void cd(Session& session, const std::string& path) {
+        CommandTimer timer(session, Command::Cd);
+        std::lock_guard<std::mutex> access(session.gate);
+        // If the path is empty or root ("/"), change to root directory
+        if (path.empty() || path == "/") {
+            session.previousInode = session.currentInode; // Save the current directory
+            session.currentInode = rootInode; // Change to root directory
+            return;
+        }
+
+        // If the path is "-", change to the previous directory
+        if (path == "-") {
+            // If there is a previous directory still in the tree (a snapshot never loses one)
+            if (session.previousInode && (session.view != nullptr || attached(session.previousInode))) {
+                session.currentInode = session.previousInode; // Change to the previous directory
+            }
+            return;
+        }
+
+        // If the path is "..", change to the parent directory
+        if (path == "..") {
+            if (session.currentInode != rootInode) {  // Prevent moving above root
+                session.previousInode = session.currentInode; // Save the current directory
+                session.currentInode = session.currentInode->parent; // Change to parent directory
+            }
+            return;
+        }
+
+        // Handle absolute or relative path through the shared resolver
+        std::string_view missing;
+        Inode* targetInode = session.view != nullptr
+            ? resolvePath(nullptr, session.currentInode, path, &missing, session.view->epoch)
+            : resolvePath(&session.pathCache, session.currentInode, path, &missing);
+
+        // If a directory is not found, print an error message and return
+        if (!targetInode) {
+            session.out << "Directory not found: " << missing << '\n';
+            timer.fail();
+            return;
+        }
+
+        // Change to the target directory
+        session.previousInode = session.currentInode; // Save the current directory
+        session.currentInode = targetInode; // Change to the target directory
+    }
+
+    // Method to remove a file or directory
+    void rm(Session& session, const std::string& name) {
+        Vector<std::string> names;
+        names.push_back(name);
+        rm(session, names);
+    }
+
+    // Method to remove several files or directories from the current directory ('rm a b c')
+    // All of them are removed under one exclusive hold of the tree, and the bookkeeping that
+    // does not depend on the individual entry (path cache, name index density, other sessions)
+    // is done once for the batch
+    void rm(Session& session, const Vector<std::string>& names) {
+        CommandTimer timer(session, Command::Rm);
+        ExclusiveAccess access(*this);
+        if (viewingSnapshot(session, "rm")) {
+            timer.fail();
+            return;
+        }
+        Inode* dir = expand(session.currentInode);
+        preservePath(dir);
+        std::string dirPath = constructPath(dir);
+        if (dirPath != "/") {
+            dirPath += '/';
+        }
+        bool removedAny = false;
+        for (const std::string& name : names) {
+            // Look up the inode to be removed in the child index
+            Inode* toBeRemoved = dir->findChild(name);
+
+            // If no child with the given name is found, print an error message and go on
+            if (!toBeRemoved) {
+                session.out << "Error: File or directory '" << name << "' not found." << '\n';
+                timer.fail();
+                continue;
+            }
+
+            // Detach the inode from the current directory (children and index), in O(1)
+            dir->removeChild(toBeRemoved);
+            logMutation(session, dir, Journal::Op::Rm, name);
+            // find only reports inodes in the tree
+            indexSubtree(toBeRemoved, false);
+
+            // The bin grows as needed, so every removed inode can be recovered
+            binInsert(toBeRemoved, dir, dirPath + name);
+            removedAny = true;
+
+            // Print a success message
+            session.out << "Removed '" << name << "'." << '\n';
+        }
+        if (!removedAny) {
+            return;
+        }
+
+        ++treeGeneration; // Cached paths through the removed inodes are no longer valid
+        // Once enough names are gone, the name index starts over
+        if (nameIndex.sparse()) {
+            buildNameIndex();
+        }
+
+        // Other sessions working inside a removed subtree are moved up to this directory,
+        // so every session's working directory stays in the tree
+        // (sessions viewing a snapshot stay where they are: the snapshot still has the subtree)
+        for (Session* other = sessions; other != nullptr; other = other->nextSession) {
+            if (other != &session && other->view == nullptr && !attached(other->currentInode)) {
+                other->currentInode = dir;
+            }
+        }
+    }
+
+    // This method displays the oldest inode in the bin
+    void showbin(Session& session) {
+        CommandTimer timer(session, Command::Showbin);
+        std::lock_guard<std::mutex> access(session.gate);
+        // Check if the bin is empty
+        if (binLive == 0) {
+            // If empty, print a message
+            session.out << "Bin is empty." << '\n';
+        } else {
+            // If not empty, get the oldest inode (the front entry is never a tombstone)
+            const BinEntry& oldest = bin.front_element();
+            // Print the name of the oldest inode
+            session.out << "Oldest inode in the bin: " << oldest.node->name << '\n';
+            // Print the original path of the oldest inode
+            session.out << "Path: " << oldest.path << '\n';
+            session.out << "Entries in the bin: " << binLive << '\n';
+        }
+    }
+
+
+    // This method recovers an inode from the bin: the oldest one, or the newest one removed
+    // under the given name, or from the given original path (relative paths start at the
+    // current directory)
+    void recover(Session& session, const std::string& target = "") {
+        CommandTimer timer(session, Command::Recover);
+        ExclusiveAccess access(*this);
+        if (viewingSnapshot(session, "recover")) {
+            timer.fail();
+            return;
+        }
+        // Check if the bin is empty
+        if (binLive == 0) {
+            // If empty, print an error message and return
+            session.out << "Error: Bin is empty." << '\n';
+            timer.fail();
+            return;
+        }
+
+        // Find the entry: names and paths are both indexed, so this is a single lookup
+        uint64_t sequence = binFront;
+        std::string key = target;
+        if (!target.empty()) {
+            bool isPath = target.find('/') != std::string::npos;
+            if (isPath) {
+                // Original paths are stored in canonical form: absolute, no '.', '..' or empty components
+                std::string absolute = target[0] == '/' ? target : constructPath(session.currentInode) + "/" + target;
+                Vector<std::string_view> parts;
+                PathTokenizer tokens(absolute);
+                std::string_view token;
+                while (tokens.next(token)) {
+                    if (token == "..") {
+                        if (!parts.empty()) parts.pop_back();
+                    } else if (token != ".") {
+                        parts.push_back(token);
+                    }
+                }
+                key.clear();
+                for (std::string_view part : parts) {
+                    key += '/';
+                    key.append(part.data(), part.size());
+                }
+            }
+            const uint64_t* found = isPath ? binByPath.find(key) : binByName.find(key);
+            if (found == nullptr) {
+                session.out << "Error: '" << target << "' is not in the bin." << '\n';
+                timer.fail();
+                return;
+            }
+            sequence = *found;
+        }
+        BinEntry& entry = bin.at(sequence - binFront);
+        Inode* inodeToRecover = entry.node;
+
+        // The entry goes back to the directory it was removed from, which must still be in the tree
+        if (entry.parent == nullptr) {
+            session.out << "Error: The original location of '" << inodeToRecover->name << "' is unknown." << '\n';
+            timer.fail();
+            return;
+        }
+        if (!attached(entry.parent)) {
+            session.out << "Error: The original folder of '" << inodeToRecover->name
+                << "' is in the bin; recover it first." << '\n';
+            timer.fail();
+            return;
+        }
+
+        // Names are unique within a directory, keep the inode in the bin if the name was reused
+        if (expand(entry.parent)->findChild(inodeToRecover->name)) {
+            session.out << "Error: '" << inodeToRecover->name << "' already exists in its original location." << '\n';
+            timer.fail();
+            return;
+        }
+
+        // Add the inode to be recovered to the parent inode's children and take it off the bin
+        preservePath(entry.parent);
+        entry.parent->addChild(inodeToRecover);
+        ++treeGeneration;
+        indexSubtree(inodeToRecover, true);
+        logMutation(session, nullptr, Journal::Op::Recover, target.empty() ? target : key);
+        binRelease(sequence);
+        // Print a success message
+        session.out << "Recovered '" << inodeToRecover->name << "' to its original location." << '\n';
+    }
+
+    // Method to move a file to a different folder
+    void mv(Session& session, const std::string& filename, const std::string& foldername) {
+        CommandTimer timer(session, Command::Mv);
+        ExclusiveAccess access(*this);
+        if (viewingSnapshot(session, "mv")) {
+            timer.fail();
+            return;
+        }
+        // Initialize pointers to the file and folder nodes
+        Inode* fileNode = nullptr;
+        Inode* folderNode = nullptr;
+
+        // Look up the file and folder nodes in the current inode's child index
+        if (Inode* child = expand(session.currentInode)->findChild(filename)) {
+            // If the child node is a file, assign it to fileNode
+            if (child->type == Inode::Type::File) {
+                fileNode = child;
+            }
+        }
+        if (Inode* child = session.currentInode->findChild(foldername)) {
+            // If the child node is a directory, assign it to folderNode
+            if (child->type == Inode::Type::Directory) {
+                folderNode = child;
+            }
+        }
+
+        // Check if the file and folder nodes were found
+        if (!fileNode) {
+            // If the file node was not found, print an error message and return
+            session.out << "Error: File '" << filename << "' not found." << '\n';
+            timer.fail();
+            return;
+        }
+        if (!folderNode) {
+            // If the folder node was not found, print an error message and return
+            session.out << "Error: Folder '" << foldername << "' not found." << '\n';
+            timer.fail();
+            return;
+        }
+
+        // The folder cannot hold two entries with the same name
+        if (expand(folderNode)->findChild(filename)) {
+            session.out << "Error: '" << filename << "' already exists in '" << foldername << "'." << '\n';
+            timer.fail();
+            return;
+        }
+
+        // Detach the file node from the current inode and add it to the folder node's children
+        // The name stays the same, so the name index needs no update (find builds paths as it goes)
+        // The folder is a child of the current directory, so its path covers both changes
+        preservePath(folderNode);
+        session.currentInode->removeChild(fileNode);
+        folderNode->addChild(fileNode);
+        ++treeGeneration;
+        logMutation(session, session.currentInode, Journal::Op::Mv, filename, foldername);
+
+        // Print a success message
+        session.out << "Successfully moved '" << filename << "' to '" << foldername << "'." << '\n';
+    }
+
+
+
+    // This method is used to empty the bin; returns false if the session cannot change the tree
+    bool emptybin(Session& session) {
+        CommandTimer timer(session, Command::Emptybin);
+        ExclusiveAccess access(*this);
+        if (viewingSnapshot(session, "emptybin")) {
+            timer.fail();
+            return false;
+        }
+        if (binLive > 0) {
+            logMutation(session, nullptr, Journal::Op::Emptybin);
+        }
+        // Freed inodes may still be referenced by cached paths
+        ++treeGeneration;
+        // 'cd -' must not lead into a freed directory, in any session
+        // (one viewing a snapshot is inside the snapshot, which keeps its directories)
+        for (Session* session = sessions; session != nullptr; session = session->nextSession) {
+            if (session->view == nullptr && session->previousInode != nullptr && !attached(session->previousInode)) {
+                session->previousInode = nullptr;
+            }
+        }
+        if (newestEpoch != 0) {
+            // Snapshots may still list the removed inodes, so they are kept until the last one is deleted
+            for (size_t i = 0; i < bin.getSize(); ++i) {
+                if (Inode* removedInode = bin.at(i).node) {
+                    retained.push_back(removedInode);
+                    retainedInodes += removedInode->totalInodes;
+                }
+            }
+        } else if (binInodes + bin.getSize() <= SYNC_RECLAIM_LIMIT) {
+            // A small bin is cheaper to free right here than to hand over
+            for (size_t i = 0; i < bin.getSize(); ++i) {
+                if (Inode* removedInode = bin.at(i).node) {
+                    inodePool.destroySubtree(removedInode); // Slots go back to the pool for reuse
+                }
+            }
+        } else {
+            // The whole bin (entries and indexes) is swapped into a batch and freed by the
+            // reclaimer thread, so this returns without touching the removed inodes
+            ReclaimBatch* batch = new ReclaimBatch;
+            binFront += bin.getSize();
+            batch->entries.swap(bin);
+            batch->byName.swap(binByName);
+            batch->byPath.swap(binByPath);
+            batch->inodes = binInodes;
+            reclaimer.hand(batch);
+        }
+        clearBin();
+        return true;
+    }
+
+
+    // snapshot method - takes, lists, deletes or views point-in-time views of the tree
+    // Taking one is O(1): it hands out a new id and nothing is copied. A directory keeps its old
+    // children and totals the first time it changes afterwards (see preserve), so a change copies
+    // only the directories on its path to the root, and snapshots cost memory in proportion to
+    // what changed since they were taken. Versions, and the inodes emptied from the bin or replaced
+    // by writes meanwhile, are freed when the last snapshot is deleted.
+    // A session viewing a snapshot runs ls, cd, size, find, read and pwd against it; commands that
+    // change the tree are refused until it returns to the live tree with 'snapshot -v'.
+    void snapshot(Session& session, SnapshotOp op, const std::string& name = "") {
+        CommandTimer timer(session, Command::Snapshot);
+        ExclusiveAccess access(*this);
+        size_t index = snapshots.size();
+        for (size_t i = 0; i < snapshots.size(); ++i) {
+            if (snapshots[i]->name == name) {
+                index = i;
+            }
+        }
+        Snapshot* found = index < snapshots.size() ? snapshots[index] : nullptr;
+
+        switch (op) {
+        case SnapshotOp::Take: {
+            if (found != nullptr) {
+                session.out << "Error: Snapshot '" << name << "' already exists." << '\n';
+                timer.fail();
+                return;
+            }
+            Snapshot* taken = new Snapshot;
+            taken->name = name;
+            taken->epoch = ++snapshotsTaken;
+            snapshots.push_back(taken);
+            newestEpoch = taken->epoch;
+            session.out << "Snapshot '" << name << "' taken (" << rootInode->totalInodes << " inodes, "
+                        << rootInode->totalSize << " bytes)." << '\n';
+            return;
+        }
+        case SnapshotOp::List:
+            if (snapshots.empty()) {
+                session.out << "No snapshots." << '\n';
+            }
+            for (Snapshot* snapshot : snapshots) {
+                size_t inodes;
+                size_t bytes = snapshotTotal(rootInode, snapshot->epoch, &inodes);
+                session.out << snapshot->name << "\t" << inodes << " inodes\t" << bytes << " bytes"
+                            << (snapshot == session.view ? "\t(viewing)" : "") << '\n';
+            }
+            return;
+        case SnapshotOp::Drop:
+            if (found == nullptr) {
+                session.out << "Error: Snapshot '" << name << "' not found." << '\n';
+                timer.fail();
+                return;
+            }
+            if (found->viewers > 0) {
+                session.out << "Error: Snapshot '" << name << "' is being viewed; return to the live tree with 'snapshot -v' first." << '\n';
+                timer.fail();
+                return;
+            }
+            snapshots.erase(index);
+            delete found;
+            newestEpoch = 0;
+            for (Snapshot* snapshot : snapshots) {
+                newestEpoch = std::max(newestEpoch, snapshot->epoch);
+            }
+            if (snapshots.empty()) {
+                releaseVersions();
+            }
+            session.out << "Deleted snapshot '" << name << "'." << '\n';
+            return;
+        case SnapshotOp::View:
+            if (!name.empty() && found == nullptr) {
+                session.out << "Error: Snapshot '" << name << "' not found." << '\n';
+                timer.fail();
+                return;
+            }
+            // Either way the session starts over at the root: its directory may not exist in the other tree
+            if (session.view != nullptr) {
+                --session.view->viewers;
+            }
+            session.view = found;
+            if (found != nullptr) {
+                ++found->viewers;
+            }
+            session.currentInode = rootInode;
+            session.previousInode = nullptr;
+            if (found != nullptr) {
+                session.out << "Viewing snapshot '" << name << "' (read-only)." << '\n';
+            } else {
+                session.out << "Viewing the live tree." << '\n';
+            }
+            return;
+        }
+    }
+
+    // save method - writes the tree and the bin to an image file
+    bool save(Session& session, const std::string& path) {
+        CommandTimer timer(session, Command::Save);
+        ExclusiveAccess access(*this);
+        if (!writeImage(session, path)) {
+            timer.fail();
+            return false;
+        }
+        return true;
+    }
+
+    // load method - replaces the tree with the contents of an image file
+    // The file stays memory-mapped and directories are built from it on first use (see expand)
+    bool load(Session& session, const std::string& path) {
+        CommandTimer timer(session, Command::Load);
+        ExclusiveAccess access(*this);
+        if (viewingSnapshot(session, "load")) {
+            timer.fail();
+            return false;
+        }
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            session.out << "Error: Cannot open image '" << path << "'." << '\n';
+            timer.fail();
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(ImageHeader)) {
+            close(fd);
+            session.out << "Error: '" << path << "' is not an image." << '\n';
+            timer.fail();
+            return false;
+        }
+        size_t length = info.st_size;
+        void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            session.out << "Error: Cannot map image '" << path << "'." << '\n';
+            timer.fail();
+            return false;
+        }
+
+        const char* base = static_cast<const char*>(mapping);
+        if (!validImage(base, length)) {
+            munmap(mapping, length);
+            session.out << "Error: '" << path << "' is not a valid image." << '\n';
+            timer.fail();
+            return false;
+        }
+        const ImageHeader* header = reinterpret_cast<const ImageHeader*>(base);
+        const ImageInode* records = reinterpret_cast<const ImageInode*>(base + sizeof(ImageHeader));
+        const ImageBinEntry* binRecords = reinterpret_cast<const ImageBinEntry*>(records + header->inodeCount);
+
+        // Start from an empty tree: the old tree, the bin and the old mapping are released
+        // Snapshots are views of the old tree, so they go with it
+        reclaimer.stop(); // The pool is about to be released under it
+        clearBin();
+        nameIndex.clear(); // Built again by the next find
+        size_t droppedSnapshots = snapshots.size();
+        for (Snapshot* snapshot : snapshots) {
+            delete snapshot;
+        }
+        snapshots.clear();
+        newestEpoch = 0;
+        versionedDirs.clear();
+        versionCount = 0;
+        versionChildren = 0;
+        retained.clear();
+        retainedInodes = 0;
+        inodePool.releaseAll();
+        releaseImage();
+        ++treeGeneration;
+
+        // Only the root is built now; every other directory is built from its record the first
+        // time it is used, so startup cost does not grow with the size of the image
+        imageMapping = mapping;
+        imageLength = length;
+        imageRecords = records;
+        imagePool = reinterpret_cast<const char*>(binRecords + header->binCount);
+        imageInodes = header->inodeCount;
+        imagePoolBytes = header->poolBytes;
+        imageSequence = header->sequence;
+
+        rootInode = inodePool.create("/", Inode::Type::Directory, records[0].size);
+        rootInode->totalSize = records[0].totalSize;
+        rootInode->totalInodes = records[0].totalInodes;
+        if (records[0].childCount > 0) {
+            rootInode->dirData->pendingChildren = &records[0];
+        }
+        for (Session* other = sessions; other != nullptr; other = other->nextSession) {
+            other->currentInode = rootInode;
+            other->previousInode = nullptr;
+            other->view = nullptr;
+        }
+
+        // Bin entries go back into the bin in their original order
+        Vector<Inode*> removed(header->binCount);
+        for (size_t i = 1; i <= header->binCount; ++i) {
+            removed.push_back(validRecord(records[i]) && binRecords[i - 1].parentBase < header->binCount + 2
+                              ? buildInode(records[i]) : nullptr);
+        }
+        // Each entry points back at its original parent: a directory in the tree, or a directory
+        // inside another entry if the parent was removed afterwards
+        for (size_t i = 0; i < removed.size(); ++i) {
+            const ImageBinEntry& entry = binRecords[i];
+            if (removed[i] == nullptr) {
+                session.out << "Error: Image record " << i + 1 << " is corrupt; bin entry dropped." << '\n';
+                continue;
+            }
+            std::string_view parentPath(imagePool + entry.parentOffset, entry.parentLength);
+            Inode* parent = nullptr;
+            if (entry.parentBase == 1 && !parentPath.empty() && parentPath[0] == '/') {
+                parent = resolvePath(nullptr, rootInode, parentPath);
+            } else if (entry.parentBase > 1 && entry.parentBase - 2 != i && removed[entry.parentBase - 2] != nullptr &&
+                       (parentPath.empty() || parentPath[0] != '/')) {
+                parent = resolvePath(nullptr, removed[entry.parentBase - 2], parentPath);
+            }
+            removed[i]->parent = parent;
+            binInsert(removed[i], parent, std::string(imagePool + entry.pathOffset, entry.pathLength));
+        }
+
+        session.out << "Loaded " << imageInodes << " inodes from '" << path << "'." << '\n';
+        if (droppedSnapshots > 0) {
+            session.out << "Deleted " << droppedSnapshots << " snapshots of the previous tree." << '\n';
+        }
+
+        // The journal cannot replay a load, so the loaded tree becomes the new checkpoint
+        if (journal.isOpen() && !writeCheckpoint(session)) {
+            timer.fail();
+            return false;
+        }
+        return true;
+    }
+
+    // Opens the journal, replays the records the tree does not contain yet, and logs every later
+    // mutation to it. Records are synced in groups of up to groupOps, or after groupWindow.
+    // 'checkpoint' writes imagePath and truncates the journal.
+    // Called once at startup, before any session runs a command.
+    bool openJournal(Session& session, const std::string& path, const std::string& imagePath, size_t groupOps,
+                     std::chrono::milliseconds groupWindow) {
+        journal.configure(groupOps, groupWindow);
+        checkpointPath = imagePath;
+
+        // Replayed commands run silently, in a session of their own that writes to no stream
+        size_t replayed = 0, failed = 0;
+        std::ostream muted(nullptr);
+        std::string error;
+        {
+            Session replay(*this, muted);
+            replaying = true;
+            error = journal.open(path, imageSequence, [&](const Journal::Record& record) {
+                ++replayed;
+                if (!replayRecord(replay, record)) {
+                    ++failed;
+                }
+            });
+            replaying = false;
+        }
+
+        if (!error.empty()) {
+            session.out << "Error: " << error << '\n';
+            return false;
+        }
+        if (journal.dropped() > 0) {
+            session.out << "Journal: discarded " << journal.dropped() << " bytes of incomplete records." << '\n';
+        }
+        if (failed > 0) {
+            session.out << "Error: " << failed << " journal records refer to missing directories; skipped." << '\n';
+        }
+        if (replayed > 0) {
+            session.out << "Replayed " << replayed << " journal records." << '\n';
+        }
+        return true;
+    }
+
+    // checkpoint method - writes the image and empties the journal
+    bool checkpoint(Session& session) {
+        CommandTimer timer(session, Command::Checkpoint);
+        ExclusiveAccess access(*this);
+        if (!writeCheckpoint(session)) {
+            timer.fail();
+            return false;
+        }
+        return true;
+    }
+
+    // Milliseconds until pending journal records are due for their group commit, -1 if none are
+    long long syncDelay() {
+        if (!journal.isOpen()) {
+            return -1; // Opened (or not) before any command runs, so this needs no lock
+        }
+        std::lock_guard<std::mutex> guard(journalLock);
+        return journal.untilDue();
+    }
+
+    // Syncs journal records that are still waiting for their group commit
+    void syncJournal(Session& session) {
+        std::lock_guard<std::mutex> guard(journalLock);
+        if (!journal.commit()) {
+            session.out << "Error: Cannot write the journal; recent changes are not durable." << '\n';
+        }
+    }
+
+    // exit method - handles exiting the program
+    void exit(Session& session) const {
+        session.out << "Exiting the Virtual File System. Goodbye!\n";
+    }
+
+};
+
+
+// Session implementation, placed after FileSystem because it joins and leaves the tree
+
+inline Session::Session(FileSystem& vfs, std::ostream& output) : vfs(vfs), out(output) {
+    vfs.join(*this);
+}
+
+inline Session::~Session() {
+    vfs.leave(*this);
+}
+
+//====================================================
+// Compact storage engine: the same commands over a structure-of-arrays inode table
+//====================================================
+
+class CompactFileSystem;
+
+// One client of a CompactFileSystem: its working directories and output stream
+// The compact engine serves one session, from one thread
+class CompactSession {
+public:
+    CompactSession(CompactFileSystem& vfs, std::ostream& output);
+
+    // Returns the stream this session's command output is written to
+    std::ostream& output() { return out; }
+
+    // Disable copy construction and assignment for simplicity
+    CompactSession(const CompactSession&) = delete;
+    CompactSession& operator=(const CompactSession&) = delete;
+
+private:
+    friend class CompactFileSystem;
+
+    std::ostream& out;            // Where command output goes
+    uint32_t currentInode;        // Working directory, always in the tree
+    uint32_t previousInode;       // Previous working directory for 'cd -', may have been removed since
+    TimeFormatter timeFormatter;  // Formats the timestamps ls prints
+};
+
+// Storage engine for trees too large for one heap object per inode. Inodes are rows in parallel
+// columns indexed by 32-bit ids: flags, size, modification time, parent, name and sibling links,
+// about 37 bytes a row. Directories also get a row in a second, smaller table with their totals,
+// first child and child count. Names are length-prefixed in one pool, and a single open-addressing
+// table maps (parent, name) to the child for every directory at once. A traversal reads a few
+// dense arrays instead of chasing pointers into scattered inodes.
+// Runs the same commands as FileSystem, with the same output, for one session at a time. There
+// is no name index, no du, no file contents and no journal, and images can be loaded but not
+// saved; those commands report that they are not available. The bin keeps removed subtrees in
+// place and is searched newest first.
+class CompactFileSystem {
+public:
+    static constexpr uint32_t NONE = UINT32_MAX;  // No inode (also marks an empty hash slot)
+    static constexpr uint32_t ROOT = 0;           // Id of the root directory
+
+private:
+    friend class CompactSession;
+
+    // Bits of the flags column
+    static constexpr uint8_t DIRECTORY = 1;
+    static constexpr uint8_t DETACHED = 2;   // Top of a removed subtree, in the bin
+    static constexpr uint8_t FREE = 4;       // Row on the free list
+
+    std::ostream& out;          // Where diagnostics that belong to no command go (verify)
+
+    // Inode columns, indexed by id
+    Vector<uint8_t> flags;
+    Vector<uint64_t> sizes;           // Size of the file, or the directory entry's own size
+    Vector<int64_t> mtimes;           // Last modification time in seconds since the epoch, 0 if unknown
+    Vector<uint32_t> parents;         // Parent id, NONE for the root; kept when the inode is removed
+    Vector<uint32_t> names;           // Offset of the name's entry in namePool
+    Vector<uint32_t> nextSiblings;    // Next child of the same directory (next free row for free rows)
+    Vector<uint32_t> prevSiblings;    // Previous child of the same directory, NONE for the first child
+    Vector<uint32_t> dirRows;         // Row in the directory columns, NONE for files
+
+    // Directory columns, indexed by dirRows[id]
+    Vector<uint64_t> totalSizes;      // Aggregate bytes of the directory and everything below it
+    Vector<uint32_t> totalInodes;     // Inodes in the directory's subtree, including itself
+    Vector<uint32_t> firstChildren;   // First child, NONE if empty (next free row for free rows)
+    Vector<uint32_t> childCounts;     // Number of children
+
+    uint32_t freeIds = NONE;          // Free inode rows, linked through nextSiblings
+    uint32_t freeDirRows = NONE;      // Free directory rows, linked through firstChildren
+    size_t liveInodes = 0;            // Rows in use (tree and bin)
+    size_t liveDirs = 0;              // Directory rows in use
+
+    // Names as (varint length, bytes) entries; entries of freed inodes are reclaimed once they
+    // make up half of the pool
+    std::string namePool;
+    size_t deadNameBytes = 0;
+
+    // (parent, name) -> child id for every linked inode, linear probing, backward-shift deletion
+    Vector<uint32_t> slots;           // Capacity is always zero or a power of two
+    size_t slotCount = 0;             // Inodes in the table
+
+    // Removed subtrees, oldest first; recovered entries stay as tombstones until they reach the front
+    struct BinEntry {
+        uint32_t node = NONE;         // Top of the removed subtree, NONE once recovered
+        uint32_t parent = NONE;       // Directory it was removed from
+        std::string path;             // Original absolute path
+    };
+    Queue<BinEntry> bin;
+    size_t binLive = 0;               // Entries that are not tombstones
+
+    // Returns an inode's name, decoded from its pool entry
+    std::string_view nameOf(uint32_t id) const {
+        const unsigned char* entry = reinterpret_cast<const unsigned char*>(namePool.data()) + names[id];
+        size_t length = 0;
+        int shift = 0;
+        while (*entry & 0x80) {
+            length |= static_cast<size_t>(*entry++ & 0x7f) << shift;
+            shift += 7;
+        }
+        length |= static_cast<size_t>(*entry++) << shift;
+        return std::string_view(reinterpret_cast<const char*>(entry), length);
+    }
+
+    // Returns the bytes a name's pool entry takes
+    static size_t entryBytes(std::string_view name) {
+        size_t bytes = name.size() + 1;
+        for (size_t length = name.size(); length >= 0x80; length >>= 7) {
+            ++bytes;
+        }
+        return bytes;
+    }
+
+    // Appends a name entry to a pool and returns its offset
+    static uint32_t appendName(std::string& pool, std::string_view name) {
+        if (pool.size() + entryBytes(name) > UINT32_MAX) {
+            throw std::length_error("name pool is full");
+        }
+        uint32_t offset = static_cast<uint32_t>(pool.size());
+        size_t length = name.size();
+        while (length >= 0x80) {
+            pool += static_cast<char>((length & 0x7f) | 0x80);
+            length >>= 7;
+        }
+        pool += static_cast<char>(length);
+        pool.append(name.data(), name.size());
+        return offset;
+    }
+
+    bool isDirectory(uint32_t id) const { return flags[id] & DIRECTORY; }
+    uint64_t totalSizeOf(uint32_t id) const { return isDirectory(id) ? totalSizes[dirRows[id]] : sizes[id]; }
+    uint32_t totalInodesOf(uint32_t id) const { return isDirectory(id) ? totalInodes[dirRows[id]] : 1; }
+
+    // Hash of a (parent, name) key
+    static size_t hashKey(uint32_t parent, std::string_view name) {
+        return ChildIndex::hashName(name) ^ (static_cast<size_t>(parent) * 0x9E3779B97F4A7C15ULL);
+    }
+
+    // Grows the child table and reinserts every entry (hashes are recomputed from the columns)
+    void rehash(size_t newCapacity) {
+        Vector<uint32_t> old(std::move(slots));
+        slots = Vector<uint32_t>(newCapacity);
+        for (size_t i = 0; i < newCapacity; ++i) {
+            slots.push_back(NONE);
+        }
+        size_t mask = newCapacity - 1;
+        for (uint32_t id : old) {
+            if (id != NONE) {
+                size_t i = hashKey(parents[id], nameOf(id)) & mask;
+                while (slots[i] != NONE) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = id;
+            }
+        }
+    }
+
+    // Adds an inode to the child table under its parent and name
+    void indexChild(uint32_t id) {
+        if ((slotCount + 1) * 4 > slots.size() * 3) {
+            rehash(slots.empty() ? 16 : slots.size() * 2);
+        }
+        size_t mask = slots.size() - 1;
+        size_t i = hashKey(parents[id], nameOf(id)) & mask;
+        while (slots[i] != NONE) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = id;
+        ++slotCount;
+    }
+
+    // Removes an inode from the child table, shifting later entries of its probe run back
+    void unindexChild(uint32_t id) {
+        size_t mask = slots.size() - 1;
+        size_t i = hashKey(parents[id], nameOf(id)) & mask;
+        while (slots[i] != id) {
+            i = (i + 1) & mask;
+        }
+        size_t hole = i;
+        for (size_t j = (hole + 1) & mask; slots[j] != NONE; j = (j + 1) & mask) {
+            size_t home = hashKey(parents[slots[j]], nameOf(slots[j])) & mask;
+            if (((j - home) & mask) >= ((j - hole) & mask)) {
+                slots[hole] = slots[j];
+                hole = j;
+            }
+        }
+        slots[hole] = NONE;
+        --slotCount;
+    }
+
+    // Finds a directory's child by name, NONE if there is none
+    uint32_t findChild(uint32_t dir, std::string_view name) const {
+        if (slotCount == 0) {
+            return NONE;
+        }
+        size_t mask = slots.size() - 1;
+        for (size_t i = hashKey(dir, name) & mask; slots[i] != NONE; i = (i + 1) & mask) {
+            uint32_t id = slots[i];
+            if (parents[id] == dir && nameOf(id) == name) {
+                return id;
+            }
+        }
+        return NONE;
+    }
+
+    // Takes a row off the free list or appends one, and fills it in
+    uint32_t allocate(std::string_view name, bool directory, uint64_t size, int64_t time) {
+        uint32_t id = freeIds;
+        if (id != NONE) {
+            freeIds = nextSiblings[id];
+        } else {
+            if (flags.size() >= NONE) {
+                throw std::length_error("inode table is full");
+            }
+            id = static_cast<uint32_t>(flags.size());
+            flags.push_back(0);
+            sizes.push_back(0);
+            mtimes.push_back(0);
+            parents.push_back(NONE);
+            names.push_back(0);
+            nextSiblings.push_back(NONE);
+            prevSiblings.push_back(NONE);
+            dirRows.push_back(NONE);
+        }
+        flags[id] = directory ? DIRECTORY : 0;
+        sizes[id] = size;
+        mtimes[id] = time;
+        parents[id] = NONE;
+        names[id] = appendName(namePool, name);
+        nextSiblings[id] = NONE;
+        prevSiblings[id] = NONE;
+        dirRows[id] = NONE;
+        if (directory) {
+            uint32_t row = freeDirRows;
+            if (row != NONE) {
+                freeDirRows = firstChildren[row];
+            } else {
+                row = static_cast<uint32_t>(totalSizes.size());
+                totalSizes.push_back(0);
+                totalInodes.push_back(0);
+                firstChildren.push_back(NONE);
+                childCounts.push_back(0);
+            }
+            totalSizes[row] = size;
+            totalInodes[row] = 1;
+            firstChildren[row] = NONE;
+            childCounts[row] = 0;
+            dirRows[id] = row;
+            ++liveDirs;
+        }
+        ++liveInodes;
+        return id;
+    }
+
+    // Puts a row (and its directory row) back on the free lists
+    void release(uint32_t id) {
+        if (isDirectory(id)) {
+            uint32_t row = dirRows[id];
+            firstChildren[row] = freeDirRows;
+            freeDirRows = row;
+            --liveDirs;
+        }
+        deadNameBytes += entryBytes(nameOf(id));
+        flags[id] = FREE;
+        nextSiblings[id] = freeIds;
+        freeIds = id;
+        --liveInodes;
+    }
+
+    // Rewrites the name pool without the entries of freed rows
+    void compactNames() {
+        std::string live;
+        live.reserve(namePool.size() - deadNameBytes);
+        for (uint32_t id = 0; id < flags.size(); ++id) {
+            if (!(flags[id] & FREE)) {
+                names[id] = appendName(live, nameOf(id));
+            }
+        }
+        namePool.swap(live);
+        deadNameBytes = 0;
+    }
+
+    // Links a child at the front of a directory's child list and into the child table
+    void linkChild(uint32_t dir, uint32_t child) {
+        uint32_t row = dirRows[dir];
+        parents[child] = dir;
+        prevSiblings[child] = NONE;
+        nextSiblings[child] = firstChildren[row];
+        if (firstChildren[row] != NONE) {
+            prevSiblings[firstChildren[row]] = child;
+        }
+        firstChildren[row] = child;
+        ++childCounts[row];
+        indexChild(child);
+    }
+
+    // Unlinks a child from its directory; its parent id is kept so its location can be traced
+    void unlinkChild(uint32_t child) {
+        uint32_t row = dirRows[parents[child]];
+        unindexChild(child);
+        if (prevSiblings[child] != NONE) {
+            nextSiblings[prevSiblings[child]] = nextSiblings[child];
+        } else {
+            firstChildren[row] = nextSiblings[child];
+        }
+        if (nextSiblings[child] != NONE) {
+            prevSiblings[nextSiblings[child]] = prevSiblings[child];
+        }
+        --childCounts[row];
+    }
+
+    // Adds (or, with grow false, subtracts) a subtree's bytes and inodes to dir and its ancestors
+    void adjustTotals(uint32_t dir, uint64_t bytes, uint32_t inodes, bool grow) {
+        for (uint32_t node = dir; node != NONE; node = parents[node]) {
+            uint32_t row = dirRows[node];
+            if (grow) {
+                totalSizes[row] += bytes;
+                totalInodes[row] += inodes;
+            } else {
+                totalSizes[row] -= bytes;
+                totalInodes[row] -= inodes;
+            }
+        }
+    }
+
+    // Calls visit(child) for every child of a directory, most recently linked first
+    template <typename Visit>
+    void forChildren(uint32_t dir, Visit visit) const {
+        for (uint32_t child = firstChildren[dirRows[dir]]; child != NONE; child = nextSiblings[child]) {
+            visit(child);
+        }
+    }
+
+    // Returns the absolute path of an inode
+    std::string constructPath(uint32_t id) const {
+        if (id == ROOT) {
+            return "/";
+        }
+        Vector<uint32_t> chain;
+        size_t length = 0;
+        for (uint32_t node = id; node != ROOT; node = parents[node]) {
+            chain.push_back(node);
+            length += nameOf(node).size() + 1;
+        }
+        std::string path;
+        path.reserve(length);
+        for (size_t i = chain.size(); i-- > 0;) {
+            path += '/';
+            path += nameOf(chain[i]);
+        }
+        return path;
+    }
+
+    // True if the inode is still in the tree (no ancestor, or itself, is the top of a bin entry)
+    bool attached(uint32_t id) const {
+        for (uint32_t node = id; node != ROOT; node = parents[node]) {
+            if (flags[node] & DETACHED) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Resolves a path to a directory like FileSystem::resolvePath, NONE if a component is missing
+    // or not a directory; `failed` is then set to that component
+    uint32_t resolvePath(uint32_t base, std::string_view path, std::string_view* failed) const {
+        uint32_t target = (!path.empty() && path[0] == '/') ? ROOT : base;
+        PathTokenizer tokens(path);
+        std::string_view token;
+        while (tokens.next(token)) {
+            if (token == ".") continue;
+            if (token == "..") {
+                // A bin entry's top has no parent yet while an image is loaded
+                if (target != ROOT && parents[target] != NONE) {
+                    target = parents[target];
+                }
+                continue;
+            }
+            uint32_t child = findChild(target, token);
+            if (child == NONE || !isDirectory(child)) {
+                *failed = token;
+                return NONE;
+            }
+            target = child;
+        }
+        return target;
+    }
+
+    // Creates a file or directory in the session's directory, mirroring FileSystem's messages
+    // Returns false if the name is taken
+    bool create(CompactSession& session, const std::string& name, bool directory, uint64_t size) {
+        uint32_t dir = session.currentInode;
+        uint32_t existing = findChild(dir, name);
+        if (existing != NONE) {
+            if (!directory) {
+                session.out << "Error: A file or directory with the name '" << name << "' already exists." << '\n';
+            } else if (isDirectory(existing)) {
+                session.out << "Error: Directory '" << name << "' already exists." << '\n';
+            } else {
+                session.out << "Error: A file with the name '" << name << "' already exists." << '\n';
+            }
+            return false;
+        }
+        uint32_t id = allocate(name, directory, size, FileSystem::currentTime());
+        linkChild(dir, id);
+        adjustTotals(dir, size, 1, true);
+        return true;
+    }
+
+    // Frees a removed subtree's rows; the subtree's top is already out of the child table
+    void freeSubtree(uint32_t top) {
+        Stack<uint32_t> pending;
+        pending.push(top);
+        while (!pending.isEmpty()) {
+            uint32_t node = pending.pop();
+            if (isDirectory(node)) {
+                forChildren(node, [&](uint32_t child) { pending.push(child); });
+            }
+            if (node != top) {
+                unindexChild(node);
+            }
+            release(node);
+        }
+    }
+
+    // Drops every row, name and bin entry, leaving room for `rows` inodes in the columns
+    void reset(size_t rows) {
+        flags = Vector<uint8_t>(rows);
+        sizes = Vector<uint64_t>(rows);
+        mtimes = Vector<int64_t>(rows);
+        parents = Vector<uint32_t>(rows);
+        names = Vector<uint32_t>(rows);
+        nextSiblings = Vector<uint32_t>(rows);
+        prevSiblings = Vector<uint32_t>(rows);
+        dirRows = Vector<uint32_t>(rows);
+        totalSizes = Vector<uint64_t>();
+        totalInodes = Vector<uint32_t>();
+        firstChildren = Vector<uint32_t>();
+        childCounts = Vector<uint32_t>();
+        freeIds = NONE;
+        freeDirRows = NONE;
+        liveInodes = 0;
+        liveDirs = 0;
+        namePool = std::string();
+        deadNameBytes = 0;
+        slots = Vector<uint32_t>();
+        slotCount = 0;
+        bin.clear();
+        binLive = 0;
+    }
+
+    // Builds the subtree below image record `index` under row `top`, breadth-first, checking each
+    // directory's child range like FileSystem::expand. Bad ranges and repeated names are reported
+    // and left out, and the totals are then summed over the rows actually built, children before
+    // parents. Right after reset() rows are appended in order, so the subtree is rows top... and
+    // only the image index of each row needs remembering.
+    void buildFromImage(CompactSession& session, uint32_t top, size_t index, const ImageInode* records,
+                        size_t count, const char* pool, uint64_t poolBytes) {
+        Vector<uint32_t> indexes;       // Image record of row top + i
+        indexes.push_back(static_cast<uint32_t>(index));
+        for (size_t i = 0; i < indexes.size(); ++i) {
+            const ImageInode& record = records[indexes[i]];
+            if (record.childCount == 0) {
+                continue;
+            }
+            uint32_t dir = top + static_cast<uint32_t>(i);
+            bool ok = record.firstChild > indexes[i] && record.firstChild + static_cast<uint64_t>(record.childCount) <= count;
+            for (size_t k = record.firstChild; ok && k < record.firstChild + record.childCount; ++k) {
+                ok = validImageRecord(records[k], poolBytes);
+            }
+            if (!ok) {
+                session.out << "Error: Image record " << indexes[i] << " is corrupt; its directory is left empty." << '\n';
+                continue;
+            }
+            for (size_t k = record.firstChild; k < record.firstChild + record.childCount; ++k) {
+                const ImageInode& child = records[k];
+                std::string_view name(pool + child.nameOffset, child.nameLength);
+                if (findChild(dir, name) != NONE) {
+                    session.out << "Error: Image record " << k << " repeats the name '" << name << "'; skipped." << '\n';
+                    continue;
+                }
+                linkChild(dir, allocate(name, child.type == 1, child.size, child.mtime));
+                indexes.push_back(static_cast<uint32_t>(k));
+            }
+        }
+        for (size_t i = indexes.size(); i-- > 1;) {
+            uint32_t node = top + static_cast<uint32_t>(i);
+            uint32_t row = dirRows[parents[node]];
+            totalSizes[row] += totalSizeOf(node);
+            totalInodes[row] += totalInodesOf(node);
+        }
+    }
+
+    // Turns a recovered entry into a tombstone and drops tombstones from the front of the bin
+    void binRelease(size_t index) {
+        BinEntry& entry = bin.at(index);
+        entry.node = NONE;
+        entry.path = std::string();
+        --binLive;
+        while (!bin.isEmpty() && bin.front_element().node == NONE) {
+            bin.dequeue();
+        }
+    }
+
+public:
+    // Constructor: the root and the same demo entries as FileSystem
+    explicit CompactFileSystem(std::ostream& output = std::cout) : out(output) {
+        allocate("/", true, 0, 0);
+        uint32_t file1 = allocate("file1.txt", false, 200, FileSystem::localDate(2023, 3, 1));
+        uint32_t file2 = allocate("file2.txt", false, 200, FileSystem::localDate(2023, 3, 2));
+        uint32_t dir1 = allocate("dir1", true, 0, 0);
+        for (uint32_t child : {file1, file2, dir1}) {
+            linkChild(ROOT, child);
+            adjustTotals(ROOT, totalSizeOf(child), 1, true);
+        }
+    }
+
+    // Disable copy construction and assignment for simplicity
+    CompactFileSystem(const CompactFileSystem&) = delete;
+    CompactFileSystem& operator=(const CompactFileSystem&) = delete;
+
+    // Recomputes every directory total and compares it with the maintained values
+    // Children are summed before their parents by walking a pre-order list backwards
+    bool verify() {
+        Vector<uint32_t> order;
+        order.push_back(ROOT);
+        for (size_t i = 0; i < order.size(); ++i) {
+            if (isDirectory(order[i])) {
+                forChildren(order[i], [&](uint32_t child) { order.push_back(child); });
+            }
+        }
+        Vector<uint64_t> bytes(totalSizes.size());
+        Vector<uint32_t> inodes(totalSizes.size());
+        for (size_t i = 0; i < totalSizes.size(); ++i) {
+            bytes.push_back(0);
+            inodes.push_back(0);
+        }
+        bool ok = true;
+        for (size_t i = order.size(); i-- > 0;) {
+            uint32_t node = order[i];
+            uint64_t nodeBytes = sizes[node];
+            uint32_t nodeInodes = 1;
+            if (isDirectory(node)) {
+                uint32_t row = dirRows[node];
+                nodeBytes += bytes[row];
+                nodeInodes += inodes[row];
+                if (nodeBytes != totalSizes[row] || nodeInodes != totalInodes[row]) {
+                    out << "Totals mismatch at '" << constructPath(node) << "': maintained "
+                        << totalSizes[row] << " bytes/" << totalInodes[row] << " inodes, recomputed "
+                        << nodeBytes << " bytes/" << nodeInodes << " inodes" << '\n';
+                    ok = false;
+                }
+            }
+            if (node != ROOT) {
+                bytes[dirRows[parents[node]]] += nodeBytes;
+                inodes[dirRows[parents[node]]] += nodeInodes;
+            }
+        }
+        return ok;
+    }
+
+    // help method - displays help information
+    void help(CompactSession& session) const {
+        FileSystem::printHelp(session.out);
+        session.out << "This is the compact engine: find, du, save, checkpoint, snapshot, write and read are not available.\n";
+    }
+
+    // pwd method - returns the current path as a string
+    std::string pwd(CompactSession& session) const {
+        return constructPath(session.currentInode);
+    }
+
+    // ls method - lists the current directory, largest first (only the `limit` largest if given)
+    // There is no maintained size order here; the children are sorted when they are listed
+    void ls(CompactSession& session, size_t limit = static_cast<size_t>(-1)) {
+        uint32_t dir = session.currentInode;
+        if (childCounts[dirRows[dir]] == 0) {
+            session.out << "Directory is empty" << '\n';
+            return;
+        }
+        Vector<uint32_t> children(childCounts[dirRows[dir]]);
+        forChildren(dir, [&](uint32_t child) { children.push_back(child); });
+        // Larger total size first; equal sizes by name, as in FileSystem
+        auto before = [this](uint32_t a, uint32_t b) {
+            uint64_t sizeA = totalSizeOf(a), sizeB = totalSizeOf(b);
+            return sizeA != sizeB ? sizeA > sizeB : nameOf(a) < nameOf(b);
+        };
+        size_t shown = std::min(limit, children.size());
+        std::partial_sort(children.begin(), children.begin() + shown, children.end(), before);
+        for (size_t i = 0; i < shown; ++i) {
+            uint32_t child = children[i];
+            session.out << (isDirectory(child) ? "dir" : "file") << "\t" << nameOf(child) << "\t"
+                        << totalSizeOf(child) << "\t";
+            if (mtimes[child] != 0) {
+                session.out << session.timeFormatter.format(mtimes[child]);
+            }
+            session.out << '\n';
+        }
+    }
+
+    // Method to create a new directory
+    void mkdir(CompactSession& session, const std::string& folderName) {
+        create(session, folderName, true, 10); // Default size for a directory is 10
+    }
+
+    // Method to create a new file
+    void touch(CompactSession& session, const std::string& filename, size_t size) {
+        create(session, filename, false, size);
+    }
+
+    // Method to change the current directory
+    void cd(CompactSession& session, const std::string& path) {
+        if (path.empty() || path == "/") {
+            session.previousInode = session.currentInode;
+            session.currentInode = ROOT;
+            return;
+        }
+        if (path == "-") {
+            if (session.previousInode != NONE && attached(session.previousInode)) {
+                session.currentInode = session.previousInode;
+            }
+            return;
+        }
+        if (path == "..") {
+            if (session.currentInode != ROOT) {
+                session.previousInode = session.currentInode;
+                session.currentInode = parents[session.currentInode];
+            }
+            return;
+        }
+        std::string_view missing;
+        uint32_t target = resolvePath(session.currentInode, path, &missing);
+        if (target == NONE) {
+            session.out << "Directory not found: " << missing << '\n';
+            return;
+        }
+        session.previousInode = session.currentInode;
+        session.currentInode = target;
+    }
+
+    // Method to remove a file or directory; the subtree stays in its rows until emptybin
+    void rm(CompactSession& session, const std::string& name) {
+        uint32_t dir = session.currentInode;
+        uint32_t node = findChild(dir, name);
+        if (node == NONE) {
+            session.out << "Error: File or directory '" << name << "' not found." << '\n';
+            return;
+        }
+        unlinkChild(node);
+        adjustTotals(dir, totalSizeOf(node), totalInodesOf(node), false);
+        flags[node] |= DETACHED;
+
+        std::string path = constructPath(dir);
+        if (path != "/") {
+            path += '/';
+        }
+        path += name;
+        BinEntry entry;
+        entry.node = node;
+        entry.parent = dir;
+        entry.path = std::move(path);
+        bin.enqueue(std::move(entry));
+        ++binLive;
+        session.out << "Removed '" << name << "'." << '\n';
+    }
+
+    // Removes several entries; unlinking is O(1) here, so this is just the loop
+    void rm(CompactSession& session, const Vector<std::string>& names) {
+        for (const std::string& name : names) {
+            rm(session, name);
+        }
+    }
+
+    // Returns the total size of a child of the current directory
+    size_t size(CompactSession& session, const std::string& name) {
+        uint32_t child = findChild(session.currentInode, name);
+        if (child != NONE) {
+            return totalSizeOf(child);
+        }
+        session.out << "Error: No file or folder named '" << name << "' found." << '\n';
+        return 0;
+    }
+
+    // This method displays the oldest inode in the bin
+    void showbin(CompactSession& session) {
+        if (binLive == 0) {
+            session.out << "Bin is empty." << '\n';
+        } else {
+            const BinEntry& oldest = bin.front_element();
+            session.out << "Oldest inode in the bin: " << nameOf(oldest.node) << '\n';
+            session.out << "Path: " << oldest.path << '\n';
+            session.out << "Entries in the bin: " << binLive << '\n';
+        }
+    }
+
+    // Recovers the oldest entry, or the newest one removed under a name or from a path
+    // The bin is not indexed here, so a name or path is found by scanning it newest first
+    void recover(CompactSession& session, const std::string& target = "") {
+        if (binLive == 0) {
+            session.out << "Error: Bin is empty." << '\n';
+            return;
+        }
+        size_t index = 0;
+        if (!target.empty()) {
+            bool isPath = target.find('/') != std::string::npos;
+            std::string key = target;
+            if (isPath) {
+                // Original paths are stored in canonical form: absolute, no '.', '..' or empty components
+                std::string absolute = target[0] == '/' ? target : constructPath(session.currentInode) + "/" + target;
+                Vector<std::string_view> parts;
+                PathTokenizer tokens(absolute);
+                std::string_view token;
+                while (tokens.next(token)) {
+                    if (token == "..") {
+                        if (!parts.empty()) parts.pop_back();
+                    } else if (token != ".") {
+                        parts.push_back(token);
+                    }
+                }
+                key.clear();
+                for (std::string_view part : parts) {
+                    key += '/';
+                    key.append(part.data(), part.size());
+                }
+            }
+            index = bin.getSize();
+            for (size_t i = bin.getSize(); i-- > 0;) {
+                const BinEntry& entry = bin.at(i);
+                if (entry.node != NONE && (isPath ? entry.path == key : nameOf(entry.node) == key)) {
+                    index = i;
+                    break;
+                }
+            }
+            if (index == bin.getSize()) {
+                session.out << "Error: '" << target << "' is not in the bin." << '\n';
+                return;
+            }
+        }
+        BinEntry& entry = bin.at(index);
+        uint32_t node = entry.node;
+        std::string name(nameOf(node));
+        if (entry.parent == NONE) {
+            session.out << "Error: The original location of '" << name << "' is unknown." << '\n';
+            return;
+        }
+        if (!attached(entry.parent)) {
+            session.out << "Error: The original folder of '" << name << "' is in the bin; recover it first." << '\n';
+            return;
+        }
+        if (findChild(entry.parent, name) != NONE) {
+            session.out << "Error: '" << name << "' already exists in its original location." << '\n';
+            return;
+        }
+        flags[node] &= ~DETACHED;
+        linkChild(entry.parent, node);
+        adjustTotals(entry.parent, totalSizeOf(node), totalInodesOf(node), true);
+        binRelease(index);
+        session.out << "Recovered '" << name << "' to its original location." << '\n';
+    }
+
+    // Method to move a file to a folder in the current directory
+    void mv(CompactSession& session, const std::string& filename, const std::string& foldername) {
+        uint32_t dir = session.currentInode;
+        uint32_t file = findChild(dir, filename);
+        uint32_t folder = findChild(dir, foldername);
+        if (file == NONE || isDirectory(file)) {
+            session.out << "Error: File '" << filename << "' not found." << '\n';
+            return;
+        }
+        if (folder == NONE || !isDirectory(folder)) {
+            session.out << "Error: Folder '" << foldername << "' not found." << '\n';
+            return;
+        }
+        if (findChild(folder, filename) != NONE) {
+            session.out << "Error: '" << filename << "' already exists in '" << foldername << "'." << '\n';
+            return;
+        }
+        unlinkChild(file);
+        adjustTotals(dir, sizes[file], 1, false);
+        linkChild(folder, file);
+        adjustTotals(folder, sizes[file], 1, true);
+        session.out << "Successfully moved '" << filename << "' to '" << foldername << "'." << '\n';
+    }
+
+    // This method is used to empty the bin; the rows go back on the free lists
+    bool emptybin(CompactSession& session) {
+        if (session.previousInode != NONE && !attached(session.previousInode)) {
+            session.previousInode = NONE;
+        }
+        for (size_t i = 0; i < bin.getSize(); ++i) {
+            if (bin.at(i).node != NONE) {
+                freeSubtree(bin.at(i).node);
+            }
+        }
+        bin.clear();
+        binLive = 0;
+        if (deadNameBytes * 2 > namePool.size()) {
+            compactNames();
+        }
+        return true;
+    }
+
+    // stats method - prints the table sizes and the memory they take
+    void stats(CompactSession& session, bool json = false) {
+        size_t rows = flags.capacity();
+        size_t columnBytes = rows * (sizeof(uint8_t) + 2 * sizeof(uint64_t) + 5 * sizeof(uint32_t)) +
+                             totalSizes.capacity() * (sizeof(uint64_t) + 3 * sizeof(uint32_t));
+        size_t tableBytes = slots.capacity() * sizeof(uint32_t);
+        size_t total = columnBytes + namePool.capacity() + tableBytes;
+        size_t perInode = liveInodes > 0 ? total / liveInodes : 0;
+        if (json) {
+            session.out << "{\"engine\":\"compact\",\"inodes\":" << liveInodes << ",\"directories\":" << liveDirs
+                        << ",\"free_rows\":" << flags.size() - liveInodes << ",\"bin_entries\":" << binLive
+                        << ",\"column_bytes\":" << columnBytes << ",\"name_pool_bytes\":" << namePool.size()
+                        << ",\"dead_name_bytes\":" << deadNameBytes << ",\"child_table_bytes\":" << tableBytes
+                        << ",\"bytes_per_inode\":" << perInode << "}" << '\n';
+            return;
+        }
+        session.out << "Compact inode table:\n";
+        session.out << "  inodes:        " << liveInodes << " (" << liveDirs << " directories, tree and bin)\n";
+        session.out << "  free rows:     " << flags.size() - liveInodes << "\n";
+        session.out << "  bin entries:   " << binLive << "\n";
+        session.out << "  columns:       " << columnBytes / 1024 << " KiB\n";
+        session.out << "  name pool:     " << namePool.size() / 1024 << " KiB (" << deadNameBytes / 1024 << " KiB freed)\n";
+        session.out << "  child table:   " << tableBytes / 1024 << " KiB\n";
+        session.out << "  per inode:     " << perInode << " bytes" << '\n';
+    }
+
+    // load method - replaces the tree with the contents of an image saved by the default engine
+    // Unlike FileSystem::load the whole image is copied into the columns at once and unmapped
+    // again, so no page of it stays in memory. File contents are not kept, only their sizes.
+    bool load(CompactSession& session, const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            session.out << "Error: Cannot open image '" << path << "'." << '\n';
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(ImageHeader)) {
+            close(fd);
+            session.out << "Error: '" << path << "' is not an image." << '\n';
+            return false;
+        }
+        size_t length = info.st_size;
+        void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            session.out << "Error: Cannot map image '" << path << "'." << '\n';
+            return false;
+        }
+        const char* base = static_cast<const char*>(mapping);
+        if (!validImage(base, length)) {
+            munmap(mapping, length);
+            session.out << "Error: '" << path << "' is not a valid image." << '\n';
+            return false;
+        }
+        const ImageHeader* header = reinterpret_cast<const ImageHeader*>(base);
+        const ImageInode* records = reinterpret_cast<const ImageInode*>(base + sizeof(ImageHeader));
+        const ImageBinEntry* binRecords = reinterpret_cast<const ImageBinEntry*>(records + header->inodeCount);
+        const char* pool = reinterpret_cast<const char*>(binRecords + header->binCount);
+        size_t count = header->inodeCount;
+        // The records are read front to back, once
+        madvise(mapping, length, MADV_SEQUENTIAL);
+
+        reset(count);
+        size_t capacity = 16;
+        while (capacity * 3 < (count + 1) * 4) {
+            capacity *= 2;
+        }
+        rehash(capacity); // Sized once for the whole image
+        allocate("/", true, records[0].size, 0);
+        buildFromImage(session, ROOT, 0, records, count, pool, header->poolBytes);
+
+        // Bin entries, oldest first, then their original parents: a directory in the tree, or one
+        // inside another entry if the parent was removed after it
+        Vector<uint32_t> removed(header->binCount);
+        for (size_t i = 1; i <= header->binCount; ++i) {
+            const ImageInode& record = records[i];
+            uint32_t top = NONE;
+            if (validImageRecord(record, header->poolBytes) && binRecords[i - 1].parentBase < header->binCount + 2) {
+                top = allocate(std::string_view(pool + record.nameOffset, record.nameLength), record.type == 1,
+                               record.size, record.mtime);
+                flags[top] |= DETACHED;
+                buildFromImage(session, top, i, records, count, pool, header->poolBytes);
+            }
+            removed.push_back(top);
+        }
+        for (size_t i = 0; i < removed.size(); ++i) {
+            const ImageBinEntry& entry = binRecords[i];
+            if (removed[i] == NONE) {
+                session.out << "Error: Image record " << i + 1 << " is corrupt; bin entry dropped." << '\n';
+                continue;
+            }
+            std::string_view parentPath(pool + entry.parentOffset, entry.parentLength);
+            std::string_view missing;
+            uint32_t parent = NONE;
+            if (entry.parentBase == 1 && !parentPath.empty() && parentPath[0] == '/') {
+                parent = resolvePath(ROOT, parentPath, &missing);
+            } else if (entry.parentBase > 1 && entry.parentBase - 2 != i && removed[entry.parentBase - 2] != NONE &&
+                       (parentPath.empty() || parentPath[0] != '/')) {
+                parent = resolvePath(removed[entry.parentBase - 2], parentPath, &missing);
+            }
+            parents[removed[i]] = parent;
+            BinEntry binEntry;
+            binEntry.node = removed[i];
+            binEntry.parent = parent;
+            binEntry.path = std::string(pool + entry.pathOffset, entry.pathLength);
+            bin.enqueue(std::move(binEntry));
+            ++binLive;
+        }
+        munmap(mapping, length);
+
+        session.currentInode = ROOT;
+        session.previousInode = NONE;
+        session.out << "Loaded " << count << " inodes from '" << path << "'." << '\n';
+        return true;
+    }
+
+    // Commands that need the pointer-based engine
+    size_t find(CompactSession& session, const std::string&) { return unavailable(session, "find"), 0; }
+    void du(CompactSession& session, const std::string&, size_t) { unavailable(session, "du"); }
+    bool save(CompactSession& session, const std::string&) { return unavailable(session, "save"); }
+    bool checkpoint(CompactSession& session) { return unavailable(session, "checkpoint"); }
+    void snapshot(CompactSession& session, SnapshotOp, const std::string&) { unavailable(session, "snapshot"); }
+    void write(CompactSession& session, const std::string&, size_t, std::string_view) { unavailable(session, "write"); }
+    void read(CompactSession& session, const std::string&, size_t, size_t) { unavailable(session, "read"); }
+    void syncJournal(CompactSession&) {}
+    long long syncDelay() { return -1; }
+
+    // exit method - handles exiting the program
+    void exit(CompactSession& session) const {
+        session.out << "Exiting the Virtual File System. Goodbye!\n";
+    }
+
+private:
+    // Reports a command the compact engine does not have, returns false
+    static bool unavailable(CompactSession& session, const char* command) {
+        session.out << "Error: '" << command << "' is not available in the compact engine." << '\n';
+        return false;
+    }
+};
+
+inline CompactSession::CompactSession(CompactFileSystem&, std::ostream& output)
+    : out(output), currentInode(CompactFileSystem::ROOT), previousInode(CompactFileSystem::NONE) {}
+
+//====================================================
+// Command shell: input, output and command dispatch shared by the interactive and batch modes
+//====================================================
+
+// Reads a file descriptor in large blocks and hands out lines as views into the block
+// A line stays valid until the next call to next()
+class LineReader {
+private:
+    int fd;                 // Source file descriptor
+    char* buffer;           // Input block
+    size_t capacity;        // Size of the input block (grows for lines longer than the block)
+    size_t begin;           // Start of the unconsumed input
+    size_t end;             // End of the input read so far
+    bool eof;               // True once the descriptor has no more data
+
+public:
+    explicit LineReader(int fd, size_t capacity = 1 << 20)
+        : fd(fd), buffer(new char[capacity]), capacity(capacity), begin(0), end(0), eof(false) {}
+
+    ~LineReader() { delete[] buffer; }
+
+    // True if next() can return without reading the descriptor
+    bool buffered() const {
+        return eof || std::memchr(buffer + begin, '\n', end - begin) != nullptr;
+    }
+
+    // Stores the next line (without its line ending) in `line`, returns false at end of input
+    bool next(std::string_view& line) {
+        while (true) {
+            const char* newline = static_cast<const char*>(std::memchr(buffer + begin, '\n', end - begin));
+            if (newline != nullptr || (eof && begin < end)) {
+                size_t stop = newline != nullptr ? newline - buffer : end;
+                line = std::string_view(buffer + begin, stop - begin);
+                if (!line.empty() && line.back() == '\r') {
+                    line.remove_suffix(1);
+                }
+                begin = newline != nullptr ? stop + 1 : end;
+                return true;
+            }
+            if (eof) {
+                return false;
+            }
+
+            // Keep the partial line at the front of the block, growing it if the line fills it
+            std::memmove(buffer, buffer + begin, end - begin);
+            end -= begin;
+            begin = 0;
+            if (end == capacity) {
+                char* grown = new char[capacity * 2];
+                std::memcpy(grown, buffer, end);
+                delete[] buffer;
+                buffer = grown;
+                capacity *= 2;
+            }
+
+            ssize_t bytes = read(fd, buffer + end, capacity - end);
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes <= 0) {
+                eof = true;
+            } else {
+                end += bytes;
+            }
+        }
+    }
+
+    // Disable copy construction and assignment for simplicity
+    LineReader(const LineReader&) = delete;
+    LineReader& operator=(const LineReader&) = delete;
+};
+
+// Splits a command line into whitespace-separated arguments without copying them
+class ArgTokenizer {
+private:
+    std::string_view rest;  // Part of the line not consumed yet
+
+    static bool isSpace(char c) { return c == ' ' || c == '\t'; }
+
+public:
+    explicit ArgTokenizer(std::string_view line) : rest(line) {}
+
+    // Returns the rest of the line after its leading blanks, blanks inside it included
+    std::string_view remainder() {
+        while (!rest.empty() && isSpace(rest.front())) {
+            rest.remove_prefix(1);
+        }
+        std::string_view all = rest;
+        rest = {};
+        return all;
+    }
+
+    // Returns the next argument, or an empty view once the line is exhausted
+    std::string_view next() {
+        while (!rest.empty() && isSpace(rest.front())) {
+            rest.remove_prefix(1);
+        }
+        size_t length = 0;
+        while (length < rest.size() && !isSpace(rest[length])) {
+            ++length;
+        }
+        std::string_view arg = rest.substr(0, length);
+        rest.remove_prefix(length);
+        return arg;
+    }
+};
+
+// Parses a non-negative decimal number, returns false if the argument is not one
+inline bool parseSize(std::string_view arg, size_t& value) {
+    if (arg.empty()) {
+        return false;
+    }
+    auto result = std::from_chars(arg.data(), arg.data() + arg.size(), value);
+    return result.ec == std::errc() && result.ptr == arg.data() + arg.size();
+}
+
+// Reads a whole host file (the data of 'write @file'), returns false if it cannot be read
+inline bool readHostFile(const std::string& path, std::string& contents) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        contents.reserve(static_cast<size_t>(info.st_size));
+    }
+    char buffer[1 << 16];
+    ssize_t got;
+    while ((got = ::read(fd, buffer, sizeof(buffer))) != 0) {
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return false;
+        }
+        contents.append(buffer, static_cast<size_t>(got));
+    }
+    close(fd);
+    return true;
+}
+
+// Shell commands, in the order of SHELL_VERBS
+enum class Verb : uint8_t {
+    Help, Pwd, Ls, Mkdir, Touch, Cd, Rm, Size, Find, Du, Showbin, Recover, Mv, Emptybin,
+    Save, Load, Checkpoint, Snapshot, Write, Read, Stats, Exit,
+    Unknown  // Not a command (also the value of an empty dispatch slot)
+};
+
+// Name of each shell command, indexed by Verb
+constexpr std::string_view SHELL_VERBS[] = {
+    "help", "pwd", "ls", "mkdir", "touch", "cd", "rm", "size", "find", "du", "showbin", "recover", "mv", "emptybin",
+    "save", "load", "checkpoint", "snapshot", "write", "read", "stats", "exit",
+};
+static_assert(std::size(SHELL_VERBS) == static_cast<size_t>(Verb::Unknown), "SHELL_VERBS must list every Verb");
+
+// The dispatch table has 2^VERB_SLOT_BITS slots
+constexpr unsigned VERB_SLOT_BITS = 6;
+constexpr size_t VERB_SLOTS = size_t(1) << VERB_SLOT_BITS;
+
+// Seeded FNV-1a hash of a command name
+constexpr uint32_t verbHash(std::string_view word, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (char c : word) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+    }
+    return hash;
+}
+
+// Slot of a command name: the top bits of its hash, which depend on every bit of the seed
+constexpr size_t verbSlot(std::string_view word, uint32_t seed) {
+    return verbHash(word, seed) >> (32 - VERB_SLOT_BITS);
+}
+
+// Returns the first seed that puts every command in a slot of its own, searched at compile time
+constexpr uint32_t findVerbSeed() {
+    for (uint32_t seed = 0;; ++seed) {
+        bool taken[VERB_SLOTS] = {};
+        bool collision = false;
+        for (std::string_view verb : SHELL_VERBS) {
+            size_t slot = verbSlot(verb, seed);
+            collision = collision || taken[slot];
+            taken[slot] = true;
+        }
+        if (!collision) {
+            return seed;
+        }
+    }
+}
+
+constexpr uint32_t VERB_SEED = findVerbSeed();
+
+// Perfect hash table from command name to Verb, built at compile time
+struct VerbTable {
+    Verb slots[VERB_SLOTS];
+};
+
+constexpr VerbTable buildVerbTable() {
+    VerbTable table{};
+    for (size_t slot = 0; slot < VERB_SLOTS; ++slot) {
+        table.slots[slot] = Verb::Unknown;
+    }
+    for (size_t verb = 0; verb < std::size(SHELL_VERBS); ++verb) {
+        table.slots[verbSlot(SHELL_VERBS[verb], VERB_SEED)] = static_cast<Verb>(verb);
+    }
+    return table;
+}
+
+constexpr VerbTable VERB_TABLE = buildVerbTable();
+
+// Maps a command name to its Verb with one hash, one probe and one comparison
+constexpr Verb lookupVerb(std::string_view word) {
+    Verb verb = VERB_TABLE.slots[verbSlot(word, VERB_SEED)];
+    return verb != Verb::Unknown && SHELL_VERBS[static_cast<size_t>(verb)] == word ? verb : Verb::Unknown;
+}
+static_assert(lookupVerb("checkpoint") == Verb::Checkpoint && lookupVerb("exit") == Verb::Exit &&
+              lookupVerb("exi") == Verb::Unknown, "command dispatch table is inconsistent");
+
+// Executes one command line against the file system, in the given session
+// Works with either engine (FileSystem and Session, or CompactFileSystem and CompactSession)
+// Returns false when the command was 'exit'
+template <typename Vfs, typename Cursor>
+bool runCommand(Vfs& vfs, Cursor& session, std::string_view line) {
+    std::ostream& out = session.output();
+    ArgTokenizer args(line);
+    std::string_view command = args.next();
+
+    // Blank lines are ignored
+    if (command.empty()) {
+        return true;
+    }
+
+    try {
+        switch (lookupVerb(command)) {
+        // If the command is 'help', call the help function
+        case Verb::Help:
+            vfs.help(session);
+            break;
+        // If the command is 'pwd', print the current path
+        case Verb::Pwd:
+            out << "Current path: " << vfs.pwd(session) << '\n';
+            break;
+        // If the command is 'ls', list the files in the current directory
+        case Verb::Ls: {
+            std::string_view option = args.next();
+            if (option.empty()) {
+                vfs.ls(session);
+            } else {
+                // 'ls -n <N>' lists only the N largest entries
+                size_t limit;
+                if (option == "-n" && parseSize(args.next(), limit)) {
+                    vfs.ls(session, limit);
+                } else {
+                    out << "Usage: ls [-n <count>]" << '\n';
+                }
+            }
+            break;
+        }
+        // If the command is 'mkdir', create a new directory
+        case Verb::Mkdir: {
+            std::string_view folderName = args.next();
+            if (!folderName.empty()) {
+                vfs.mkdir(session, std::string(folderName));
+            } else {
+                out << "Usage: mkdir <foldername>" << '\n';
+            }
+            break;
+        }
+        // If the command is 'touch', create a new file
+        case Verb::Touch: {
+            std::string_view filename = args.next();
+            size_t size;
+            if (!filename.empty() && parseSize(args.next(), size)) {
+                vfs.touch(session, std::string(filename), size);
+            } else {
+                out << "Usage: touch <filename> <size>" << '\n';
+            }
+            break;
+        }
+        // If the command is 'cd', change the current directory
+        case Verb::Cd:
+            vfs.cd(session, std::string(args.next()));
+            break;
+        // If the command is 'rm', remove files or directories ('rm a b c' removes all three)
+        case Verb::Rm: {
+            Vector<std::string> names;
+            for (std::string_view name = args.next(); !name.empty(); name = args.next()) {
+                names.push_back(std::string(name));
+            }
+            if (names.empty()) {
+                names.push_back(std::string()); // Reported as not found, like any other missing name
+            }
+            vfs.rm(session, names);
+            break;
+        }
+        // If the command is 'size', print the size of a file or directory
+        case Verb::Size: {
+            std::string name(args.next());
+            size_t size = vfs.size(session, name);
+            out << "Size of '" << name << "': " << size << " bytes\n";
+            break;
+        }
+        // If the command is 'find', list the inodes whose name matches a pattern
+        case Verb::Find: {
+            std::string_view pattern = args.next();
+            if (!pattern.empty()) {
+                vfs.find(session, std::string(pattern));
+            } else {
+                out << "Usage: find <pattern>" << '\n';
+            }
+            break;
+        }
+        // If the command is 'du', recount the folders under a path
+        case Verb::Du: {
+            // 'du -j <N> [path]' spreads the walk over N threads
+            std::string_view arg = args.next();
+            size_t threads = 1;
+            bool valid = true;
+            if (arg == "-j") {
+                valid = parseSize(args.next(), threads) && threads > 0;
+                arg = args.next();
+            }
+            if (valid) {
+                vfs.du(session, std::string(arg), threads);
+            } else {
+                out << "Usage: du [-j <threads>] [path]" << '\n';
+            }
+            break;
+        }
+        // If the command is 'showbin', show the oldest inode in the bin
+        case Verb::Showbin:
+            vfs.showbin(session);
+            break;
+        // If the command is 'recover', recover an inode from the bin (the oldest one by default)
+        case Verb::Recover:
+            vfs.recover(session, std::string(args.next()));
+            break;
+        // If the command is 'mv', move a file to a different directory
+        case Verb::Mv: {
+            std::string filename(args.next());
+            std::string foldername(args.next());
+            vfs.mv(session, filename, foldername);
+            break;
+        }
+        // If the command is 'emptybin', empty the bin
+        case Verb::Emptybin:
+            if (vfs.emptybin(session)) {
+                out << "Bin emptied successfully." << '\n';
+            }
+            break;
+        // If the command is 'save', write the tree to an image file
+        case Verb::Save: {
+            std::string_view path = args.next();
+            if (!path.empty()) {
+                vfs.save(session, std::string(path));
+            } else {
+                out << "Usage: save <file>" << '\n';
+            }
+            break;
+        }
+        // If the command is 'load', replace the tree with an image file
+        case Verb::Load: {
+            std::string_view path = args.next();
+            if (!path.empty()) {
+                vfs.load(session, std::string(path));
+            } else {
+                out << "Usage: load <file>" << '\n';
+            }
+            break;
+        }
+        // If the command is 'checkpoint', write the image and empty the journal
+        case Verb::Checkpoint:
+            vfs.checkpoint(session);
+            break;
+        // If the command is 'snapshot', take, list, delete or view a snapshot of the tree
+        case Verb::Snapshot: {
+            // 'snapshot <name>' takes one, 'snapshot' lists them, '-d <name>' deletes one and
+            // '-v [name]' views one in this session ('-v' alone returns to the live tree)
+            std::string_view arg = args.next();
+            SnapshotOp op = arg.empty() ? SnapshotOp::List : SnapshotOp::Take;
+            if (arg == "-d" || arg == "-v") {
+                op = arg == "-d" ? SnapshotOp::Drop : SnapshotOp::View;
+                arg = args.next();
+            }
+            if ((op == SnapshotOp::Drop && arg.empty()) || (!arg.empty() && arg[0] == '-')) {
+                out << "Usage: snapshot [<name> | -d <name> | -v [<name>]]" << '\n';
+            } else {
+                vfs.snapshot(session, op, std::string(arg));
+            }
+            break;
+        }
+        // If the command is 'write', store the rest of the line in a file ('@path' names a host
+        // file whose contents are written instead)
+        case Verb::Write: {
+            std::string_view filename = args.next();
+            size_t offset;
+            bool valid = !filename.empty() && parseSize(args.next(), offset);
+            std::string_view data = args.remainder();
+            if (!valid || data.empty()) {
+                out << "Usage: write <filename> <offset> <data | @hostfile>" << '\n';
+            } else if (data[0] == '@') {
+                std::string contents;
+                if (readHostFile(std::string(data.substr(1)), contents)) {
+                    vfs.write(session, std::string(filename), offset, contents);
+                } else {
+                    out << "Error: Cannot read host file '" << data.substr(1) << "'." << '\n';
+                }
+            } else {
+                vfs.write(session, std::string(filename), offset, data);
+            }
+            break;
+        }
+        // If the command is 'read', print a file's contents ('read <file> <offset> <length>' for a part)
+        case Verb::Read: {
+            std::string_view filename = args.next();
+            std::string_view first = args.next();
+            size_t offset = 0;
+            size_t length = SIZE_MAX;
+            if (!filename.empty() && (first.empty() || (parseSize(first, offset) && parseSize(args.next(), length)))) {
+                vfs.read(session, std::string(filename), offset, length);
+            } else {
+                out << "Usage: read <filename> [<offset> <length>]" << '\n';
+            }
+            break;
+        }
+        // If the command is 'stats', print the allocator counters
+        case Verb::Stats: {
+            std::string_view option = args.next();
+            if (option.empty() || option == "--json") {
+                vfs.stats(session, !option.empty());
+            } else {
+                out << "Usage: stats [--json]" << '\n';
+            }
+            break;
+        }
+        // If the command is 'exit', exit the program
+        case Verb::Exit:
+            vfs.exit(session);
+            return false;
+        // If the command is not recognized, print an error message
+        case Verb::Unknown:
+            out << command << ": command not found" << '\n';
+            break;
+        }
+    }
+    // If an exception is thrown, print the exception message
+    catch (std::exception &e) {
+        out << "Exception: " << e.what() << '\n';
+    }
+#ifdef VFS_DEBUG
+    // Debug builds cross-check every maintained total after each command
+    vfs.verify();
+#endif
+    return true;
+}
+
+
+#ifdef VFS_BENCHMARK
+//====================================================
+// Benchmarks, built instead of the interactive shell:
+//   g++ -O2 -DVFS_BENCHMARK -o vfs_bench A2_Data_Structures.cpp
+//   ./vfs_bench [options]   synthetic tree + per-command latency, JSON report
+//   ./vfs_bench --micro     directory scaling, path resolution and Vector tables
+//   ./vfs_bench --stress    concurrent sessions: throughput by thread count
+//   ./vfs_bench --du        du recount time by thread count
+//   ./vfs_bench --find      find latency by kind of pattern
+//   ./vfs_bench --compact   memory and walk time of the pointer and compact engines
+//====================================================
+
+#include <fstream>
+#include <random>
+#include <vector>
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Returns the average nanoseconds per operation between two time points
+static double nsPerOp(std::chrono::steady_clock::time_point start,
+                      std::chrono::steady_clock::time_point stop, size_t ops) {
+    return std::chrono::duration<double, std::nano>(stop - start).count() / ops;
+}
+
+// Creates and looks up N files in a single directory for growing N
+// With the hashed child index both columns should stay flat as the directory grows
+static void benchDirectoryScaling() {
+    const size_t counts[] = {1000, 10000, 100000, 500000};
+
+    std::cout << "directory scaling (ns/op)\n";
+    std::cout << "entries\tcreate\tlookup\n";
+    for (size_t n : counts) {
+        FileSystem vfs;
+        Session shell(vfs, std::cout);
+        vfs.mkdir(shell, "big");
+        vfs.cd(shell, "big");
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < n; ++i) {
+            vfs.touch(shell, "f" + std::to_string(i), i);
+        }
+        auto created = std::chrono::steady_clock::now();
+
+        size_t checksum = 0;
+        for (size_t i = 0; i < n; ++i) {
+            checksum += vfs.size(shell, "f" + std::to_string(i));
+        }
+        auto looked = std::chrono::steady_clock::now();
+
+        std::cout << n << "\t" << nsPerOp(start, created, n) << "\t" << nsPerOp(created, looked, n)
+                  << (checksum == n * (n - 1) / 2 ? "" : "\t(checksum mismatch)") << "\n";
+    }
+}
+
+// Resolves the same 20-component absolute path over and over
+// After the first walk every cd should be a single path cache probe
+static void benchPathResolution() {
+    const size_t depth = 20;
+    const size_t rounds = 1000000;
+
+    FileSystem vfs;
+    Session shell(vfs, std::cout);
+    std::string path;
+    for (size_t i = 0; i < depth; ++i) {
+        std::string name = "level" + std::to_string(i);
+        vfs.mkdir(shell, name);
+        vfs.cd(shell, name);
+        path += "/" + name;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; ++i) {
+        vfs.cd(shell, path);
+    }
+    auto stop = std::chrono::steady_clock::now();
+
+    std::cout << "\npath resolution (ns/op)\n";
+    std::cout << depth << "-component cd\t" << nsPerOp(start, stop, rounds) << "\n";
+}
+
+// Times one vector workload and returns nanoseconds per operation
+// The checksum keeps the optimizer from discarding the work
+template <typename Work>
+static double timeWorkload(size_t ops, Work work) {
+    auto start = std::chrono::steady_clock::now();
+    size_t checksum = work();
+    auto stop = std::chrono::steady_clock::now();
+    if (checksum == static_cast<size_t>(-1)) {
+        std::cout << "";
+    }
+    return nsPerOp(start, stop, ops);
+}
+
+// push_back, front insert and front erase on Vector<T> against std::vector<T>
+template <typename V, typename T, typename Make>
+static void benchVectorOps(const char* label, size_t pushes, size_t shifts, Make make) {
+    double push = timeWorkload(pushes, [&]() {
+        V v;
+        for (size_t i = 0; i < pushes; ++i) {
+            v.push_back(make(i));
+        }
+        return v.size();
+    });
+
+    double insert = timeWorkload(shifts, [&]() {
+        V v;
+        for (size_t i = 0; i < shifts; ++i) {
+            v.insert(0, make(i));
+        }
+        return v.size();
+    });
+
+    V filled;
+    for (size_t i = 0; i < shifts; ++i) {
+        filled.push_back(make(i));
+    }
+    double erase = timeWorkload(shifts, [&]() {
+        for (size_t i = 0; i < shifts; ++i) {
+            filled.erase(0);
+        }
+        return filled.size();
+    });
+
+    std::cout << label << "\t" << push << "\t" << insert << "\t" << erase << "\n";
+}
+
+// std::vector adapter exposing the index-based insert/erase used by Vector
+template <typename T>
+struct StdVector : std::vector<T> {
+    void insert(size_t index, T value) { std::vector<T>::insert(std::vector<T>::begin() + index, std::move(value)); }
+    void erase(size_t index) { std::vector<T>::erase(std::vector<T>::begin() + index); }
+};
+
+// Microbenchmarks of the Vector template against std::vector
+static void benchVector() {
+    auto makeInt = [](size_t i) { return i; };
+    auto makeString = [](size_t i) { return "entry-name-" + std::to_string(i); };
+
+    std::cout << "\nvector microbenchmarks (ns/op)\n";
+    std::cout << "container\tpush_back\tinsert@0\terase@0\n";
+    benchVectorOps<Vector<size_t>, size_t>("Vector<size_t>", 10000000, 20000, makeInt);
+    benchVectorOps<StdVector<size_t>, size_t>("std::vector<size_t>", 10000000, 20000, makeInt);
+    benchVectorOps<Vector<std::string>, std::string>("Vector<string>", 1000000, 20000, makeString);
+    benchVectorOps<StdVector<std::string>, std::string>("std::vector<string>", 1000000, 20000, makeString);
+}
+
+//====================================================
+// Benchmark suite: synthetic trees and per-command latency
+//====================================================
+
+// Allocation counters, fed by the malloc wrappers below
+static std::atomic<size_t> allocationCalls{0};
+static std::atomic<size_t> allocationBytes{0};
+
+#ifdef __GLIBC__
+// Count every heap allocation (operator new, Vector, the inode slabs) by wrapping glibc's malloc
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+
+extern "C" void* malloc(size_t size) {
+    allocationCalls.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(size, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+    allocationCalls.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(count * size, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+    allocationCalls.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(size, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+// Stream buffer that discards everything, so command output does not skew the timings
+class NullBuffer : public std::streambuf {
+protected:
+    int_type overflow(int_type ch) override { return traits_type::not_eof(ch); }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+// Shape of the synthetic tree and the size of each measured phase
+struct BenchConfig {
+    size_t inodes = 100000;         // Total inodes to create (root excluded)
+    size_t fanout = 64;             // Entries per directory
+    size_t dirsPerDir = 4;          // How many of those entries are directories
+    size_t depth = 8;               // Maximum directory depth
+    std::string sizeDist = "lognormal";  // File size distribution: fixed, uniform or lognormal
+    double sizeA = 8.0;             // fixed: size, uniform: minimum, lognormal: mu
+    double sizeB = 2.0;             // uniform: maximum, lognormal: sigma
+    size_t ops = 100000;            // Operations per measured command (ls uses ops / 100)
+    unsigned long long seed = 42;   // Random seed for the tree and the workload
+    std::string jsonPath;           // Where to write the JSON report (stdout if empty)
+    bool micro = false;             // Run the older microbenchmark tables instead
+    bool stress = false;            // Run the concurrent sessions table instead
+    bool du = false;                // Run the du scaling table instead
+    bool find = false;              // Run the find latency table instead
+    bool compact = false;           // Run the engine comparison instead
+    size_t threads = 0;             // Most threads for --stress and --du (0: hardware threads)
+};
+
+// Latency recorder: keeps a bounded reservoir of samples for the percentiles
+class LatencyRecorder {
+private:
+    static const size_t RESERVOIR = 1000000;
+    std::vector<uint64_t> samples;  // Reservoir of latencies in nanoseconds
+    size_t count = 0;               // Operations recorded
+    double totalNs = 0;             // Sum of all latencies
+    size_t allocations = 0;         // Heap allocations made during the operations
+    std::mt19937_64 rng{7};
+
+public:
+    void record(uint64_t ns) {
+        ++count;
+        totalNs += ns;
+        if (samples.size() < RESERVOIR) {
+            samples.push_back(ns);
+        } else {
+            size_t slot = rng() % count;
+            if (slot < RESERVOIR) {
+                samples[slot] = ns;
+            }
+        }
+    }
+
+    void addAllocations(size_t calls) { allocations += calls; }
+
+    // Returns the latency at a percentile (0-100) of the recorded samples
+    uint64_t percentile(double p) {
+        if (samples.empty()) {
+            return 0;
+        }
+        size_t rank = static_cast<size_t>(p / 100.0 * (samples.size() - 1));
+        std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+        return samples[rank];
+    }
+
+    // Writes the recorder as a JSON object
+    void writeJson(std::ostream& json) {
+        double seconds = totalNs / 1e9;
+        json << "{\"count\": " << count
+             << ", \"throughput_ops_s\": " << (seconds > 0 ? count / seconds : 0.0)
+             << ", \"mean_ns\": " << (count ? totalNs / count : 0.0)
+             << ", \"p50_ns\": " << percentile(50)
+             << ", \"p99_ns\": " << percentile(99)
+             << ", \"allocations_per_op\": " << (count ? static_cast<double>(allocations) / count : 0.0)
+             << "}";
+    }
+};
+
+// Times one call and records it, including the allocations it made
+template <typename Op>
+static void measure(LatencyRecorder& recorder, Op op) {
+    size_t allocsBefore = allocationCalls.load(std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    op();
+    auto stop = std::chrono::steady_clock::now();
+    recorder.record(std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count());
+    recorder.addAllocations(allocationCalls.load(std::memory_order_relaxed) - allocsBefore);
+}
+
+// Generated tree: every directory path and a sample of (directory, file) pairs
+struct GeneratedTree {
+    std::vector<std::string> dirPaths;     // Absolute path of every directory except the root
+    std::vector<std::pair<size_t, std::string>> files;  // (index into dirPaths, file name)
+    std::vector<std::pair<size_t, std::string>> subdirs; // (index into dirPaths, child directory name)
+    size_t created = 0;                    // Inodes created
+};
+
+// Draws file sizes from the configured distribution
+class SizeDistribution {
+private:
+    const BenchConfig& config;
+    std::mt19937_64& rng;
+
+public:
+    SizeDistribution(const BenchConfig& config, std::mt19937_64& rng) : config(config), rng(rng) {}
+
+    size_t next() {
+        if (config.sizeDist == "fixed") {
+            return static_cast<size_t>(config.sizeA);
+        }
+        if (config.sizeDist == "uniform") {
+            std::uniform_int_distribution<size_t> dist(static_cast<size_t>(config.sizeA), static_cast<size_t>(config.sizeB));
+            return dist(rng);
+        }
+        std::lognormal_distribution<double> dist(config.sizeA, config.sizeB);
+        return static_cast<size_t>(dist(rng));
+    }
+};
+
+// Builds the tree breadth-first through the public commands, timing each mkdir and touch
+// Works with either engine, so both can be given the same tree
+template <typename Vfs, typename Cursor>
+static GeneratedTree generateTree(Vfs& vfs, Cursor& shell, const BenchConfig& config, std::mt19937_64& rng,
+                                  LatencyRecorder& mkdirLatency, LatencyRecorder& touchLatency) {
+    GeneratedTree tree;
+    SizeDistribution sizes(config, rng);
+
+    // Work list of (path, depth) of directories still to fill, consumed front to back
+    std::vector<std::pair<std::string, size_t>> pending;
+    pending.emplace_back("/", 0);
+
+    for (size_t next = 0; next < pending.size() && tree.created < config.inodes; ++next) {
+        std::string path = pending[next].first;
+        size_t depth = pending[next].second;
+        // pending[k] was queued together with dirPaths[k - 1]; the root has no dirPaths entry
+        size_t dirIndex = next == 0 ? static_cast<size_t>(-1) : next - 1;
+        vfs.cd(shell, path);
+
+        std::string prefix = path == "/" ? "/" : path + "/";
+        for (size_t i = 0; i < config.fanout && tree.created < config.inodes; ++i) {
+            if (i < config.dirsPerDir && depth < config.depth) {
+                std::string name = "d" + std::to_string(tree.created);
+                measure(mkdirLatency, [&]() { vfs.mkdir(shell, name); });
+                tree.dirPaths.push_back(prefix + name);
+                pending.emplace_back(prefix + name, depth + 1);
+                if (dirIndex != static_cast<size_t>(-1)) {
+                    tree.subdirs.emplace_back(dirIndex, name);
+                }
+            } else {
+                std::string name = "f" + std::to_string(tree.created);
+                size_t size = sizes.next();
+                measure(touchLatency, [&]() { vfs.touch(shell, name, size); });
+                if (dirIndex != static_cast<size_t>(-1)) {
+                    tree.files.emplace_back(dirIndex, name);
+                }
+            }
+            ++tree.created;
+        }
+    }
+    vfs.cd(shell, "/");
+    return tree;
+}
+
+// Returns the peak resident set size of the process in KiB
+static long peakRssKiB() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Builds a tree and measures every command against it, then writes a JSON report
+static void runSuite(const BenchConfig& config) {
+    std::mt19937_64 rng(config.seed);
+    NullBuffer discard;
+    std::ostream quiet(&discard);
+    FileSystem vfs(quiet);
+    Session shell(vfs, quiet);
+
+    LatencyRecorder mkdirLatency, touchLatency, lsLatency, cdLatency, sizeLatency;
+    LatencyRecorder rmLatency, recoverLatency, mvLatency, emptybinLatency;
+
+    auto buildStart = std::chrono::steady_clock::now();
+    size_t allocsBefore = allocationCalls.load();
+    GeneratedTree tree = generateTree(vfs, shell, config, rng, mkdirLatency, touchLatency);
+    double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count();
+    size_t buildAllocs = allocationCalls.load() - allocsBefore;
+
+    // Round-trip the freshly built tree through an image file
+    std::string imagePath = "/tmp/vfs_bench_image." + std::to_string(getpid());
+    auto saveStart = std::chrono::steady_clock::now();
+    vfs.save(shell, imagePath);
+    auto saveStop = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point loadStop, expandStop;
+    {
+        // Load into a fresh instance, as a process starting with --image would
+        FileSystem loaded(quiet);
+        Session loadedShell(loaded, quiet);
+        loaded.load(loadedShell, imagePath);
+        loadStop = std::chrono::steady_clock::now();
+        // Directories are built on first use; verify() visits (and so builds) all of them
+        loaded.verify();
+        expandStop = std::chrono::steady_clock::now();
+    }
+    struct stat imageInfo = {};
+    stat(imagePath.c_str(), &imageInfo);
+    unlink(imagePath.c_str());
+    double saveSeconds = std::chrono::duration<double>(saveStop - saveStart).count();
+    double loadSeconds = std::chrono::duration<double>(loadStop - saveStop).count();
+    double expandSeconds = std::chrono::duration<double>(expandStop - loadStop).count();
+
+    auto pick = [&rng](size_t count) { return static_cast<size_t>(rng() % count); };
+
+    if (!tree.dirPaths.empty()) {
+        // cd to random absolute directory paths
+        for (size_t i = 0; i < config.ops; ++i) {
+            const std::string& path = tree.dirPaths[pick(tree.dirPaths.size())];
+            measure(cdLatency, [&]() { vfs.cd(shell, path); });
+        }
+
+        // ls in random directories (fewer rounds, each lists a whole directory)
+        size_t lsOps = config.ops / 100 > 0 ? config.ops / 100 : 1;
+        for (size_t i = 0; i < lsOps; ++i) {
+            vfs.cd(shell, tree.dirPaths[pick(tree.dirPaths.size())]);
+            measure(lsLatency, [&]() { vfs.ls(shell); });
+        }
+    }
+
+    if (!tree.files.empty()) {
+        // size of random files
+        for (size_t i = 0; i < config.ops; ++i) {
+            const auto& file = tree.files[pick(tree.files.size())];
+            vfs.cd(shell, tree.dirPaths[file.first]);
+            measure(sizeLatency, [&]() { vfs.size(shell, file.second); });
+        }
+
+        // rm followed by recover, so the tree keeps its shape
+        for (size_t i = 0; i < config.ops; ++i) {
+            const auto& file = tree.files[pick(tree.files.size())];
+            vfs.cd(shell, tree.dirPaths[file.first]);
+            measure(rmLatency, [&]() { vfs.rm(shell, file.second); });
+            measure(recoverLatency, [&]() { vfs.recover(shell); });
+        }
+    }
+
+    // mv a file into a sibling directory (each file moves at most once)
+    if (!tree.subdirs.empty()) {
+        std::vector<size_t> firstSubdir(tree.dirPaths.size(), static_cast<size_t>(-1));
+        for (size_t i = 0; i < tree.subdirs.size(); ++i) {
+            if (firstSubdir[tree.subdirs[i].first] == static_cast<size_t>(-1)) {
+                firstSubdir[tree.subdirs[i].first] = i;
+            }
+        }
+        size_t moved = 0;
+        for (size_t i = 0; i < tree.files.size() && moved < config.ops; ++i) {
+            const auto& file = tree.files[i];
+            size_t sub = firstSubdir[file.first];
+            if (sub == static_cast<size_t>(-1)) {
+                continue;
+            }
+            vfs.cd(shell, tree.dirPaths[file.first]);
+            measure(mvLatency, [&]() { vfs.mv(shell, file.second, tree.subdirs[sub].second); });
+            ++moved;
+        }
+    }
+
+    // emptybin on a bin holding whole directories
+    for (size_t i = 0; i < tree.subdirs.size() && i < config.ops; ++i) {
+        const auto& dir = tree.subdirs[tree.subdirs.size() - 1 - i];
+        vfs.cd(shell, tree.dirPaths[dir.first]);
+        vfs.rm(shell, dir.second);
+        measure(emptybinLatency, [&]() { vfs.emptybin(shell); });
+    }
+
+    // Report
+    std::ofstream file;
+    if (!config.jsonPath.empty()) {
+        file.open(config.jsonPath);
+    }
+    std::ostream& json = config.jsonPath.empty() ? std::cout : file;
+    json << "{\n";
+    json << "  \"shape\": {\"inodes\": " << config.inodes << ", \"fanout\": " << config.fanout
+         << ", \"dirs_per_dir\": " << config.dirsPerDir << ", \"depth\": " << config.depth
+         << ", \"size_dist\": \"" << config.sizeDist << "\", \"size_a\": " << config.sizeA
+         << ", \"size_b\": " << config.sizeB << ", \"seed\": " << config.seed << "},\n";
+    json << "  \"build\": {\"inodes\": " << tree.created << ", \"directories\": " << tree.dirPaths.size()
+         << ", \"seconds\": " << buildSeconds << ", \"inodes_per_s\": " << (buildSeconds > 0 ? tree.created / buildSeconds : 0.0)
+         << ", \"allocations\": " << buildAllocs << "},\n";
+    json << "  \"image\": {\"bytes\": " << imageInfo.st_size << ", \"save_s\": " << saveSeconds
+         << ", \"load_s\": " << loadSeconds << ", \"full_expand_s\": " << expandSeconds << "},\n";
+    json << "  \"operations\": {\n";
+    std::pair<const char*, LatencyRecorder*> ops[] = {
+        {"mkdir", &mkdirLatency}, {"touch", &touchLatency}, {"cd", &cdLatency}, {"ls", &lsLatency},
+        {"size", &sizeLatency}, {"rm", &rmLatency}, {"recover", &recoverLatency}, {"mv", &mvLatency},
+        {"emptybin", &emptybinLatency}};
+    size_t opCount = sizeof(ops) / sizeof(ops[0]);
+    for (size_t i = 0; i < opCount; ++i) {
+        json << "    \"" << ops[i].first << "\": ";
+        ops[i].second->writeJson(json);
+        json << (i + 1 < opCount ? ",\n" : "\n");
+    }
+    json << "  },\n";
+    json << "  \"peak_rss_kib\": " << peakRssKiB() << ",\n";
+    json << "  \"allocations\": {\"calls\": " << allocationCalls.load() << ", \"bytes\": " << allocationBytes.load() << "}\n";
+    json << "}\n";
+}
+
+// Runs `threads` sessions at once, each doing config.ops rounds on the shared tree, and returns the
+// total operations per second. A round is cd into a random directory and size of one of its
+// files; every 16th round adds an ls of the 16 largest entries, and with touchEvery > 0 every
+// touchEvery-th round also creates a file.
+static double stressRound(FileSystem& vfs, const GeneratedTree& tree, const BenchConfig& config,
+                          size_t threads, size_t touchEvery) {
+    std::atomic<size_t> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<size_t> totalOps{0};
+    std::vector<std::thread> workers;
+
+    auto work = [&](size_t id) {
+        NullBuffer discard;
+        std::ostream quiet(&discard);
+        Session session(vfs, quiet);
+        std::mt19937_64 rng(config.seed + id);
+        ++ready;
+        while (!go.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+
+        size_t ops = 0;
+        for (size_t round = 0; round < config.ops; ++round) {
+            const auto& file = tree.files[rng() % tree.files.size()];
+            vfs.cd(session, tree.dirPaths[file.first]);
+            vfs.size(session, file.second);
+            ops += 2;
+            if (round % 16 == 0) {
+                vfs.ls(session, 16);
+                ++ops;
+            }
+            if (touchEvery > 0 && round % touchEvery == 0) {
+                vfs.touch(session, "s" + std::to_string(id) + "_" + std::to_string(round), round);
+                ++ops;
+            }
+        }
+        totalOps += ops;
+    };
+
+    for (size_t id = 0; id < threads; ++id) {
+        workers.emplace_back(work, id);
+    }
+    while (ready.load() < threads) {
+        std::this_thread::yield();
+    }
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return seconds > 0 ? totalOps.load() / seconds : 0.0;
+}
+
+// Concurrent sessions on one tree: read-only and read/touch throughput as threads are added
+// Thread counts double from 1 up to --threads (default: the number of hardware threads)
+static void benchConcurrentSessions(const BenchConfig& config) {
+    std::mt19937_64 rng(config.seed);
+    NullBuffer discard;
+    std::ostream quiet(&discard);
+    FileSystem vfs(quiet);
+    GeneratedTree tree;
+    {
+        Session shell(vfs, quiet);
+        LatencyRecorder mkdirLatency, touchLatency;
+        tree = generateTree(vfs, shell, config, rng, mkdirLatency, touchLatency);
+    }
+    if (tree.files.empty()) {
+        std::cerr << "The tree has no files below the root; use more --inodes\n";
+        return;
+    }
+
+    size_t maxThreads = config.threads > 0 ? config.threads : std::thread::hardware_concurrency();
+    if (maxThreads == 0) {
+        maxThreads = 1;
+    }
+    std::cout << "concurrent sessions (ops/s, " << std::thread::hardware_concurrency() << " hardware threads)\n";
+    std::cout << "threads\tread\tspeedup\tread+touch\tspeedup\n";
+    double baseRead = 0, baseMixed = 0;
+    for (size_t threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+        double read = stressRound(vfs, tree, config, threads, 0);
+        double mixed = stressRound(vfs, tree, config, threads, 10);
+        if (threads == 1) {
+            baseRead = read;
+            baseMixed = mixed;
+        }
+        std::cout << threads << "\t" << static_cast<size_t>(read) << "\t" << read / baseRead << "\t"
+                  << static_cast<size_t>(mixed) << "\t" << mixed / baseMixed << "\n";
+        if (threads == maxThreads) {
+            break;
+        }
+    }
+}
+
+// Recounts the whole generated tree with du at thread counts doubling from 1 up to --threads
+static void benchDiskUsage(const BenchConfig& config) {
+    std::mt19937_64 rng(config.seed);
+    NullBuffer discard;
+    std::ostream quiet(&discard);
+    FileSystem vfs(quiet);
+    Session shell(vfs, quiet);
+    LatencyRecorder mkdirLatency, touchLatency;
+    GeneratedTree tree = generateTree(vfs, shell, config, rng, mkdirLatency, touchLatency);
+
+    size_t maxThreads = config.threads > 0 ? config.threads : std::thread::hardware_concurrency();
+    if (maxThreads == 0) {
+        maxThreads = 1;
+    }
+    std::cout << "du over " << tree.created << " inodes (ms, best of 3, "
+              << std::thread::hardware_concurrency() << " hardware threads)\n";
+    std::cout << "threads\tms\tspeedup\n";
+    double base = 0;
+    for (size_t threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+        double best = 0;
+        for (int run = 0; run < 3; ++run) {
+            auto start = std::chrono::steady_clock::now();
+            vfs.du(shell, "/", threads);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            best = run == 0 ? ms : std::min(best, ms);
+        }
+        if (threads == 1) {
+            base = best;
+        }
+        std::cout << threads << "\t" << best << "\t" << base / best << "\n";
+        if (threads == maxThreads) {
+            break;
+        }
+    }
+}
+
+// Times find over the generated tree: the first call, which builds the name index, then exact,
+// prefix, substring and suffix patterns, and a glob with no literal to narrow it down
+static void benchFind(const BenchConfig& config) {
+    std::mt19937_64 rng(config.seed);
+    NullBuffer discard;
+    std::ostream quiet(&discard);
+    FileSystem vfs(quiet);
+    Session shell(vfs, quiet);
+    LatencyRecorder mkdirLatency, touchLatency;
+    GeneratedTree tree = generateTree(vfs, shell, config, rng, mkdirLatency, touchLatency);
+    if (tree.files.empty()) {
+        std::cout << "No files generated\n";
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    vfs.find(shell, "");
+    std::cout << "find over " << tree.created << " inodes; index built in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms\n";
+
+    const std::string& name = tree.files[tree.files.size() / 2].second;
+    const std::string patterns[] = {
+        name,
+        name.substr(0, name.size() - 1) + "*",
+        "*" + name.substr(1, 4) + "*",
+        "*" + name.substr(name.size() - 3),
+        "d?",
+    };
+    std::cout << "pattern\tmatches\tms (best of 3)\n";
+    for (const std::string& pattern : patterns) {
+        size_t matches = 0;
+        double best = 0;
+        for (int run = 0; run < 3; ++run) {
+            start = std::chrono::steady_clock::now();
+            matches = vfs.find(shell, pattern);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            best = run == 0 ? ms : std::min(best, ms);
+        }
+        std::cout << pattern << "\t" << matches << "\t" << best << "\n";
+    }
+}
+
+// Returns the bytes currently allocated on the heap (the resident set size where malloc cannot tell)
+static size_t heapBytes() {
+#ifdef __GLIBC__
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+// Builds the generated tree on one engine and prints the build time, the heap it takes per
+// inode and the time of a full walk over it (verify, best of 3)
+template <typename Vfs, typename Cursor>
+static void compareEngine(const char* label, const BenchConfig& config) {
+    std::mt19937_64 rng(config.seed);
+    NullBuffer discard;
+    std::ostream quiet(&discard);
+    size_t heapBefore = heapBytes();
+    Vfs vfs(quiet);
+    Cursor shell(vfs, quiet);
+    size_t created;
+    double buildMs;
+    {
+        // The work lists and samples are gone before the heap is measured
+        LatencyRecorder mkdirLatency, touchLatency;
+        auto start = std::chrono::steady_clock::now();
+        GeneratedTree tree = generateTree(vfs, shell, config, rng, mkdirLatency, touchLatency);
+        buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        created = tree.created;
+    }
+    size_t heap = heapBytes() - heapBefore;
+
+    double best = 0;
+    for (int run = 0; run < 3; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        vfs.verify();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        best = run == 0 ? ms : std::min(best, ms);
+    }
+    std::cout << label << "\t" << created << "\t" << buildMs << "\t"
+              << static_cast<double>(heap) / (created + 1) << "\t" << best << "\n";
+}
+
+// Gives the same generated tree to the pointer-based and the compact engine
+static void benchCompact(const BenchConfig& config) {
+    std::cout << "engine\tinodes\tbuild ms\theap bytes/inode\tverify ms\n";
+    compareEngine<FileSystem, Session>("pointer", config);
+    compareEngine<CompactFileSystem, CompactSession>("compact", config);
+}
+
+// Parses the benchmark options, returns false on a bad option
+static bool parseBenchArgs(int argc, char* argv[], BenchConfig& config) {
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--micro") {
+            config.micro = true;
+        } else if (arg == "--stress") {
+            config.stress = true;
+        } else if (arg == "--du") {
+            config.du = true;
+        } else if (arg == "--find") {
+            config.find = true;
+        } else if (arg == "--compact") {
+            config.compact = true;
+        } else if (arg == "--threads" && hasValue) {
+            config.threads = std::stoull(argv[++i]);
+        } else if (arg == "--inodes" && hasValue) {
+            config.inodes = std::stoull(argv[++i]);
+        } else if (arg == "--fanout" && hasValue) {
+            config.fanout = std::stoull(argv[++i]);
+        } else if (arg == "--dirs-per-dir" && hasValue) {
+            config.dirsPerDir = std::stoull(argv[++i]);
+        } else if (arg == "--depth" && hasValue) {
+            config.depth = std::stoull(argv[++i]);
+        } else if (arg == "--size-dist" && i + 3 < argc) {
+            // --size-dist fixed <size> 0 | uniform <min> <max> | lognormal <mu> <sigma>
+            config.sizeDist = argv[++i];
+            config.sizeA = std::stod(argv[++i]);
+            config.sizeB = std::stod(argv[++i]);
+        } else if (arg == "--ops" && hasValue) {
+            config.ops = std::stoull(argv[++i]);
+        } else if (arg == "--seed" && hasValue) {
+            config.seed = std::stoull(argv[++i]);
+        } else if (arg == "--json" && hasValue) {
+            config.jsonPath = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    return config.sizeDist == "fixed" || config.sizeDist == "uniform" || config.sizeDist == "lognormal";
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    if (!parseBenchArgs(argc, argv, config)) {
+        std::cerr << "Usage: " << argv[0] << " [--micro | --stress | --du | --find | --compact] [--threads N] [--inodes N] [--fanout N] [--dirs-per-dir N] [--depth N]\n"
+                  << "       [--size-dist fixed|uniform|lognormal A B] [--ops N] [--seed N] [--json file]\n";
+        return EXIT_FAILURE;
+    }
+
+    if (config.micro) {
+        benchDirectoryScaling();
+        benchPathResolution();
+        benchVector();
+        return EXIT_SUCCESS;
+    }
+
+    if (config.stress) {
+        benchConcurrentSessions(config);
+        return EXIT_SUCCESS;
+    }
+    if (config.du) {
+        benchDiskUsage(config);
+        return EXIT_SUCCESS;
+    }
+    if (config.find) {
+        benchFind(config);
+        return EXIT_SUCCESS;
+    }
+    if (config.compact) {
+        benchCompact(config);
+        return EXIT_SUCCESS;
+    }
+
+    runSuite(config);
+    return EXIT_SUCCESS;
+}
+
+#else
+// Command line options shared by the interactive and batch modes
+struct ShellOptions {
+    const char* scriptPath = nullptr;   // --script <file>
+    const char* imagePath = nullptr;    // --image <file>
+    const char* journalPath = nullptr;  // --journal <file>
+    const char* blocksPath = nullptr;   // --blocks <file>
+    size_t groupOps = 64;               // --group-commit-ops <count>
+    size_t groupMs = 10;                // --group-commit-ms <milliseconds>
+    bool compact = false;               // --compact
+    bool fastExit = false;              // --fast-exit
+};
+
+// Maps the block file, loads the starting image and replays the journal on top of it
+// With a journal the image may not exist yet; it is created by the first checkpoint
+static bool openStorage(FileSystem& vfs, Session& shell, const ShellOptions& options) {
+    if (options.blocksPath != nullptr && !vfs.openBlockFile(shell, options.blocksPath)) {
+        return false;
+    }
+    bool haveImage = options.imagePath != nullptr &&
+                     (options.journalPath == nullptr || access(options.imagePath, F_OK) == 0);
+    if (haveImage && !vfs.load(shell, options.imagePath)) {
+        return false;
+    }
+    return options.journalPath == nullptr ||
+           vfs.openJournal(shell, options.journalPath, options.imagePath, options.groupOps,
+                           std::chrono::milliseconds(options.groupMs));
+}
+
+// Reads commands from the terminal until 'exit' or the end of input
+template <typename Vfs, typename Cursor>
+static void interactiveLoop(Vfs& vfs, Cursor& shell) {
+    vfs.help(shell); // Display help information at the start of the program
+
+    std::string user_input;
+    while (true) {
+        // Nothing more happens until the user types, so sync the journal now
+        vfs.syncJournal(shell);
+        std::cout << ">";
+        if (!std::getline(std::cin, user_input)) {
+            break; // End of input
+        }
+        if (!runCommand(vfs, shell, user_input)) {
+            return;
+        }
+        std::cout.flush();
+    }
+}
+
+// Runs every command line read from fd until 'exit', returns the number of commands run
+template <typename Vfs, typename Cursor>
+static size_t batchLoop(Vfs& vfs, Cursor& shell, int fd) {
+    size_t commands = 0;
+    LineReader reader(fd);
+    std::string_view line;
+    while (true) {
+        // A producer that stalls must not hold journal records back past their group commit
+        // window: if no input arrives before they are due, sync them before waiting on
+        long long delay = vfs.syncDelay();
+        if (delay >= 0 && !reader.buffered()) {
+            pollfd input = {fd, POLLIN, 0};
+            if (poll(&input, 1, static_cast<int>(std::min<long long>(delay, INT32_MAX))) == 0) {
+                vfs.syncJournal(shell);
+            }
+        }
+        if (!reader.next(line)) {
+            break;
+        }
+        if (line.find_first_not_of(" \t") == std::string_view::npos) {
+            continue; // Blank lines are not commands
+        }
+        ++commands;
+        if (!runCommand(vfs, shell, line)) {
+            break;
+        }
+    }
+    return commands;
+}
+
+int main(int argc, char* argv[]) {
+    // Batch mode runs a script (--script <file>) or whatever is piped into stdin
+    // --image <file> starts from a saved image instead of the demo tree
+    // --journal <file> logs every change and replays it on the next start (requires --image)
+    // --blocks <file> keeps file contents in a memory-mapped scratch file instead of anonymous memory
+    // --compact runs on the compact engine, from the demo tree or an --image (no journal or blocks)
+    // --fast-exit leaves the tree's memory to the operating system instead of freeing each inode
+    ShellOptions options;
+    bool valid = true;
+    for (int i = 1; valid && i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--script" && i + 1 < argc) {
+            options.scriptPath = argv[++i];
+        } else if (arg == "--image" && i + 1 < argc) {
+            options.imagePath = argv[++i];
+        } else if (arg == "--journal" && i + 1 < argc) {
+            options.journalPath = argv[++i];
+        } else if (arg == "--blocks" && i + 1 < argc) {
+            options.blocksPath = argv[++i];
+        } else if (arg == "--group-commit-ops" && i + 1 < argc) {
+            valid = parseSize(argv[++i], options.groupOps) && options.groupOps > 0;
+        } else if (arg == "--group-commit-ms" && i + 1 < argc) {
+            valid = parseSize(argv[++i], options.groupMs);
+        } else if (arg == "--compact") {
+            options.compact = true;
+        } else if (arg == "--fast-exit") {
+            options.fastExit = true;
+        } else {
+            valid = false;
+        }
+    }
+    if (!valid || (options.journalPath != nullptr && options.imagePath == nullptr) ||
+        (options.compact && (options.journalPath != nullptr || options.blocksPath != nullptr))) {
+        std::cerr << "Usage: " << argv[0] << " [--compact [--image <file>] | [--image <file> [--journal <file> [--group-commit-ops <count>]"
+                  << " [--group-commit-ms <ms>]]] [--blocks <file>]] [--fast-exit] [--script <file>]\n";
+        return EXIT_FAILURE;
+    }
+    const char* scriptPath = options.scriptPath;
+    bool batch = scriptPath != nullptr || !isatty(STDIN_FILENO);
+
+    if (!batch) {
+        if (options.compact) {
+            CompactFileSystem vfs;
+            CompactSession shell(vfs, std::cout);
+            if (options.imagePath != nullptr && !vfs.load(shell, options.imagePath)) {
+                return EXIT_FAILURE;
+            }
+            interactiveLoop(vfs, shell);
+            return EXIT_SUCCESS;
+        }
+        FileSystem vfs; // Create a FileSystem instance writing to the terminal
+        vfs.setFastExit(options.fastExit);
+        Session shell(vfs, std::cout);
+        if (!openStorage(vfs, shell, options)) {
+            return EXIT_FAILURE;
+        }
+        interactiveLoop(vfs, shell);
+        return EXIT_SUCCESS;
+    }
+
+    // Batch mode: no prompt or banner, block reads, one large output buffer
+    int fd = STDIN_FILENO;
+    if (scriptPath != nullptr) {
+        fd = open(scriptPath, O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Error: cannot open script '" << scriptPath << "'\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    size_t commands = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        OutputBuffer sink(STDOUT_FILENO);
+        std::ostream out(&sink);
+        if (options.compact) {
+            CompactFileSystem vfs(out);
+            CompactSession shell(vfs, out);
+            if (options.imagePath != nullptr && !vfs.load(shell, options.imagePath)) {
+                out.flush();
+                return EXIT_FAILURE;
+            }
+            commands = batchLoop(vfs, shell, fd);
+        } else {
+            FileSystem vfs(out);
+            vfs.setFastExit(options.fastExit);
+            Session shell(vfs, out);
+            if (!openStorage(vfs, shell, options)) {
+                out.flush();
+                return EXIT_FAILURE;
+            }
+            commands = batchLoop(vfs, shell, fd);
+        }
+        out.flush();
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (scriptPath != nullptr) {
+        close(fd);
+    }
+    std::cerr << "Executed " << commands << " commands in " << elapsed << " s ("
+              << (elapsed > 0 ? commands / elapsed : 0.0) << " commands/s)\n";
+    return EXIT_SUCCESS;
+}
+#endif
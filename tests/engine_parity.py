@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+# Engine parity test
+#   engine_parity.py <vfs binary> <scratch directory> [seeds]
+# Runs random scripts on the default engine and on the compact engine (--compact) and requires
+# byte-identical output. Timestamps are masked, since mkdir stamps the current second on each run.
+# The second half of every seed starts both engines from an image the default engine saved,
+# once with --image and once with the load command.
+import difflib
+import os
+import random
+import re
+import subprocess
+import sys
+
+NAMES = [f"n{i}" for i in range(25)] + ["a" * 200]
+
+
+def random_commands(rng, count, image=None):
+    commands = []
+    for _ in range(count):
+        r = rng.random()
+        n = rng.choice(NAMES)
+        if r < 0.28:
+            commands.append(f"touch {n} {rng.randint(0, 1000)}")
+        elif r < 0.42:
+            commands.append(f"mkdir {n}")
+        elif r < 0.55:
+            commands.append(f"cd {n}")
+        elif r < 0.58:
+            commands.append(f"cd {n}/{rng.choice(NAMES)}/../{rng.choice(NAMES)}")
+        elif r < 0.60:
+            commands.append("cd -")
+        elif r < 0.64:
+            commands.append("cd ..")
+        elif r < 0.69:
+            commands.append(f"rm {n}")
+        elif r < 0.71:
+            commands.append("rm " + " ".join(rng.choice(NAMES) for _ in range(rng.randint(2, 5))))
+        elif r < 0.74:
+            commands.append("recover")
+        elif r < 0.76:
+            commands.append(f"recover {n}")
+        elif r < 0.77:
+            commands.append(f"recover ../{n}")
+        elif r < 0.81:
+            commands.append(f"mv {n} {rng.choice(NAMES)}")
+        elif r < 0.85:
+            commands.append("ls")
+        elif r < 0.88:
+            commands.append(f"size {n}")
+        elif r < 0.895:
+            commands.append("emptybin")
+        elif r < 0.92:
+            commands.append("cd /")
+        elif r < 0.94:
+            commands.append(f"ls -n {rng.randint(1, 5)}")
+        elif r < 0.96:
+            commands.append("showbin")
+        elif r < 0.995 or image is None:
+            commands.append("pwd")
+        else:
+            commands.append(f"load {image}")
+    return commands
+
+
+def run(binary, args, commands):
+    script = "\n".join(commands + ["exit"]) + "\n"
+    result = subprocess.run([binary] + args, input=script, capture_output=True, text=True, timeout=120)
+    if result.returncode != 0:
+        raise RuntimeError(f"{binary} {' '.join(args)} exited with {result.returncode}: {result.stderr}")
+    return re.sub(r"\t[^\t\n]*\d\d:\d\d[^\t\n]*$", "", result.stdout, flags=re.M)
+
+
+def compare(label, default, compact):
+    if default == compact:
+        return True
+    print(f"{label}: engines differ")
+    diff = difflib.unified_diff(default.splitlines(True), compact.splitlines(True), "default", "compact")
+    sys.stdout.writelines(list(diff)[:40])
+    return False
+
+
+def main():
+    binary, scratch = sys.argv[1], sys.argv[2]
+    seeds = int(sys.argv[3]) if len(sys.argv) > 3 else 4
+    ok = True
+    for seed in range(1, seeds + 1):
+        rng = random.Random(seed)
+        commands = random_commands(rng, 5000)
+        ok = compare(f"seed {seed}", run(binary, [], commands), run(binary, ["--compact"], commands)) and ok
+
+        # A tree with a bin, saved by the default engine, then used by both
+        image = os.path.join(scratch, f"engine_parity_{seed}.img")
+        run(binary, [], random_commands(rng, 3000) + ["cd /", f"save {image}"])
+        commands = random_commands(rng, 3000, image)
+        ok = compare(f"seed {seed} --image", run(binary, ["--image", image], commands),
+                     run(binary, ["--compact", "--image", image], commands)) and ok
+        commands = [f"load {image}"] + commands
+        ok = compare(f"seed {seed} load", run(binary, [], commands), run(binary, ["--compact"], commands)) and ok
+        os.remove(image)
+    if not ok:
+        sys.exit(1)
+    print(f"engine parity: {seeds} seeds passed")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+# File contents model test
+#   file_contents.py <vfs binary> <scratch directory> [seeds] [writes]
+# Runs random writes over a few files, some of them touched with a size first, and keeps a byte
+# model of every file next to it. Every file must then read back as its model, whole and in
+# random pieces: live, inside each snapshot taken along the way, after a save and load, and after
+# a restart that replays the journal. size must report the logical length, holes included, and
+# stats the bytes the block store holds.
+import os
+import random
+import subprocess
+import sys
+
+FILES = [f"f{i}" for i in range(4)]
+BLOCK_SIZE = 4096
+
+
+def run(binary, args, lines):
+    script = ("\n".join(lines + ["exit"]) + "\n").encode()
+    result = subprocess.run([binary] + args, input=script, capture_output=True, timeout=600)
+    if result.returncode != 0:
+        raise RuntimeError(f"{binary} {' '.join(args)} exited with {result.returncode}: {result.stderr}")
+    return result.stdout
+
+
+def workload(rng, count):
+    """Returns the commands, the final model and the snapshots as [(name, model copy)]"""
+    model, commands, snapshots = {}, [], []
+    for name in FILES:
+        length = rng.choice([0, 0, rng.randint(1, 100000)])
+        commands.append(f"touch {name} {length}")
+        model[name] = bytearray(length)
+    for i in range(count):
+        if rng.random() < 0.05:
+            snapshots.append((f"s{i}", {name: bytes(data) for name, data in model.items()}))
+            commands.append(f"snapshot s{i}")
+        name = rng.choice(FILES)
+        offset = rng.randint(0, 80000) if rng.random() < 0.9 else rng.randint(200000, 300000)
+        data = "".join(rng.choice("abcdefgh") for _ in range(rng.randint(1, 9000)))
+        commands.append(f"write {name} {offset} {data}")
+        content = model[name]
+        if offset + len(data) > len(content):
+            content.extend(bytes(offset + len(data) - len(content)))
+        content[offset:offset + len(data)] = data.encode()
+    return commands, model, snapshots
+
+
+def dump(rng, model):
+    """Commands that read every file whole and in pieces, and the output they must produce.
+    A read that finds no bytes prints nothing, not even the newline."""
+    def shown(data):
+        return data + b"\n" if data else b""
+
+    lines, expected = [], b""
+    for name, content in model.items():
+        lines += [f"size {name}", f"read {name}"]
+        expected += f"Size of '{name}': {len(content)} bytes\n".encode() + shown(bytes(content))
+        for _ in range(4):
+            offset = rng.randint(0, len(content))
+            length = rng.randint(1, 20000)
+            lines.append(f"read {name} {offset} {length}")
+            expected += shown(bytes(content[offset:offset + length]))
+    return lines, expected
+
+
+def sections(output):
+    """The output between 'MARK' and 'END' lines, which the shell reports as unknown commands"""
+    return [part.split(b"\n", 1)[1] for part in output.split(b"MARK: command not found")[1:]]
+
+
+def section(lines):
+    return ["MARK"] + lines + ["END"]
+
+
+def strip_end(block):
+    return block[:block.rfind(b"END: command not found")]
+
+
+def check_seed(binary, scratch, seed, count):
+    rng = random.Random(seed)
+    commands, model, snapshots = workload(rng, count)
+    image = os.path.join(scratch, f"file_contents_{seed}.img")
+    journal = os.path.join(scratch, f"file_contents_{seed}.jnl")
+    for path in (image, journal):
+        if os.path.exists(path):
+            os.remove(path)
+
+    # Live, then inside every snapshot, then stats
+    lines, expected = [], []
+    part, want = dump(rng, model)
+    lines += section(part)
+    expected.append(want)
+    for name, frozen in snapshots:
+        part, want = dump(rng, frozen)
+        lines += [f"snapshot -v {name}"] + section(part) + ["snapshot -v"]
+        expected.append(want)
+    lines += [f"save {image}", "stats"]
+    output = run(binary, [], commands + lines)
+    ok = True
+    blocks = sections(output)
+    for k, want in enumerate(expected):
+        got = strip_end(blocks[k]) if k < len(blocks) else b""
+        if got != want:
+            where = "live" if k == 0 else f"in snapshot {snapshots[k - 1][0]}"
+            print(f"seed {seed}: contents differ {where} ({len(got)} bytes read, {len(want)} expected)")
+            ok = False
+            break
+
+    # stats counts the blocks in use, snapshot copies included; it can never exceed the logical
+    # lengths of the live files and of every snapshot rounded up to whole blocks
+    stored = [line for line in output.split(b"\n") if line.strip().startswith(b"stored:")]
+    bound = sum((len(content) + BLOCK_SIZE - 1) // BLOCK_SIZE * BLOCK_SIZE
+                for files in [model] + [frozen for _, frozen in snapshots] for content in files.values())
+    if len(stored) != 1 or not 0 < int(stored[0].split()[1]) <= bound:
+        print(f"seed {seed}: stats reports {stored}, expected at most {bound} stored bytes")
+        ok = False
+
+    # The saved image, loaded at startup and with the load command
+    part, want = dump(rng, model)
+    for args, prefix in ((["--image", image], []), ([], [f"load {image}"])):
+        got = sections(run(binary, args, prefix + section(part)))
+        if not got or strip_end(got[0]) != want:
+            print(f"seed {seed}: contents differ after {' '.join(args + prefix)}")
+            ok = False
+
+    # The same writes replayed from a journal on top of an empty image
+    run(binary, [], [f"save {image}"])
+    run(binary, ["--image", image, "--journal", journal], commands)
+    got = sections(run(binary, ["--image", image, "--journal", journal], section(part)))
+    if not got or strip_end(got[0]) != want:
+        print(f"seed {seed}: contents differ after replaying the journal")
+        ok = False
+
+    os.remove(image)
+    os.remove(journal)
+    return ok
+
+
+def main():
+    binary, scratch = sys.argv[1], sys.argv[2]
+    seeds = int(sys.argv[3]) if len(sys.argv) > 3 else 3
+    count = int(sys.argv[4]) if len(sys.argv) > 4 else 400
+    ok = True
+    for seed in range(1, seeds + 1):
+        ok = check_seed(binary, scratch, seed, count) and ok
+    if not ok:
+        sys.exit(1)
+    print(f"file contents: {seeds} seeds passed")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,124 @@
+// Journal failure and group commit tests
+//   journal_test <scratch directory>
+// A short write is simulated with RLIMIT_FSIZE: the write that crosses the limit stores what
+// fits and the next one fails with EFBIG, exactly like a disk filling up in the middle of a group.
+#define main vfs_main
+#include "../A2_Data_Structures.cpp"
+#undef main
+
+#include <csignal>
+#include <sys/resource.h>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                    \
+    do {                                                                                    \
+        if (!(condition)) {                                                                 \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition "\n"; \
+            ++failures;                                                                     \
+        }                                                                                   \
+    } while (0)
+
+static off_t fileSize(const std::string& path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? info.st_size : -1;
+}
+
+// Names of the records in a journal, in order, read back the way startup replays them
+static std::vector<std::string> replayNames(const std::string& path, size_t& dropped) {
+    std::vector<std::string> names;
+    Journal journal;
+    std::string error = journal.open(path, 0, [&](const Journal::Record& record) {
+        names.emplace_back(record.name);
+    });
+    CHECK(error.empty());
+    dropped = journal.dropped();
+    return names;
+}
+
+// A group that fails half-written is cut off and written again by the next commit; the groups
+// committed after it must survive a restart
+static void testFailedCommit(const std::string& dir) {
+    std::string path = dir + "/failed_commit.jnl";
+    unlink(path.c_str());
+    {
+        Journal journal;
+        journal.configure(1, std::chrono::milliseconds(0)); // Every record is its own group
+        CHECK(journal.open(path, 0, [](const Journal::Record&) {}).empty());
+        CHECK(journal.append(Journal::Op::Mkdir, "/", "before"));
+        off_t committed = fileSize(path);
+
+        rlimit original;
+        getrlimit(RLIMIT_FSIZE, &original);
+        rlimit limited = original;
+        limited.rlim_cur = committed + 16;
+        std::signal(SIGXFSZ, SIG_IGN);
+        CHECK(setrlimit(RLIMIT_FSIZE, &limited) == 0);
+        std::string data(200, 'x');
+        CHECK(!journal.append(Journal::Op::Write, "/", "torn", data, 0, 1));
+        CHECK(!journal.append(Journal::Op::Mkdir, "/", "while-full"));
+        CHECK(setrlimit(RLIMIT_FSIZE, &original) == 0);
+
+        // Nothing of the failed groups may stay in the file
+        CHECK(fileSize(path) == committed);
+        CHECK(journal.failed() == 2);
+        CHECK(journal.pendingCount() == 2);
+
+        CHECK(journal.append(Journal::Op::Mkdir, "/", "after"));
+        CHECK(journal.pendingCount() == 0);
+        CHECK(journal.records() == 4);
+    }
+    size_t dropped = 0;
+    std::vector<std::string> names = replayNames(path, dropped);
+    CHECK(dropped == 0);
+    CHECK((names == std::vector<std::string>{"before", "torn", "while-full", "after"}));
+    unlink(path.c_str());
+}
+
+// In batch mode a stalled producer must not hold records back past the group commit window
+static void testBatchWindow(const std::string& dir) {
+    std::string image = dir + "/batch_window.img";
+    std::string path = dir + "/batch_window.jnl";
+    unlink(image.c_str());
+    unlink(path.c_str());
+
+    int input[2];
+    CHECK(pipe(input) == 0);
+    std::ostringstream out;
+    FileSystem vfs(out);
+    Session shell(vfs, out);
+    CHECK(vfs.openJournal(shell, path, image, 64, std::chrono::milliseconds(10)));
+    off_t empty = fileSize(path);
+
+    std::thread batch([&]() { batchLoop(vfs, shell, input[0]); });
+    const char command[] = "mkdir stalled\n";
+    CHECK(::write(input[1], command, sizeof(command) - 1) == static_cast<ssize_t>(sizeof(command) - 1));
+    // The producer stalls; the record is due after 10 ms and must reach the file well within this
+    off_t synced = empty;
+    for (int wait = 0; wait < 200 && synced == empty; ++wait) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        synced = fileSize(path);
+    }
+    CHECK(synced > empty);
+    ::close(input[1]);
+    batch.join();
+    ::close(input[0]);
+
+    size_t dropped = 0;
+    CHECK((replayNames(path, dropped) == std::vector<std::string>{"stalled"}));
+    unlink(image.c_str());
+    unlink(path.c_str());
+}
+
+int main(int argc, char* argv[]) {
+    std::string dir = argc > 1 ? argv[1] : ".";
+    testFailedCommit(dir);
+    testBatchWindow(dir);
+    if (failures > 0) {
+        std::cerr << failures << " checks failed\n";
+        return EXIT_FAILURE;
+    }
+    std::cout << "journal tests passed\n";
+    return EXIT_SUCCESS;
+}
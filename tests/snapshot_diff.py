@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+# Snapshot differential test
+#   snapshot_diff.py <vfs binary> <scratch directory> [seeds] [commands]
+# Runs a random workload that takes and deletes snapshots along the way. For every snapshot still
+# alive at the end, a dump of the live tree taken right when the snapshot was taken (ls, size and
+# find in every directory) must equal the same dump taken inside 'snapshot -v' at the end.
+# The workload runs twice: the first pass lists the directories each dump visits.
+# A last script checks that a session viewing a snapshot cannot change the live tree.
+import difflib
+import os
+import random
+import subprocess
+import sys
+
+DIRS = [f"n{i}" for i in range(12)]
+FILES = [f"f{i}" for i in range(20)]
+
+
+def run(binary, lines):
+    result = subprocess.run([binary], input="\n".join(lines + ["exit"]) + "\n",
+                            capture_output=True, text=True, timeout=600)
+    if result.returncode != 0:
+        raise RuntimeError(f"{binary} exited with {result.returncode}: {result.stderr}")
+    return result.stdout
+
+
+def workload(rng, count):
+    """Returns the commands and the snapshots they take, as {index after the command: name}"""
+    commands, taken, alive = [], {}, []
+    for i in range(count):
+        x = rng.random()
+        if x < 0.18:
+            commands.append("mkdir " + rng.choice(DIRS))
+        elif x < 0.40:
+            commands.append(f"touch {rng.choice(FILES)} {rng.randint(0, 1000)}")
+        elif x < 0.50:
+            commands.append("rm " + " ".join(rng.choice(DIRS + FILES) for _ in range(rng.randint(1, 3))))
+        elif x < 0.56:
+            commands.append("recover" + (" " + rng.choice(DIRS + FILES) if rng.random() < 0.5 else ""))
+        elif x < 0.62:
+            commands.append(f"mv {rng.choice(FILES)} {rng.choice(DIRS)}")
+        elif x < 0.64:
+            commands.append("emptybin")
+        elif x < 0.74:
+            commands.append("cd " + rng.choice(DIRS))
+        elif x < 0.81:
+            commands.append("cd ..")
+        elif x < 0.83:
+            commands.append("cd /")
+        elif x < 0.89:
+            name = f"s{i}"
+            commands.append("snapshot " + name)
+            taken[len(commands)] = name
+            alive.append(name)
+        elif x < 0.91 and len(alive) > 1:
+            victim = rng.choice(alive[:-1])
+            alive.remove(victim)
+            commands.append("snapshot -d " + victim)
+        else:
+            commands.append("ls")
+    return commands, taken, alive
+
+
+def sections(output):
+    """Splits output into the blocks between 'MARK_<name>' and 'MARK_END' lines"""
+    blocks, current = {}, None
+    for line in output.split("\n"):
+        if line.startswith("MARK_END"):
+            current = None
+        elif line.startswith("MARK_"):
+            current = line.split(":")[0][5:]
+            blocks[current] = []
+        elif current is not None:
+            blocks[current].append(line)
+    return blocks
+
+
+def check_seed(binary, seed, count):
+    rng = random.Random(seed)
+    commands, taken, alive = workload(rng, count)
+
+    # Pass 1: the directories of the live tree at each snapshot, from du
+    lines = []
+    for k, command in enumerate(commands, 1):
+        lines.append(command)
+        if k in taken:
+            lines += ["cd /", "MARK_" + taken[k], "du /", "MARK_END"]
+    dirs = {name: [line.split("\t", 1)[1] for line in block if "\t" in line]
+            for name, block in sections(run(binary, lines)).items()}
+
+    def dump(name):
+        lines = ["find *"]
+        for path in dirs[name]:
+            leaf = path.rsplit("/", 1)[-1]
+            lines += ["cd " + path, "ls", "size " + leaf if path != "/" else "pwd", "cd /"]
+        return lines
+
+    # Pass 2: live dumps when each snapshot is taken, dumps inside each snapshot at the end
+    lines = []
+    for k, command in enumerate(commands, 1):
+        lines.append(command)
+        if k in taken and taken[k] in alive:
+            lines += ["cd /", "MARK_L" + taken[k]] + dump(taken[k]) + ["MARK_END"]
+    lines.append("cd /")
+    for name in alive:
+        lines += ["snapshot -v " + name, "MARK_V" + name] + dump(name) + ["MARK_END"]
+    lines.append("snapshot -v")
+    lines += ["snapshot -d " + name for name in alive]
+    output = run(binary, lines)
+    blocks = sections(output)
+
+    ok = True
+    for name in alive:
+        if blocks.get("L" + name) != blocks.get("V" + name):
+            print(f"seed {seed}: snapshot {name} differs from the tree it was taken of")
+            diff = difflib.unified_diff(blocks.get("L" + name, []), blocks.get("V" + name, []), lineterm="")
+            print("\n".join(list(diff)[:40]))
+            ok = False
+            break
+    mismatches = [line for line in output.split("\n") if "mismatch" in line]
+    if mismatches:
+        print(f"seed {seed}: {mismatches[0]}")
+        ok = False
+    return ok
+
+
+# Commands that change the tree are refused inside a snapshot, and leave the live tree alone
+def check_refusals(binary, scratch):
+    image = os.path.join(scratch, "snapshot_diff.img")
+    output = run(binary, [
+        f"save {image}", "mkdir d", "touch x 5", "rm x", "snapshot s", "snapshot -v s",
+        "emptybin", "recover x", "recover ../x", f"load {image}", "touch y 1",
+        "snapshot -v", "showbin", "ls",
+    ])
+    os.remove(image)
+    expected = [f"Error: '{command}' is not available while viewing snapshot 's'."
+                for command in ("emptybin", "recover", "recover", "load", "touch")]
+    refusals = [line for line in output.split("\n") if "while viewing snapshot" in line]
+    ok = refusals == expected and "Bin emptied successfully." not in output and \
+        "Oldest inode in the bin: x" in output and "\td\t" in output and "Loaded" not in output
+    if not ok:
+        print("refusals inside a snapshot:\n" + output)
+    return ok
+
+
+def main():
+    binary, scratch = sys.argv[1], sys.argv[2]
+    seeds = int(sys.argv[3]) if len(sys.argv) > 3 else 3
+    count = int(sys.argv[4]) if len(sys.argv) > 4 else 2000
+    ok = check_refusals(binary, scratch)
+    for seed in range(1, seeds + 1):
+        ok = check_seed(binary, seed, count) and ok
+    if not ok:
+        sys.exit(1)
+    print(f"snapshot diff: {seeds} seeds passed")
+
+
+if __name__ == "__main__":
+    main()